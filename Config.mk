@@ -17,6 +17,10 @@ GC_SECTIONS?=1
 # Compress the kernel
 GZIP_KERNEL?=1
 
+# Host build: also build the synths, and/or enable AddressSanitizer and UndefinedBehaviorSanitizer
+HOST_SYNTHS?=0
+HOST_SANITIZERS?=0
+
 # Toolchain setup
 ifeq ($(BOARD), pi2)
 RASPBERRYPI=2
@@ -96,3 +100,5 @@ FLUIDSYNTHBUILDDIR=build-fluidsynth
 FLUIDSYNTHLIB=$(FLUIDSYNTHBUILDDIR)/src/libfluidsynth.a
 
 INIHHOME=$(realpath external/inih)
+
+HOSTBUILDDIR=build-host
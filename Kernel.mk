@@ -4,12 +4,19 @@
 
 include Config.mk
 
-OBJS		:=	src/config.o \
+OBJS		:=	src/audio/latencycontroller.o \
+			src/audio/mix.o \
+			src/audio/renderaheadqueue.o \
+			src/audio/renderhelper.o \
+			src/audio/sampleconverter.o \
+			src/bufferedfile.o \
+			src/config.o \
 			src/control/control.o \
 			src/control/mister.o \
 			src/control/rotaryencoder.o \
 			src/control/simplebuttons.o \
 			src/control/simpleencoder.o \
+			src/customsysex.o \
 			src/kernel.o \
 			src/lcd/drivers/hd44780.o \
 			src/lcd/drivers/hd44780fourbit.o \
@@ -18,8 +25,10 @@ OBJS		:=	src/config.o \
 			src/lcd/drivers/ssd1306.o \
 			src/lcd/ui.o \
 			src/main.o \
+			src/midieventqueue.o \
 			src/midimonitor.o \
 			src/midiparser.o \
+			src/midirecorder.o \
 			src/mt32pi.o \
 			src/net/applemidi.o \
 			src/net/ftpdaemon.o \
@@ -30,10 +39,14 @@ OBJS		:=	src/config.o \
 			src/rommanager.o \
 			src/soundfontmanager.o \
 			src/synth/mt32synth.o \
+			src/synth/presetcache.o \
+			src/synth/soundfontloader.o \
 			src/synth/soundfontsynth.o \
+			src/synth/splitsynth.o \
 			src/zoneallocator.o
 
 EXTRACLEAN	+=	src/*.d src/*.o \
+			src/audio/*.d src/audio/*.o \
 			src/control/*.d src/control/*.o \
 			src/lcd/*.d src/lcd/*.o \
 			src/lcd/drivers/*.d src/lcd/drivers/*.o \
@@ -0,0 +1,140 @@
+//
+// midiparserbench.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Measures CMIDIParser throughput for the kinds of traffic the inputs see; run with an optional chunk size in bytes
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include <circle/logger.h>
+
+#include "midiparser.h"
+
+using TClock = std::chrono::steady_clock;
+
+constexpr size_t StreamSize = 1024 * 1024;
+constexpr size_t DefaultChunkSize = 64;
+constexpr auto MinRunTime = std::chrono::milliseconds(500);
+
+// Counts messages without doing any work, so that only the parser is measured
+class CCountingHandler : public CMIDIParserHandler
+{
+public:
+	CCountingHandler() : nMessages(0), nBytes(0) {}
+
+	virtual void OnShortMessage(u32 nMessage, u32 nTimestamp) override { ++nMessages; }
+	virtual void OnSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) override { ++nMessages; nBytes += nSize; }
+	virtual void OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) override
+	{
+		nBytes += nSize;
+		if (Fragment == TSysExFragment::End)
+			++nMessages;
+	}
+
+	size_t nMessages;
+	size_t nBytes;
+};
+
+// Note-ons and note-offs under running status, as sent by sequencers
+static std::vector<u8> GenerateNotes(std::mt19937& Random, bool bWithClock)
+{
+	std::vector<u8> Stream;
+
+	while (Stream.size() < StreamSize)
+	{
+		Stream.push_back(0x90 | (Random() & 0x0F));
+		for (size_t i = 0; i < 8; ++i)
+		{
+			Stream.push_back(Random() & 0x7F);
+			Stream.push_back(Random() & 0x7F);
+
+			if (bWithClock && i % 4 == 0)
+				Stream.push_back(0xF8);
+		}
+	}
+
+	return Stream;
+}
+
+// SysEx messages of the given size, e.g. MT-32 patch and timbre uploads or sample dumps
+static std::vector<u8> GenerateSysEx(std::mt19937& Random, size_t nMessageSize)
+{
+	std::vector<u8> Stream;
+
+	while (Stream.size() < StreamSize)
+	{
+		Stream.push_back(0xF0);
+		for (size_t i = 0; i < nMessageSize - 2; ++i)
+			Stream.push_back(Random() & 0x7F);
+		Stream.push_back(0xF7);
+	}
+
+	return Stream;
+}
+
+static void Run(const char* pName, const std::vector<u8>& Stream, size_t nChunkSize, bool bSysExStreaming = false)
+{
+	CCountingHandler Handler;
+	CMIDIParser Parser(&Handler);
+	Parser.SetSysExStreaming(bSysExStreaming);
+
+	size_t nPasses = 0;
+	const TClock::time_point Start = TClock::now();
+	TClock::duration Elapsed;
+
+	do
+	{
+		for (size_t nOffset = 0; nOffset < Stream.size(); nOffset += nChunkSize)
+			Parser.ParseMIDIBytes(Stream.data() + nOffset, std::min(nChunkSize, Stream.size() - nOffset), 0);
+
+		++nPasses;
+		Elapsed = TClock::now() - Start;
+	} while (Elapsed < MinRunTime);
+
+	const double nSeconds = std::chrono::duration<double>(Elapsed).count();
+	printf("%-28s %8.1f MB/s %10.2f M messages/s\n", pName, nPasses * Stream.size() / nSeconds / 1e6, Handler.nMessages / nSeconds / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+	const size_t nChunkSize = argc > 1 ? strtoul(argv[1], nullptr, 10) : DefaultChunkSize;
+	if (!nChunkSize)
+	{
+		fprintf(stderr, "Usage: %s [chunk size]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	CLogger::Get()->SetLogLevel(LogError);
+	std::mt19937 Random(1234);
+
+	printf("Chunk size: %zu bytes\n", nChunkSize);
+	Run("Notes, running status", GenerateNotes(Random, false), nChunkSize);
+	Run("Notes with MIDI clock", GenerateNotes(Random, true), nChunkSize);
+	Run("SysEx, 266 bytes", GenerateSysEx(Random, 266), nChunkSize);
+	Run("SysEx, 16 KB, streamed", GenerateSysEx(Random, 16384), nChunkSize, true);
+
+	return EXIT_SUCCESS;
+}
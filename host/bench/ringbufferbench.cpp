@@ -0,0 +1,97 @@
+//
+// ringbufferbench.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Compares CSPSCRingBuffer with the spin-locked CRingBuffer, moving MIDI bytes between a producer and a consumer thread
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <thread>
+
+#include "ringbuffer.h"
+#include "spscringbuffer.h"
+
+using TClock = std::chrono::steady_clock;
+
+// Same size as the MIDI receive buffer
+constexpr size_t BufferSize = 2048;
+constexpr size_t ItemCount = 16 * 1024 * 1024;
+
+template <class TBuffer>
+static void Run(const char* pName, size_t nChunkSize)
+{
+	static TBuffer Buffer;
+	std::atomic<bool> bStart(false);
+
+	std::thread Producer([&] {
+		u8 Items[BufferSize] = {};
+		size_t nEnqueued = 0;
+
+		while (!bStart.load(std::memory_order_acquire))
+			std::this_thread::yield();
+
+		while (nEnqueued < ItemCount)
+		{
+			const size_t nCount = nChunkSize == 1 ? Buffer.Enqueue(static_cast<u8>(nEnqueued)) : Buffer.Enqueue(Items, nChunkSize);
+
+			// Let the consumer run if the host has fewer cores than threads
+			if (!nCount)
+				std::this_thread::yield();
+
+			nEnqueued += nCount;
+		}
+	});
+
+	u8 Items[BufferSize];
+	size_t nDequeued = 0;
+
+	const TClock::time_point Start = TClock::now();
+	bStart.store(true, std::memory_order_release);
+
+	while (nDequeued < ItemCount)
+	{
+		const size_t nCount = nChunkSize == 1 ? Buffer.Dequeue(Items[0]) : Buffer.Dequeue(Items, nChunkSize);
+		if (!nCount)
+			std::this_thread::yield();
+
+		nDequeued += nCount;
+	}
+
+	const double nSeconds = std::chrono::duration<double>(TClock::now() - Start).count();
+	Producer.join();
+
+	printf("%-28s %5zu bytes/call %10.1f MB/s\n", pName, nChunkSize, ItemCount / nSeconds / 1e6);
+}
+
+int main()
+{
+	for (size_t nChunkSize : { 1, 16, 256 })
+	{
+		Run<CRingBuffer<u8, BufferSize>>("CRingBuffer", nChunkSize);
+		Run<CSPSCRingBuffer<u8, BufferSize>>("CSPSCRingBuffer", nChunkSize);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+//
+// sampleconverterbench.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Measures CSampleConverter throughput against the per-sample loop the audio task used before it
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "audio/sampleconverter.h"
+
+using TClock = std::chrono::steady_clock;
+using TFormat = CSampleConverter::TFormat;
+
+// A typical audio queue
+constexpr size_t BlockFrames = 256;
+constexpr auto MinRunTime = std::chrono::milliseconds(500);
+
+constexpr float Sample24BitMax = (1 << 23) - 1;
+
+// Scalar conversion with no saturation or dither, writing each sample with an overlapping 32-bit store
+static void ConvertLegacy(const float* pInBuffer, u8* pOutBuffer, size_t nFrames, size_t nBytesPerSample, bool bReversedStereo)
+{
+	const size_t nLeft = bReversedStereo ? 1 : 0;
+	const size_t nRight = bReversedStereo ? 0 : 1;
+
+	for (size_t i = 0; i < nFrames * 2; i += 2)
+	{
+		const s32 nLeftSample = pInBuffer[i + nLeft] * Sample24BitMax;
+		const s32 nRightSample = pInBuffer[i + nRight] * Sample24BitMax;
+		memcpy(pOutBuffer + i * nBytesPerSample, &nLeftSample, sizeof(s32));
+		memcpy(pOutBuffer + (i + 1) * nBytesPerSample, &nRightSample, sizeof(s32));
+	}
+}
+
+template <class TConvert>
+static void Run(const char* pName, TConvert Convert)
+{
+	std::mt19937 Random(1234);
+	std::uniform_real_distribution<float> Distribution(-1.0f, 1.0f);
+
+	std::vector<float> Input(BlockFrames * 2);
+	for (float& nSample : Input)
+		nSample = Distribution(Random);
+
+	std::vector<u8> Output(BlockFrames * 2 * sizeof(s32) + CSampleConverter::OutputPadding);
+
+	size_t nBlocks = 0;
+	const TClock::time_point Start = TClock::now();
+	TClock::duration Elapsed;
+
+	do
+	{
+		for (size_t i = 0; i < 1000; ++i)
+			Convert(Input.data(), Output.data(), BlockFrames);
+
+		nBlocks += 1000;
+		Elapsed = TClock::now() - Start;
+	} while (Elapsed < MinRunTime);
+
+	// Keep the stores from being optimized away
+	volatile u8 nSink = Output[0];
+	static_cast<void>(nSink);
+
+	const double nSeconds = std::chrono::duration<double>(Elapsed).count();
+	printf("%-32s %8.1f M frames/s %8.1f ns/block\n", pName, nBlocks * BlockFrames / nSeconds / 1e6, nSeconds * 1e9 / nBlocks);
+}
+
+static void RunConverter(const char* pName, TFormat Format, bool bReversedStereo, bool bDither)
+{
+	CSampleConverter Converter(Format, bReversedStereo, bDither);
+	Run(pName, [&](const float* pIn, u8* pOut, size_t nFrames) { Converter.Convert(pIn, pOut, nFrames); });
+}
+
+int main()
+{
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	printf("Block size: %zu frames (NEON)\n", BlockFrames);
+#else
+	printf("Block size: %zu frames (scalar)\n", BlockFrames);
+#endif
+
+	Run("Legacy, 24-bit packed", [](const float* pIn, u8* pOut, size_t nFrames) { ConvertLegacy(pIn, pOut, nFrames, 3, false); });
+	Run("Legacy, 24-in-32", [](const float* pIn, u8* pOut, size_t nFrames) { ConvertLegacy(pIn, pOut, nFrames, sizeof(s32), false); });
+	Run("Legacy, 24-in-32, swapped", [](const float* pIn, u8* pOut, size_t nFrames) { ConvertLegacy(pIn, pOut, nFrames, sizeof(s32), true); });
+
+	RunConverter("Converter, 24-bit packed", TFormat::Signed24, false, false);
+	RunConverter("Converter, 24-in-32", TFormat::Signed24_32, false, false);
+	RunConverter("Converter, 24-in-32, swapped", TFormat::Signed24_32, true, false);
+	RunConverter("Converter, 24-bit packed, dither", TFormat::Signed24, false, true);
+	RunConverter("Converter, 24-in-32, dither", TFormat::Signed24_32, false, true);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,348 @@
+//
+// ff.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FatFs and POSIX both have a DIR type
+#define DIR FF_DIR
+#include <fatfs/ff.h>
+#undef DIR
+
+namespace
+{
+	std::mutex VolumeMutex;
+	std::map<std::string, std::string> Volumes = { { "SD", "." } };
+
+	FRESULT ToHostPath(const TCHAR* pPath, std::string& HostPath)
+	{
+		std::string Volume = "SD";
+		const char* pColon = strchr(pPath, ':');
+		if (pColon)
+		{
+			Volume.assign(pPath, pColon - pPath);
+			pPath = pColon + 1;
+		}
+
+		while (*pPath == '/')
+			++pPath;
+
+		std::lock_guard<std::mutex> Lock(VolumeMutex);
+		const auto Iterator = Volumes.find(Volume);
+		if (Iterator == Volumes.end())
+			return FR_NOT_READY;
+
+		HostPath = Iterator->second;
+		if (*pPath)
+		{
+			HostPath += '/';
+			HostPath += pPath;
+		}
+
+		return FR_OK;
+	}
+
+	FRESULT FromErrno()
+	{
+		switch (errno)
+		{
+			case ENOENT:
+				return FR_NO_FILE;
+			case ENOTDIR:
+				return FR_NO_PATH;
+			case EACCES:
+			case EPERM:
+				return FR_DENIED;
+			case EEXIST:
+				return FR_EXIST;
+			case EROFS:
+				return FR_WRITE_PROTECTED;
+			case ENAMETOOLONG:
+				return FR_INVALID_NAME;
+			case EMFILE:
+			case ENFILE:
+				return FR_TOO_MANY_OPEN_FILES;
+			default:
+				return FR_DISK_ERR;
+		}
+	}
+
+	void FillFileInfo(const char* pName, const struct stat& Stat, FILINFO* pInfo)
+	{
+		struct tm Time;
+		localtime_r(&Stat.st_mtime, &Time);
+
+		pInfo->fsize = S_ISDIR(Stat.st_mode) ? 0 : Stat.st_size;
+		pInfo->fdate = ((Time.tm_year - 80) << 9) | ((Time.tm_mon + 1) << 5) | Time.tm_mday;
+		pInfo->ftime = (Time.tm_hour << 11) | (Time.tm_min << 5) | (Time.tm_sec / 2);
+		pInfo->fattrib = S_ISDIR(Stat.st_mode) ? AM_DIR : AM_ARC;
+		if (!(Stat.st_mode & S_IWUSR))
+			pInfo->fattrib |= AM_RDO;
+		pInfo->altname[0] = '\0';
+		strncpy(pInfo->fname, pName, FF_LFN_BUF);
+		pInfo->fname[FF_LFN_BUF] = '\0';
+	}
+}
+
+FRESULT f_open(FIL* fp, const TCHAR* path, BYTE mode)
+{
+	std::string HostPath;
+	const FRESULT Result = ToHostPath(path, HostPath);
+	if (Result != FR_OK)
+		return Result;
+
+	int nFlags = (mode & FA_WRITE) ? ((mode & FA_READ) ? O_RDWR : O_WRONLY) : O_RDONLY;
+	if ((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND || (mode & FA_OPEN_ALWAYS))
+		nFlags |= O_CREAT;
+	else if (mode & FA_CREATE_ALWAYS)
+		nFlags |= O_CREAT | O_TRUNC;
+	else if (mode & FA_CREATE_NEW)
+		nFlags |= O_CREAT | O_EXCL;
+
+	const int nFile = open(HostPath.c_str(), nFlags, 0644);
+	if (nFile < 0)
+		return FromErrno();
+
+	struct stat Stat;
+	if (fstat(nFile, &Stat) < 0 || S_ISDIR(Stat.st_mode))
+	{
+		close(nFile);
+		return FR_NO_FILE;
+	}
+
+	FILE* pFile = fdopen(nFile, (mode & FA_WRITE) ? ((mode & FA_READ) ? "r+b" : "wb") : "rb");
+	if (!pFile)
+	{
+		close(nFile);
+		return FR_DISK_ERR;
+	}
+
+	fp->obj.objsize = Stat.st_size;
+	fp->fptr = 0;
+	fp->pHostFile = pFile;
+
+	if ((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND)
+		return f_lseek(fp, fp->obj.objsize);
+
+	return FR_OK;
+}
+
+FRESULT f_close(FIL* fp)
+{
+	if (!fp->pHostFile)
+		return FR_INVALID_OBJECT;
+
+	const bool bResult = fclose(static_cast<FILE*>(fp->pHostFile)) == 0;
+	fp->pHostFile = nullptr;
+	return bResult ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br)
+{
+	FILE* pFile = static_cast<FILE*>(fp->pHostFile);
+	*br = fread(buff, 1, btr, pFile);
+	fp->fptr += *br;
+	return ferror(pFile) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_write(FIL* fp, const void* buff, UINT btw, UINT* bw)
+{
+	FILE* pFile = static_cast<FILE*>(fp->pHostFile);
+	*bw = fwrite(buff, 1, btw, pFile);
+	fp->fptr += *bw;
+	if (fp->fptr > fp->obj.objsize)
+		fp->obj.objsize = fp->fptr;
+	return ferror(pFile) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs)
+{
+	if (fseeko(static_cast<FILE*>(fp->pHostFile), ofs, SEEK_SET) < 0)
+		return FR_DISK_ERR;
+
+	fp->fptr = ofs;
+	if (fp->fptr > fp->obj.objsize)
+		fp->obj.objsize = fp->fptr;
+	return FR_OK;
+}
+
+FRESULT f_sync(FIL* fp)
+{
+	return fflush(static_cast<FILE*>(fp->pHostFile)) == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_opendir(FF_DIR* dp, const TCHAR* path)
+{
+	std::string HostPath;
+	const FRESULT Result = ToHostPath(path, HostPath);
+	if (Result != FR_OK)
+		return Result;
+
+	if (HostPath.size() >= sizeof(dp->HostPath))
+		return FR_INVALID_NAME;
+
+	::DIR* pDir = opendir(HostPath.c_str());
+	if (!pDir)
+		return errno == ENOENT ? FR_NO_PATH : FromErrno();
+
+	dp->pHostDir = pDir;
+	strcpy(dp->HostPath, HostPath.c_str());
+	strcpy(dp->Pattern, "*");
+	return FR_OK;
+}
+
+FRESULT f_closedir(FF_DIR* dp)
+{
+	if (!dp->pHostDir)
+		return FR_INVALID_OBJECT;
+
+	closedir(static_cast<::DIR*>(dp->pHostDir));
+	dp->pHostDir = nullptr;
+	return FR_OK;
+}
+
+FRESULT f_readdir(FF_DIR* dp, FILINFO* fno)
+{
+	while (const dirent* pEntry = readdir(static_cast<::DIR*>(dp->pHostDir)))
+	{
+		if (!strcmp(pEntry->d_name, ".") || !strcmp(pEntry->d_name, ".."))
+			continue;
+
+		if (fnmatch(dp->Pattern, pEntry->d_name, FNM_CASEFOLD) != 0)
+			continue;
+
+		const std::string EntryPath = std::string(dp->HostPath) + '/' + pEntry->d_name;
+		struct stat Stat;
+		if (stat(EntryPath.c_str(), &Stat) < 0)
+			continue;
+
+		FillFileInfo(pEntry->d_name, Stat, fno);
+		return FR_OK;
+	}
+
+	// End of directory
+	fno->fname[0] = '\0';
+	return FR_OK;
+}
+
+FRESULT f_findfirst(FF_DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern)
+{
+	const FRESULT Result = f_opendir(dp, path);
+	if (Result != FR_OK)
+		return Result;
+
+	strncpy(dp->Pattern, pattern, FF_MAX_LFN);
+	dp->Pattern[FF_MAX_LFN] = '\0';
+	return f_readdir(dp, fno);
+}
+
+FRESULT f_findnext(FF_DIR* dp, FILINFO* fno)
+{
+	return f_readdir(dp, fno);
+}
+
+FRESULT f_mkdir(const TCHAR* path)
+{
+	std::string HostPath;
+	const FRESULT Result = ToHostPath(path, HostPath);
+	if (Result != FR_OK)
+		return Result;
+
+	return mkdir(HostPath.c_str(), 0755) == 0 ? FR_OK : FromErrno();
+}
+
+FRESULT f_unlink(const TCHAR* path)
+{
+	std::string HostPath;
+	const FRESULT Result = ToHostPath(path, HostPath);
+	if (Result != FR_OK)
+		return Result;
+
+	return remove(HostPath.c_str()) == 0 ? FR_OK : FromErrno();
+}
+
+FRESULT f_rename(const TCHAR* path_old, const TCHAR* path_new)
+{
+	std::string OldPath, NewPath;
+	FRESULT Result = ToHostPath(path_old, OldPath);
+	if (Result != FR_OK)
+		return Result;
+
+	// FatFs doesn't replace existing files
+	Result = ToHostPath(path_new, NewPath);
+	if (Result != FR_OK)
+		return Result;
+
+	struct stat Stat;
+	if (stat(NewPath.c_str(), &Stat) == 0)
+		return FR_EXIST;
+
+	return rename(OldPath.c_str(), NewPath.c_str()) == 0 ? FR_OK : FromErrno();
+}
+
+FRESULT f_stat(const TCHAR* path, FILINFO* fno)
+{
+	std::string HostPath;
+	const FRESULT Result = ToHostPath(path, HostPath);
+	if (Result != FR_OK)
+		return Result;
+
+	struct stat Stat;
+	if (stat(HostPath.c_str(), &Stat) < 0)
+		return FromErrno();
+
+	const size_t nSlash = HostPath.rfind('/');
+	FillFileInfo(HostPath.c_str() + (nSlash == std::string::npos ? 0 : nSlash + 1), Stat, fno);
+	return FR_OK;
+}
+
+FRESULT f_mount(FATFS* fs, const TCHAR* path, BYTE opt)
+{
+	std::string HostPath;
+	return ToHostPath(path, HostPath);
+}
+
+FRESULT f_unmount(const TCHAR* path)
+{
+	return FR_OK;
+}
+
+FRESULT f_hostmap(const TCHAR* volume, const char* host_path)
+{
+	std::lock_guard<std::mutex> Lock(VolumeMutex);
+	if (host_path)
+		Volumes[volume] = host_path;
+	else
+		Volumes.erase(volume);
+	return FR_OK;
+}
@@ -0,0 +1,67 @@
+//
+// logger.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Host shim for Circle's logger; messages are written to stderr
+
+#ifndef _circle_logger_h
+#define _circle_logger_h
+
+#include <cstdarg>
+
+#include <circle/spinlock.h>
+#include <circle/string.h>
+#include <circle/types.h>
+
+enum TLogSeverity
+{
+	LogPanic,
+	LogError,
+	LogWarning,
+	LogNotice,
+	LogDebug
+};
+
+class CLogger
+{
+public:
+	CLogger(unsigned nLogLevel);
+
+	void Write(const char* pSource, TLogSeverity Severity, const char* pMessage, ...);
+	void WriteV(const char* pSource, TLogSeverity Severity, const char* pMessage, va_list Args);
+
+	// Host only: messages above this severity are discarded
+	void SetLogLevel(unsigned nLogLevel) { m_nLogLevel = nLogLevel; }
+
+	static CLogger* Get();
+
+private:
+	unsigned m_nLogLevel;
+};
+
+#define LOGMODULE(name) static const char From[] = name
+#define LOGPANIC(...) CLogger::Get()->Write(From, LogPanic, __VA_ARGS__)
+#define LOGERR(...) CLogger::Get()->Write(From, LogError, __VA_ARGS__)
+#define LOGWARN(...) CLogger::Get()->Write(From, LogWarning, __VA_ARGS__)
+#define LOGNOTE(...) CLogger::Get()->Write(From, LogNotice, __VA_ARGS__)
+#define LOGDBG(...) CLogger::Get()->Write(From, LogDebug, __VA_ARGS__)
+
+#endif
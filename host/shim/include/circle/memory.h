@@ -0,0 +1,50 @@
+//
+// memory.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Host shim for Circle's memory system; the heaps are carved out of the host's heap
+
+#ifndef _circle_memory_h
+#define _circle_memory_h
+
+#include <circle/alloc.h>
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+
+class CMemorySystem
+{
+public:
+	void* HeapAllocate(size_t nSize, int nType);
+	void HeapFree(void* pBlock);
+	size_t GetHeapFreeSpace(int nType) const;
+
+	// Host only: the size reported for HEAP_LOW, which CZoneAllocator takes most of
+	void SetHeapSize(size_t nSize) { m_nHeapSize = nSize; }
+
+	static CMemorySystem* Get();
+
+private:
+	CMemorySystem();
+
+	size_t m_nHeapSize;
+};
+
+#endif
@@ -0,0 +1,41 @@
+//
+// multicore.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Host shim for Circle's multi-core support; each core is stood in for by a thread
+
+#ifndef _circle_multicore_h
+#define _circle_multicore_h
+
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+
+class CMultiCoreSupport
+{
+public:
+	// The core the calling thread stands in for; 0 unless set with SetThisCore()
+	static unsigned ThisCore();
+
+	// Host only
+	static void SetThisCore(unsigned nCore);
+};
+
+#endif
@@ -0,0 +1,47 @@
+//
+// ipaddress.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Host shim for Circle's IP address class; only what the configuration needs
+
+#ifndef _circle_net_ipaddress_h
+#define _circle_net_ipaddress_h
+
+#include <cstring>
+
+#include <circle/types.h>
+
+class CIPAddress
+{
+public:
+	CIPAddress() : m_Address{} {}
+	CIPAddress(u32 nAddress) { Set(nAddress); }
+
+	void Set(u32 nAddress) { memcpy(m_Address, &nAddress, sizeof(m_Address)); }
+	void Set(const u8* pAddress) { memcpy(m_Address, pAddress, sizeof(m_Address)); }
+
+	const u8* Get() const { return m_Address; }
+
+private:
+	u8 m_Address[4];
+};
+
+#endif
@@ -0,0 +1,43 @@
+//
+// synchronize.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Host shim for Circle's synchronization levels and barriers
+
+#ifndef _circle_synchronize_h
+#define _circle_synchronize_h
+
+#include <atomic>
+
+#include <circle/sysconfig.h>
+
+#define TASK_LEVEL 0
+#define IRQ_LEVEL 1
+#define FIQ_LEVEL 2
+
+// There are no interrupts on the host; code that masks them only needs to be free of data races
+#define EnterCritical(...) ((void)0)
+#define LeaveCritical() ((void)0)
+
+#define DataSyncBarrier() std::atomic_thread_fence(std::memory_order_seq_cst)
+#define DataMemBarrier() std::atomic_thread_fence(std::memory_order_seq_cst)
+
+#endif
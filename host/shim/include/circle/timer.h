@@ -0,0 +1,54 @@
+//
+// timer.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Host shim for Circle's system timer
+
+#ifndef _circle_timer_h
+#define _circle_timer_h
+
+#include <circle/types.h>
+
+#define HZ 100
+#define CLOCKHZ 1000000
+
+#define MSEC2HZ(msec) ((msec) * HZ / 1000)
+
+class CTimer
+{
+public:
+	// Microseconds from a monotonic clock, wrapping like the Pi's free-running 1MHz counter
+	static unsigned GetClockTicks();
+
+	// Ticks of HZ since the clock started
+	unsigned GetTicks() const { return GetClockTicks() / (CLOCKHZ / HZ); }
+
+	static void SimpleMsDelay(unsigned nMilliSeconds);
+	static void SimpleusDelay(unsigned nMicroSeconds);
+
+	static CTimer* Get();
+
+	// Host only: replaces the clock, e.g. with a fake one for deterministic tests; nullptr restores the real clock
+	using TClockSource = unsigned (*)();
+	static void SetClockSource(TClockSource pClockSource);
+};
+
+#endif
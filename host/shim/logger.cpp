@@ -0,0 +1,60 @@
+//
+// logger.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdio>
+#include <mutex>
+
+#include <circle/logger.h>
+
+static const char* const SeverityNames[] = { "PANIC", "ERROR", "WARN", "NOTE", "DEBUG" };
+static std::mutex OutputMutex;
+
+CLogger::CLogger(unsigned nLogLevel)
+	: m_nLogLevel(nLogLevel)
+{
+}
+
+void CLogger::Write(const char* pSource, TLogSeverity Severity, const char* pMessage, ...)
+{
+	va_list Args;
+	va_start(Args, pMessage);
+	WriteV(pSource, Severity, pMessage, Args);
+	va_end(Args);
+}
+
+void CLogger::WriteV(const char* pSource, TLogSeverity Severity, const char* pMessage, va_list Args)
+{
+	if (static_cast<unsigned>(Severity) > m_nLogLevel)
+		return;
+
+	char Buffer[1024];
+	vsnprintf(Buffer, sizeof(Buffer), pMessage, Args);
+
+	std::lock_guard<std::mutex> Lock(OutputMutex);
+	fprintf(stderr, "%s: %s: %s\n", SeverityNames[Severity], pSource, Buffer);
+}
+
+CLogger* CLogger::Get()
+{
+	static CLogger Logger(LogNotice);
+	return &Logger;
+}
@@ -0,0 +1,55 @@
+//
+// memory.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdlib>
+
+#include <circle/memory.h>
+
+// Enough for large SoundFonts; pages are only committed by the host OS when they're touched
+constexpr size_t DefaultHeapSize = 1024 * MEGABYTE;
+
+CMemorySystem::CMemorySystem()
+	: m_nHeapSize(DefaultHeapSize)
+{
+}
+
+void* CMemorySystem::HeapAllocate(size_t nSize, int nType)
+{
+	return aligned_alloc(16, (nSize + 15) & ~static_cast<size_t>(15));
+}
+
+void CMemorySystem::HeapFree(void* pBlock)
+{
+	free(pBlock);
+}
+
+size_t CMemorySystem::GetHeapFreeSpace(int nType) const
+{
+	// No high memory region, like a Pi with 1GB of RAM or less
+	return nType == HEAP_HIGH ? 0 : m_nHeapSize;
+}
+
+CMemorySystem* CMemorySystem::Get()
+{
+	static CMemorySystem MemorySystem;
+	return &MemorySystem;
+}
@@ -0,0 +1,233 @@
+//
+// scheduler.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <circle/sched/scheduler.h>
+
+using TClock = std::chrono::steady_clock;
+
+struct TTaskRecord
+{
+	CTask* pTask;
+	bool bStarted;
+	bool bTerminated;
+	TClock::time_point WakeTime;
+};
+
+namespace
+{
+	// Never destroyed; task threads may still be waiting on it when the process exits
+	struct TSchedulerState
+	{
+		std::mutex Mutex;
+		std::condition_variable Condition;
+		std::vector<TTaskRecord*> Tasks;
+		TTaskRecord* pCurrent = nullptr;
+	};
+
+	TSchedulerState& State()
+	{
+		static TSchedulerState* pState = new TSchedulerState;
+		return *pState;
+	}
+
+	CScheduler* pScheduler = nullptr;
+	thread_local TTaskRecord* pThisTask = nullptr;
+
+	// Round-robin; the task that is switching away is only picked again if nothing else is ready
+	TTaskRecord* PickNext(TTaskRecord* pFrom, TClock::time_point Now)
+	{
+		std::vector<TTaskRecord*>& Tasks = State().Tasks;
+		size_t nFrom = 0;
+		while (Tasks[nFrom] != pFrom)
+			++nFrom;
+
+		for (size_t i = 1; i <= Tasks.size(); ++i)
+		{
+			TTaskRecord* pTask = Tasks[(nFrom + i) % Tasks.size()];
+			if (pTask->bStarted && !pTask->bTerminated && pTask->WakeTime <= Now)
+				return pTask;
+		}
+
+		return nullptr;
+	}
+
+	// Called with the lock held by the current task; returns once another task has handed control back
+	void SwitchAway(std::unique_lock<std::mutex>& Lock, bool bTerminating)
+	{
+		TSchedulerState& S = State();
+		TTaskRecord* pSelf = pThisTask;
+
+		while (true)
+		{
+			const TClock::time_point Now = TClock::now();
+			TTaskRecord* pNext = PickNext(pSelf, Now);
+
+			if (pNext == pSelf)
+				return;
+
+			if (pNext)
+			{
+				S.pCurrent = pNext;
+				S.Condition.notify_all();
+				if (!bTerminating)
+					S.Condition.wait(Lock, [pSelf, &S] { return S.pCurrent == pSelf; });
+				return;
+			}
+
+			// Every task is sleeping; idle until the first one is due
+			TClock::time_point WakeTime = TClock::time_point::max();
+			for (TTaskRecord* pTask : S.Tasks)
+				if (pTask->bStarted && !pTask->bTerminated && pTask->WakeTime < WakeTime)
+					WakeTime = pTask->WakeTime;
+
+			Lock.unlock();
+			std::this_thread::sleep_until(WakeTime);
+			Lock.lock();
+		}
+	}
+
+	void Sleep(std::chrono::microseconds Duration)
+	{
+		if (!pThisTask)
+		{
+			std::this_thread::sleep_for(Duration);
+			return;
+		}
+
+		std::unique_lock<std::mutex> Lock(State().Mutex);
+		pThisTask->WakeTime = TClock::now() + Duration;
+		SwitchAway(Lock, false);
+	}
+}
+
+CTask::CTask(unsigned nStackSize, bool bCreateSuspended)
+	: m_pRecord(new TTaskRecord{this, false, false, TClock::time_point()})
+{
+	if (!bCreateSuspended)
+		Start();
+}
+
+CTask::~CTask()
+{
+	// The record is kept, as the task's thread may still refer to it
+	std::lock_guard<std::mutex> Lock(State().Mutex);
+	m_pRecord->bTerminated = true;
+}
+
+void CTask::Run()
+{
+}
+
+void CTask::Start()
+{
+	TSchedulerState& S = State();
+	std::lock_guard<std::mutex> Lock(S.Mutex);
+
+	if (m_pRecord->bStarted)
+		return;
+
+	m_pRecord->bStarted = true;
+	S.Tasks.push_back(m_pRecord);
+
+	TTaskRecord* pRecord = m_pRecord;
+	std::thread([pRecord] {
+		TSchedulerState& S = State();
+		pThisTask = pRecord;
+
+		{
+			std::unique_lock<std::mutex> Lock(S.Mutex);
+			S.Condition.wait(Lock, [pRecord, &S] { return S.pCurrent == pRecord; });
+			if (pRecord->bTerminated)
+			{
+				SwitchAway(Lock, true);
+				return;
+			}
+		}
+
+		pRecord->pTask->Run();
+
+		std::unique_lock<std::mutex> Lock(S.Mutex);
+		pRecord->bTerminated = true;
+		SwitchAway(Lock, true);
+	}).detach();
+}
+
+CScheduler::CScheduler()
+{
+	assert(pScheduler == nullptr);
+	pScheduler = this;
+
+	// The creating thread is the main task
+	TSchedulerState& S = State();
+	std::lock_guard<std::mutex> Lock(S.Mutex);
+	pThisTask = new TTaskRecord{nullptr, true, false, TClock::time_point()};
+	S.Tasks.push_back(pThisTask);
+	S.pCurrent = pThisTask;
+}
+
+CScheduler::~CScheduler()
+{
+	pScheduler = nullptr;
+}
+
+void CScheduler::Yield()
+{
+	if (!pThisTask)
+	{
+		std::this_thread::yield();
+		return;
+	}
+
+	std::unique_lock<std::mutex> Lock(State().Mutex);
+	SwitchAway(Lock, false);
+}
+
+void CScheduler::Sleep(unsigned nSeconds)
+{
+	::Sleep(std::chrono::seconds(nSeconds));
+}
+
+void CScheduler::MsSleep(unsigned nMilliSeconds)
+{
+	::Sleep(std::chrono::milliseconds(nMilliSeconds));
+}
+
+void CScheduler::usSleep(unsigned nMicroSeconds)
+{
+	::Sleep(std::chrono::microseconds(nMicroSeconds));
+}
+
+CTask* CScheduler::GetCurrentTask()
+{
+	return pThisTask ? pThisTask->pTask : nullptr;
+}
+
+CScheduler* CScheduler::Get()
+{
+	return pScheduler;
+}
@@ -0,0 +1,60 @@
+//
+// timer.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <circle/timer.h>
+
+static std::atomic<CTimer::TClockSource> ClockSource(nullptr);
+
+unsigned CTimer::GetClockTicks()
+{
+	const TClockSource pClockSource = ClockSource.load(std::memory_order_relaxed);
+	if (pClockSource)
+		return pClockSource();
+
+	const auto Now = std::chrono::steady_clock::now().time_since_epoch();
+	return static_cast<unsigned>(std::chrono::duration_cast<std::chrono::microseconds>(Now).count());
+}
+
+void CTimer::SimpleMsDelay(unsigned nMilliSeconds)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(nMilliSeconds));
+}
+
+void CTimer::SimpleusDelay(unsigned nMicroSeconds)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(nMicroSeconds));
+}
+
+CTimer* CTimer::Get()
+{
+	static CTimer Timer;
+	return &Timer;
+}
+
+void CTimer::SetClockSource(TClockSource pClockSource)
+{
+	ClockSource.store(pClockSource, std::memory_order_relaxed);
+}
@@ -0,0 +1,212 @@
+//
+// midimonitortest.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <thread>
+
+#include <circle/spinlock.h>
+#include <circle/timer.h>
+#include <circle/types.h>
+
+#include "utility.h"
+
+// Snapshots are private; the test checks them directly
+#define private public
+#include "midimonitor.h"
+#undef private
+
+#include "test.h"
+
+TEST_DEFINE_FAILURE_COUNT;
+
+// The MIDI and render cores write to the monitor while the UI reads channel snapshots. One writer plays notes and
+// releases them all at once; the other cycles volume and expression. A snapshot that copies part of a write shows
+// notes or controller values that never existed together.
+
+constexpr unsigned int StressTimeMillis = 1000;
+constexpr unsigned int NotesPerRelease = 64;
+
+constexpr u8 LowVolume = 50;
+constexpr u8 LowExpression = 20;
+
+static std::atomic<unsigned int> nClockTicks(1);
+
+static unsigned int GetTestTicks()
+{
+	return nClockTicks.load(std::memory_order_relaxed);
+}
+
+// Plays notes on channels 0-7 with ever-increasing timestamps, then releases every note on every channel in one write
+static void NoteWriter(CMIDIMonitor& Monitor, const std::atomic<bool>& bStop, size_t& nWrites)
+{
+	u8 nNote = 0;
+
+	while (!bStop.load(std::memory_order_relaxed))
+	{
+		for (unsigned int i = 0; i < NotesPerRelease; ++i)
+		{
+			const u8 nChannel = i & 7;
+			nNote = (nNote + 37) & 0x7F;
+
+			nClockTicks.fetch_add(1, std::memory_order_relaxed);
+			Monitor.OnShortMessage(0x90 | nChannel | nNote << 8 | 100 << 16);
+			++nWrites;
+		}
+
+		nClockTicks.fetch_add(1, std::memory_order_relaxed);
+		Monitor.AllNotesOff();
+		++nWrites;
+	}
+}
+
+// Lowers volume, then expression, then resets both in one write
+static void ControllerWriter(CMIDIMonitor& Monitor, const std::atomic<bool>& bStop, size_t& nWrites)
+{
+	while (!bStop.load(std::memory_order_relaxed))
+	{
+		for (u8 nChannel = 0; nChannel < 16; ++nChannel)
+			Monitor.OnShortMessage(0xB0 | nChannel | 0x07 << 8 | LowVolume << 16);
+
+		for (u8 nChannel = 0; nChannel < 16; ++nChannel)
+			Monitor.OnShortMessage(0xB0 | nChannel | 0x0B << 8 | LowExpression << 16);
+
+		Monitor.ResetControllers(false);
+		nWrites += 33;
+	}
+}
+
+static bool IsConsistent(const CMIDIMonitor::TChannelSnapshot& Snapshot)
+{
+	// Reset restores both controllers at once, so full volume never appears with lowered expression
+	if (Snapshot.nVolume == 100 && Snapshot.nExpression == LowExpression)
+		return false;
+
+	// A release catches every playing note, so any note still on must have started after the latest release
+	unsigned int nLatestNoteOff = 0;
+	unsigned int nEarliestNoteOn = UINT_MAX;
+
+	for (size_t i = 0; i < Snapshot.nNotes; ++i)
+	{
+		const CMIDIMonitor::TNoteState& NoteState = Snapshot.Notes[i];
+
+		if (NoteState.EnvelopePhase == CMIDIMonitor::TEnvelopePhase::NoteOff)
+			nLatestNoteOff = Utility::Max(nLatestNoteOff, NoteState.nNoteOffTime);
+		else if (NoteState.EnvelopePhase == CMIDIMonitor::TEnvelopePhase::NoteOn)
+			nEarliestNoteOn = Utility::Min(nEarliestNoteOn, NoteState.nNoteOnTime);
+	}
+
+	return nEarliestNoteOn > nLatestNoteOff;
+}
+
+static size_t CountActiveNotes(const CMIDIMonitor& Monitor, u8 nChannel)
+{
+	size_t nNotes = 0;
+	for (u32 nWord : Monitor.m_State[nChannel].ActiveNotes)
+		nNotes += __builtin_popcount(nWord);
+
+	return nNotes;
+}
+
+// Finished notes are removed from every channel, not only from the channel of the latest message
+static void TestPruning()
+{
+	CMIDIMonitor Monitor;
+	float Levels[16], Peaks[16];
+
+	// Drums are often never released; a melodic note is released, then its channel goes quiet; another is held
+	Monitor.OnShortMessage(0x99 | 36 << 8 | 100 << 16);
+	Monitor.OnShortMessage(0x93 | 60 << 8 | 100 << 16);
+	Monitor.OnShortMessage(0x83 | 60 << 8);
+	Monitor.OnShortMessage(0x94 | 64 << 8 | 100 << 16);
+	Monitor.GetChannelLevels(GetTestTicks(), Levels, Peaks, 1 << 9);
+
+	CHECK(CountActiveNotes(Monitor, 9) == 1);
+	CHECK(CountActiveNotes(Monitor, 3) == 1);
+	CHECK(CountActiveNotes(Monitor, 4) == 1);
+
+	// Once every envelope but the held note's has finished, any message prunes them
+	nClockTicks.fetch_add(Utility::MillisToTicks(1000), std::memory_order_relaxed);
+	Monitor.OnShortMessage(0xB0 | 0x07 << 8 | 100 << 16);
+
+	CHECK(CountActiveNotes(Monitor, 9) == 0);
+	CHECK(CountActiveNotes(Monitor, 3) == 0);
+	CHECK(CountActiveNotes(Monitor, 4) == 1);
+}
+
+int main()
+{
+	CTimer::SetClockSource(GetTestTicks);
+
+	TestPruning();
+
+	CMIDIMonitor Monitor;
+	std::atomic<bool> bStop(false);
+	size_t nNoteWrites = 0, nControllerWrites = 0;
+
+	std::thread NoteThread(NoteWriter, std::ref(Monitor), std::cref(bStop), std::ref(nNoteWrites));
+	std::thread ControllerThread(ControllerWriter, std::ref(Monitor), std::cref(bStop), std::ref(nControllerWrites));
+
+	// Large enough to be on the heap
+	auto* pSnapshot = new CMIDIMonitor::TChannelSnapshot;
+	float Levels[16], Peaks[16];
+	size_t nReads = 0, nTornReads = 0, nNotesSeen = 0, nLevelErrors = 0;
+	const auto EndTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(StressTimeMillis);
+
+	while (std::chrono::steady_clock::now() < EndTime)
+	{
+		for (u8 nChannel = 0; nChannel < 8; ++nChannel)
+		{
+			Monitor.ReadChannel(nChannel, *pSnapshot);
+
+			if (!IsConsistent(*pSnapshot))
+				++nTornReads;
+
+			nNotesSeen += pSnapshot->nNotes;
+			++nReads;
+		}
+
+		Monitor.GetChannelLevels(GetTestTicks(), Levels, Peaks, 1 << 9);
+		for (size_t i = 0; i < 16; ++i)
+		{
+			if (Levels[i] < 0.0f || Levels[i] > 1.0f || Peaks[i] < Levels[i])
+				++nLevelErrors;
+		}
+	}
+
+	bStop = true;
+	NoteThread.join();
+	ControllerThread.join();
+
+	fprintf(stderr, "%zu reads (%zu notes), %zu + %zu writes\n", nReads, nNotesSeen, nNoteWrites, nControllerWrites);
+
+	CHECK(nTornReads == 0);
+	CHECK(nLevelErrors == 0);
+	CHECK(nReads > 0 && nNotesSeen > 0);
+	CHECK(nNoteWrites > 0 && nControllerWrites > 0);
+
+	delete pSnapshot;
+	CTimer::SetClockSource(nullptr);
+
+	return Test::Result("midimonitortest");
+}
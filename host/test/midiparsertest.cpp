@@ -0,0 +1,592 @@
+//
+// midiparsertest.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <circle/logger.h>
+
+#include "customsysex.h"
+#include "midiparser.h"
+#include "test.h"
+
+TEST_DEFINE_FAILURE_COUNT;
+
+// Random MIDI streams, split into random chunks, are fed to CMIDIParser and to a byte-at-a-time reference model of
+// the same rules; both must report the same messages. Byte captures given on the command line are replayed the same
+// way.
+
+constexpr size_t RandomStreamCount = 2000;
+constexpr size_t MaxChunkSize = 300;
+constexpr size_t RandomPacketCount = 100000;
+constexpr size_t RandomCustomSysExCount = 100000;
+
+struct TEvent
+{
+	enum class TType
+	{
+		ShortMessage,
+		SysEx,
+		SysExFragment,
+		UnexpectedStatus,
+		SysExOverflow,
+	};
+
+	TType Type;
+	u32 nTimestamp;
+	u32 nMessage;
+	TSysExFragment Fragment;
+	std::vector<u8> Data;
+
+	bool operator==(const TEvent& Other) const
+	{
+		return Type == Other.Type && nTimestamp == Other.nTimestamp && nMessage == Other.nMessage && Fragment == Other.Fragment && Data == Other.Data;
+	}
+};
+
+class CRecordingHandler : public CMIDIParserHandler
+{
+public:
+	virtual void OnShortMessage(u32 nMessage, u32 nTimestamp) override
+	{
+		Events.push_back(TEvent{TEvent::TType::ShortMessage, nTimestamp, nMessage, TSysExFragment::Begin, {}});
+	}
+
+	virtual void OnSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) override
+	{
+		// Whole messages fit the buffer, and are framed by F0 and F7
+		CHECK(nSize >= 2 && nSize <= CMIDIParser::SysExBufferSize);
+		CHECK(pData[0] == 0xF0 && pData[nSize - 1] == 0xF7);
+		Events.push_back(TEvent{TEvent::TType::SysEx, nTimestamp, 0, TSysExFragment::Begin, {pData, pData + nSize}});
+	}
+
+	virtual void OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) override
+	{
+		CHECK(nSize <= CMIDIParser::SysExBufferSize);
+		CHECK((Fragment == TSysExFragment::Abort) == (nSize == 0));
+		Events.push_back(TEvent{TEvent::TType::SysExFragment, nTimestamp, 0, Fragment, {pData, pData + nSize}});
+	}
+
+	virtual void OnUnexpectedStatus() override
+	{
+		Events.push_back(TEvent{TEvent::TType::UnexpectedStatus, 0, 0, TSysExFragment::Begin, {}});
+	}
+
+	virtual void OnSysExOverflow() override
+	{
+		Events.push_back(TEvent{TEvent::TType::SysExOverflow, 0, 0, TSysExFragment::Begin, {}});
+	}
+
+	std::vector<TEvent> Events;
+};
+
+// The parser's rules, one byte at a time and without the fast paths
+class CReferenceParser
+{
+public:
+	CReferenceParser(bool bSysExStreaming)
+		: m_bSysExStreaming(bSysExStreaming),
+		  m_nRunningStatus(0),
+		  m_bInSysEx(false),
+		  m_bFragmented(false)
+	{
+	}
+
+	void Parse(const u8* pData, size_t nSize, u32 nTimestamp, bool bIgnoreNoteOns)
+	{
+		m_nTimestamp = nTimestamp;
+		m_bIgnoreNoteOns = bIgnoreNoteOns;
+
+		for (size_t i = 0; i < nSize; ++i)
+			ParseByte(pData[i]);
+	}
+
+	std::vector<TEvent> Events;
+
+private:
+	static size_t GetMessageLength(u8 nStatus)
+	{
+		return (nStatus >= 0xC0 && nStatus <= 0xDF) || nStatus == 0xF1 || nStatus == 0xF3 ? 2 : 3;
+	}
+
+	void Emit(TEvent::TType Type, u32 nMessage = 0, TSysExFragment Fragment = TSysExFragment::Begin, std::vector<u8> Data = {})
+	{
+		const bool bHasTimestamp = Type != TEvent::TType::UnexpectedStatus && Type != TEvent::TType::SysExOverflow;
+		Events.push_back(TEvent{Type, bHasTimestamp ? m_nTimestamp : 0, nMessage, Fragment, std::move(Data)});
+	}
+
+	void EndSysEx()
+	{
+		if (m_bFragmented)
+			Emit(TEvent::TType::SysExFragment, 0, TSysExFragment::Abort);
+
+		m_bInSysEx = false;
+		m_bFragmented = false;
+		m_nRunningStatus = 0;
+	}
+
+	void ParseByte(u8 nByte)
+	{
+		// Real-time messages can appear anywhere; undefined ones are ignored
+		if (nByte >= 0xF8)
+		{
+			if (nByte != 0xF9 && nByte != 0xFD)
+				Emit(TEvent::TType::ShortMessage, nByte);
+			return;
+		}
+
+		if (m_bInSysEx)
+		{
+			if (nByte & 0x80 && nByte != 0xF7)
+			{
+				Emit(TEvent::TType::UnexpectedStatus);
+				EndSysEx();
+				ParseStatus(nByte);
+				return;
+			}
+
+			if (m_SysEx.size() == CMIDIParser::SysExBufferSize)
+			{
+				if (!m_bSysExStreaming)
+				{
+					Emit(TEvent::TType::SysExOverflow);
+					EndSysEx();
+					ParseStatus(nByte);
+					return;
+				}
+
+				Emit(TEvent::TType::SysExFragment, 0, m_bFragmented ? TSysExFragment::Continue : TSysExFragment::Begin, m_SysEx);
+				m_bFragmented = true;
+				m_SysEx.clear();
+			}
+
+			m_SysEx.push_back(nByte);
+
+			if (nByte == 0xF7)
+			{
+				if (m_bFragmented)
+				{
+					m_bFragmented = false;
+					Emit(TEvent::TType::SysExFragment, 0, TSysExFragment::End, m_SysEx);
+				}
+				else
+					Emit(TEvent::TType::SysEx, 0, TSysExFragment::Begin, m_SysEx);
+
+				EndSysEx();
+			}
+
+			return;
+		}
+
+		if (!m_Message.empty())
+		{
+			if (nByte & 0x80)
+			{
+				Emit(TEvent::TType::UnexpectedStatus);
+				m_Message.clear();
+				m_nRunningStatus = 0;
+				ParseStatus(nByte);
+				return;
+			}
+
+			m_Message.push_back(nByte);
+			CheckComplete();
+			return;
+		}
+
+		ParseStatus(nByte);
+	}
+
+	void ParseStatus(u8 nByte)
+	{
+		// Data byte; use running status if there is one
+		if (!(nByte & 0x80))
+		{
+			if (m_nRunningStatus)
+			{
+				m_Message = {m_nRunningStatus, nByte};
+				CheckComplete();
+			}
+			return;
+		}
+
+		switch (nByte)
+		{
+			case 0xF0:
+				m_bInSysEx = true;
+				m_SysEx = {0xF0};
+				m_nRunningStatus = 0;
+				break;
+
+			case 0xF4:
+			case 0xF5:
+			case 0xF7:
+				m_nRunningStatus = 0;
+				break;
+
+			case 0xF6:
+				Emit(TEvent::TType::ShortMessage, nByte);
+				m_nRunningStatus = 0;
+				break;
+
+			default:
+				m_Message = {nByte};
+				m_nRunningStatus = nByte;
+				break;
+		}
+	}
+
+	void CheckComplete()
+	{
+		const u8 nStatus = m_Message[0];
+		if (m_Message.size() != GetMessageLength(nStatus))
+			return;
+
+		if (!((nStatus & 0xF0) == 0x90 && m_bIgnoreNoteOns))
+		{
+			u32 nMessage = 0;
+			for (size_t i = 0; i < m_Message.size(); ++i)
+				nMessage |= m_Message[i] << 8 * i;
+			Emit(TEvent::TType::ShortMessage, nMessage);
+		}
+
+		// System Common messages have no running status
+		if (nStatus >= 0xF1)
+			m_nRunningStatus = 0;
+
+		m_Message.clear();
+	}
+
+	bool m_bSysExStreaming;
+	u8 m_nRunningStatus;
+	bool m_bInSysEx;
+	bool m_bFragmented;
+	std::vector<u8> m_Message;
+	std::vector<u8> m_SysEx;
+
+	u32 m_nTimestamp;
+	bool m_bIgnoreNoteOns;
+};
+
+static void AppendDataBytes(std::mt19937& Random, std::vector<u8>& Stream, size_t nCount)
+{
+	for (size_t i = 0; i < nCount; ++i)
+		Stream.push_back(Random() & 0x7F);
+}
+
+// Mostly well-formed MIDI, with the kinds of damage seen on real inputs
+static std::vector<u8> GenerateStream(std::mt19937& Random)
+{
+	std::vector<u8> Stream;
+	const size_t nItems = Random() % 200 + 1;
+
+	for (size_t i = 0; i < nItems; ++i)
+	{
+		switch (Random() % 10)
+		{
+			// Channel message
+			case 0:
+			case 1:
+			case 2:
+			{
+				const u8 nStatus = 0x80 | (Random() & 0x7F);
+				Stream.push_back(nStatus < 0xF0 ? nStatus : 0x90);
+				AppendDataBytes(Random, Stream, Random() % 3 + 1);
+				break;
+			}
+
+			// More data under running status
+			case 3:
+				AppendDataBytes(Random, Stream, Random() % 6 + 1);
+				break;
+
+			// System Common
+			case 4:
+			{
+				static constexpr u8 SystemCommon[] = {0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7};
+				Stream.push_back(SystemCommon[Random() % sizeof(SystemCommon)]);
+				AppendDataBytes(Random, Stream, Random() % 3);
+				break;
+			}
+
+			// SysEx of any length up to a few buffers, around the buffer size, or cut short by another status
+			case 5:
+			case 6:
+			{
+				size_t nLength;
+				switch (Random() % 3)
+				{
+					case 0: nLength = Random() % 32; break;
+					case 1: nLength = CMIDIParser::SysExBufferSize - 4 + Random() % 8; break;
+					default: nLength = Random() % (3 * CMIDIParser::SysExBufferSize); break;
+				}
+
+				Stream.push_back(0xF0);
+				AppendDataBytes(Random, Stream, nLength);
+
+				if (Random() % 8)
+					Stream.push_back(0xF7);
+				else
+					Stream.push_back(0x80 | (Random() & 0x7F));
+				break;
+			}
+
+			// Real-time bytes, which may land in the middle of other messages
+			case 7:
+			case 8:
+			{
+				const size_t nPosition = Stream.empty() ? 0 : Random() % Stream.size();
+				Stream.insert(Stream.begin() + nPosition, 0xF8 + Random() % 8);
+				break;
+			}
+
+			// Noise
+			default:
+				Stream.push_back(Random() & 0xFF);
+				break;
+		}
+	}
+
+	return Stream;
+}
+
+static bool CompareWithReference(std::mt19937& Random, const std::vector<u8>& Stream, bool bSysExStreaming)
+{
+	CRecordingHandler Handler;
+	CMIDIParser Parser(&Handler);
+	CReferenceParser Reference(bSysExStreaming);
+	Parser.SetSysExStreaming(bSysExStreaming);
+
+	size_t nOffset = 0;
+	u32 nTimestamp = Random();
+
+	// Chunks of any size, as from serial, USB or network inputs
+	while (nOffset < Stream.size())
+	{
+		const size_t nChunkSize = Random() % 4 ? Random() % MaxChunkSize + 1 : 1;
+		const size_t nSize = std::min(nChunkSize, Stream.size() - nOffset);
+		const bool bIgnoreNoteOns = Random() % 16 == 0;
+
+		// A copy, so that AddressSanitizer catches reads past the end of the chunk
+		std::vector<u8> Chunk(Stream.begin() + nOffset, Stream.begin() + nOffset + nSize);
+		Parser.ParseMIDIBytes(Chunk.data(), Chunk.size(), nTimestamp, bIgnoreNoteOns);
+		Reference.Parse(Chunk.data(), Chunk.size(), nTimestamp, bIgnoreNoteOns);
+
+		nOffset += nSize;
+		nTimestamp += Random() % 1000;
+	}
+
+	return Handler.Events == Reference.Events;
+}
+
+static std::vector<u8> LoadCapture(const char* pPath)
+{
+	std::vector<u8> Capture;
+	FILE* pFile = fopen(pPath, "rb");
+	if (!pFile)
+		return Capture;
+
+	int nByte;
+	while ((nByte = fgetc(pFile)) != EOF)
+		Capture.push_back(nByte);
+
+	fclose(pFile);
+	return Capture;
+}
+
+static void TestKnownSequences()
+{
+	CRecordingHandler Handler;
+	CMIDIParser Parser(&Handler);
+
+	// Running status, with a clock byte between the data bytes of a note-on
+	const u8 Notes[] = {0x90, 0x3C, 0xF8, 0x64, 0x40, 0x7F};
+	Parser.ParseMIDIBytes(Notes, sizeof(Notes), 1);
+	CHECK(Handler.Events.size() == 3);
+	CHECK(Handler.Events[0].nMessage == 0xF8);
+	CHECK(Handler.Events[1].nMessage == 0x643C90);
+	CHECK(Handler.Events[2].nMessage == 0x7F4090);
+
+	// A Tune Request clears running status; the data bytes after it are ignored
+	Handler.Events.clear();
+	const u8 TuneRequest[] = {0x90, 0x3C, 0x64, 0xF6, 0x3C, 0x00, 0x90, 0x3C, 0x00};
+	Parser.ParseMIDIBytes(TuneRequest, sizeof(TuneRequest), 2);
+	CHECK(Handler.Events.size() == 3);
+	CHECK(Handler.Events[1].nMessage == 0xF6);
+	CHECK(Handler.Events[2].nMessage == 0x003C90);
+
+	// The largest SysEx message that fits, then one byte more
+	for (size_t nSize : {CMIDIParser::SysExBufferSize, CMIDIParser::SysExBufferSize + 1})
+	{
+		Handler.Events.clear();
+		std::vector<u8> SysEx(nSize, 0x10);
+		SysEx.front() = 0xF0;
+		SysEx.back() = 0xF7;
+		Parser.ParseMIDIBytes(SysEx.data(), SysEx.size(), 3);
+
+		const bool bFits = nSize <= CMIDIParser::SysExBufferSize;
+		CHECK(Handler.Events.size() == 1);
+		CHECK(Handler.Events[0].Type == (bFits ? TEvent::TType::SysEx : TEvent::TType::SysExOverflow));
+	}
+}
+
+static void TestCompleteShortMessages(std::mt19937& Random)
+{
+	// Data bytes with the top bit set, e.g. a damaged USB MIDI packet; these must not bypass the parser
+	const std::vector<std::vector<u8>> Malformed = {
+		{0x90, 0xFF, 0x40},
+		{0x90, 0x3C, 0x80},
+		{0xC0, 0x80},
+		{0xF2, 0x00, 0xFF},
+		{0x90, 0x3C},
+		{0xF0, 0x7E, 0xF7},
+	};
+	for (const std::vector<u8>& Packet : Malformed)
+		CHECK(!CMIDIParser::IsCompleteShortMessage(Packet.data(), Packet.size()));
+
+	const std::vector<std::vector<u8>> WellFormed = {
+		{0x90, 0x3C, 0x40},
+		{0xC0, 0x05},
+		{0xF8},
+	};
+	for (const std::vector<u8>& Packet : WellFormed)
+		CHECK(CMIDIParser::IsCompleteShortMessage(Packet.data(), Packet.size()));
+
+	// Anything accepted must be exactly what the parser would have made of the same bytes
+	size_t nMismatches = 0;
+	for (size_t i = 0; i < RandomPacketCount; ++i)
+	{
+		std::vector<u8> Packet(Random() % 3 + 1);
+		Packet[0] = 0x80 | Random();
+		for (size_t j = 1; j < Packet.size(); ++j)
+			Packet[j] = Random() % 4 ? Random() & 0x7F : Random();
+
+		if (!CMIDIParser::IsCompleteShortMessage(Packet.data(), Packet.size()))
+			continue;
+
+		u32 nMessage = 0;
+		for (size_t j = 0; j < Packet.size(); ++j)
+			nMessage |= Packet[j] << 8 * j;
+
+		CRecordingHandler Handler;
+		CMIDIParser Parser(&Handler);
+		Parser.ParseMIDIBytes(Packet.data(), Packet.size(), 0);
+		if (Handler.Events.size() != 1 || Handler.Events[0].Type != TEvent::TType::ShortMessage || Handler.Events[0].nMessage != nMessage)
+			++nMismatches;
+	}
+	CHECK(nMismatches == 0);
+}
+
+static void TestCustomSysEx(std::mt19937& Random)
+{
+	TCustomSysExCommand Command;
+	u8 nParameter;
+
+	const std::vector<u8> Reboot = {0xF0, 0x7D, 0x00, 0xF7};
+	CHECK(ParseCustomSysEx(Reboot.data(), Reboot.size(), Command, nParameter));
+	CHECK(Command == TCustomSysExCommand::Reboot);
+
+	const std::vector<u8> SwitchSoundFont = {0xF0, 0x7D, 0x02, 0x05, 0xF7};
+	CHECK(ParseCustomSysEx(SwitchSoundFont.data(), SwitchSoundFont.size(), Command, nParameter));
+	CHECK(Command == TCustomSysExCommand::SwitchSoundFont && nParameter == 0x05);
+
+	// Truncated, missing parameter, extra bytes, unknown command, other manufacturer, bad framing or data
+	const std::vector<std::vector<u8>> Rejected = {
+		{},
+		{0xF0},
+		{0xF0, 0x7D},
+		{0xF0, 0x7D, 0xF7},
+		{0xF0, 0x7D, 0x02, 0xF7},
+		{0xF0, 0x7D, 0x00, 0x00, 0xF7},
+		{0xF0, 0x7D, 0x02, 0x05, 0x00, 0xF7},
+		{0xF0, 0x7D, 0x06, 0x00, 0xF7},
+		{0xF0, 0x41, 0x02, 0x05, 0xF7},
+		{0xF0, 0x7D, 0x02, 0x05, 0x00},
+		{0x00, 0x7D, 0x02, 0x05, 0xF7},
+		{0xF0, 0x7D, 0x02, 0x85, 0xF7},
+		{0xF0, 0x7D, 0x82, 0x05, 0xF7},
+	};
+	for (const std::vector<u8>& Message : Rejected)
+		CHECK(!ParseCustomSysEx(Message.data(), Message.size(), Command, nParameter));
+
+	// Messages of every size up to a few bytes, each in a buffer of exactly that size so that the sanitizers catch any
+	// read beyond it; whatever is accepted must be one of the documented commands
+	size_t nMismatches = 0;
+	for (size_t i = 0; i < RandomCustomSysExCount; ++i)
+	{
+		std::vector<u8> Message(Random() % 8);
+		for (size_t j = 0; j < Message.size(); ++j)
+			Message[j] = Random() % 4 ? Random() & 0x7F : Random();
+
+		// Mostly well framed, so that the command and parameter checks are reached
+		if (Message.size() >= 2 && Random() % 4)
+		{
+			Message.front() = 0xF0;
+			Message[1] = 0x7D;
+			Message.back() = 0xF7;
+			if (Message.size() >= 3 && Random() % 2)
+				Message[2] = Random() % 8;
+		}
+
+		if (!ParseCustomSysEx(Message.data(), Message.size(), Command, nParameter))
+			continue;
+
+		const u8 nCommand = static_cast<u8>(Command);
+		const bool bFramed = Message[0] == 0xF0 && Message[1] == 0x7D && Message.back() == 0xF7;
+		const bool bValid = Message.size() == 4 ? nCommand == 0x00 : Message.size() == 5 && nCommand >= 0x01 && nCommand <= 0x05 && nParameter < 0x80;
+		if (!bFramed || !bValid || nCommand != Message[2] || (Message.size() == 5 && nParameter != Message[3]))
+			++nMismatches;
+	}
+	CHECK(nMismatches == 0);
+}
+
+int main(int argc, char* argv[])
+{
+	// Damaged streams are expected here
+	CLogger::Get()->SetLogLevel(LogError);
+
+	TestKnownSequences();
+
+	std::mt19937 Random(1234);
+	TestCompleteShortMessages(Random);
+	TestCustomSysEx(Random);
+	size_t nMismatches = 0;
+
+	for (size_t i = 0; i < RandomStreamCount; ++i)
+	{
+		const std::vector<u8> Stream = GenerateStream(Random);
+		if (!CompareWithReference(Random, Stream, false) || !CompareWithReference(Random, Stream, true))
+			++nMismatches;
+	}
+	CHECK(nMismatches == 0);
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::vector<u8> Capture = LoadCapture(argv[i]);
+		CHECK(!Capture.empty());
+		CHECK(CompareWithReference(Random, Capture, false) && CompareWithReference(Random, Capture, true));
+	}
+
+	return Test::Result("midiparsertest");
+}
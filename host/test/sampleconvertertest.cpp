@@ -0,0 +1,183 @@
+//
+// sampleconvertertest.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Checks CSampleConverter against a plain per-sample conversion; on ARM hosts this covers the NEON path, elsewhere
+// the scalar one
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "audio/sampleconverter.h"
+#include "test.h"
+
+TEST_DEFINE_FAILURE_COUNT;
+
+using TFormat = CSampleConverter::TFormat;
+
+constexpr s32 Sample24BitMax = (1 << 23) - 1;
+constexpr s32 Sample24BitMin = -(1 << 23);
+
+// Odd counts leave a frame for the scalar tail after the vector loop
+constexpr size_t FrameCounts[] = { 1, 2, 3, 4, 5, 7, 8, 9, 255, 256 };
+
+// The conversion the audio task did before CSampleConverter, with saturation added
+static s32 ReferenceSample(float nSample)
+{
+	if (nSample > 1.0f)
+		nSample = 1.0f;
+	else if (nSample < -1.0f)
+		nSample = -1.0f;
+
+	return static_cast<s32>(nSample * static_cast<float>(Sample24BitMax));
+}
+
+// Sign-extends the sample at the given index of the converter's output
+static s32 ReadSample(const std::vector<u8>& Buffer, TFormat Format, size_t nIndex)
+{
+	if (Format == TFormat::Signed24_32)
+	{
+		s32 nSample;
+		memcpy(&nSample, Buffer.data() + nIndex * sizeof(s32), sizeof(s32));
+		return nSample;
+	}
+
+	const u8* pBytes = Buffer.data() + nIndex * 3;
+	const u32 nSample = pBytes[0] | pBytes[1] << 8 | pBytes[2] << 16;
+	return static_cast<s32>(nSample << 8) >> 8;
+}
+
+static std::vector<u8> Convert(TFormat Format, bool bReversedStereo, bool bDither, const std::vector<float>& Input)
+{
+	CSampleConverter Converter(Format, bReversedStereo, bDither);
+	const size_t nFrames = Input.size() / 2;
+	const size_t nSize = nFrames * Converter.GetBytesPerFrame();
+
+	// Fill the padding with a marker so that stores beyond it show up
+	std::vector<u8> Buffer(nSize + CSampleConverter::OutputPadding + 16, 0xA5);
+	Converter.Convert(Input.data(), Buffer.data(), nFrames);
+
+	for (size_t i = nSize + CSampleConverter::OutputPadding; i < Buffer.size(); ++i)
+		CHECK(Buffer[i] == 0xA5);
+
+	return Buffer;
+}
+
+// Full scale, beyond full scale, and values close to zero and to the rounding boundaries
+static std::vector<float> GenerateInput(std::mt19937& Random, size_t nFrames)
+{
+	static const float EdgeValues[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 1.5f, -1.5f, 1000.0f, -1000.0f, INFINITY, -INFINITY,
+		0.5f / Sample24BitMax, -0.5f / Sample24BitMax, 1.0f / Sample24BitMax, -1.0f / Sample24BitMax,
+		std::nextafter(1.0f, 0.0f), std::nextafter(-1.0f, 0.0f), std::nextafter(1.0f, 2.0f), std::nextafter(-1.0f, -2.0f),
+	};
+
+	std::uniform_real_distribution<float> Distribution(-1.25f, 1.25f);
+	std::vector<float> Input(nFrames * 2);
+	for (size_t i = 0; i < Input.size(); ++i)
+		Input[i] = i < sizeof(EdgeValues) / sizeof(*EdgeValues) ? EdgeValues[i] : Distribution(Random);
+
+	// Move the edge values around so that they land in every lane
+	std::shuffle(Input.begin(), Input.end(), Random);
+
+	return Input;
+}
+
+static void TestConversion(std::mt19937& Random, TFormat Format, bool bReversedStereo)
+{
+	for (size_t nFrames : FrameCounts)
+	{
+		const std::vector<float> Input = GenerateInput(Random, nFrames);
+		const std::vector<u8> Output = Convert(Format, bReversedStereo, false, Input);
+
+		for (size_t i = 0; i < nFrames * 2; ++i)
+		{
+			// Left and right are swapped within each frame
+			const size_t nSource = bReversedStereo ? i ^ 1 : i;
+			CHECK(ReadSample(Output, Format, i) == ReferenceSample(Input[nSource]));
+		}
+	}
+}
+
+static void TestSaturation(TFormat Format)
+{
+	const std::vector<float> Input = { 2.0f, -2.0f, 1.0f, -1.0f, INFINITY, -INFINITY, 1.0f, -1.0f };
+	const std::vector<u8> Output = Convert(Format, false, false, Input);
+
+	for (size_t i = 0; i < Input.size(); i += 2)
+	{
+		CHECK(ReadSample(Output, Format, i) == Sample24BitMax);
+		CHECK(ReadSample(Output, Format, i + 1) == -Sample24BitMax);
+	}
+}
+
+// Triangular dither spans (-1, 1) LSB, so it may move each sample to a neighbouring value but never beyond one
+static void TestDither(std::mt19937& Random, TFormat Format)
+{
+	for (size_t nFrames : FrameCounts)
+	{
+		const std::vector<float> Input = GenerateInput(Random, nFrames);
+		const std::vector<u8> Output = Convert(Format, false, true, Input);
+
+		for (size_t i = 0; i < nFrames * 2; ++i)
+		{
+			const s32 nSample = ReadSample(Output, Format, i);
+			CHECK(std::abs(nSample - ReferenceSample(Input[i])) <= 1);
+			CHECK(nSample >= Sample24BitMin && nSample <= Sample24BitMax);
+		}
+	}
+
+	// Samples are truncated, so half an LSB only becomes 1 when the dither adds at least another half, i.e. 1/8 of the time
+	constexpr size_t nFrames = 50000;
+	const std::vector<float> Input(nFrames * 2, 0.5f / Sample24BitMax);
+	const std::vector<u8> Output = Convert(Format, false, true, Input);
+
+	size_t nOnes = 0;
+	for (size_t i = 0; i < nFrames * 2; ++i)
+	{
+		const s32 nSample = ReadSample(Output, Format, i);
+		CHECK(nSample == 0 || nSample == 1);
+		nOnes += nSample == 1;
+	}
+
+	const float nMean = static_cast<float>(nOnes) / (nFrames * 2);
+	CHECK(nMean > 0.11f && nMean < 0.14f);
+}
+
+int main()
+{
+	std::mt19937 Random(1234);
+
+	for (TFormat Format : { TFormat::Signed24, TFormat::Signed24_32 })
+	{
+		TestConversion(Random, Format, false);
+		TestConversion(Random, Format, true);
+		TestSaturation(Format);
+		TestDither(Random, Format);
+	}
+
+	return Test::Result("sampleconvertertest");
+}
@@ -0,0 +1,197 @@
+//
+// spscringbuffertest.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "spscringbuffer.h"
+#include "test.h"
+
+TEST_DEFINE_FAILURE_COUNT;
+
+constexpr size_t BufferSize = 16;
+
+// One slot is always left empty to tell a full buffer from an empty one
+constexpr size_t Capacity = BufferSize - 1;
+
+using TTestBuffer = CSPSCRingBuffer<u32, BufferSize>;
+
+static void TestSingleItems()
+{
+	TTestBuffer Buffer;
+	u32 nItem;
+
+	CHECK(!Buffer.Dequeue(nItem));
+	CHECK(!Buffer.Peek(nItem));
+	CHECK(Buffer.GetFreeSpace() == Capacity);
+
+	for (u32 i = 0; i < Capacity; ++i)
+		CHECK(Buffer.Enqueue(i));
+
+	CHECK(!Buffer.Enqueue(Capacity));
+	CHECK(Buffer.GetFreeSpace() == 0);
+
+	// Peeking leaves the items in place
+	for (u32 i = 0; i < Capacity; ++i)
+		CHECK(Buffer.Peek(nItem, i) && nItem == i);
+	CHECK(!Buffer.Peek(nItem, Capacity));
+
+	for (u32 i = 0; i < Capacity; ++i)
+		CHECK(Buffer.Dequeue(nItem) && nItem == i);
+
+	CHECK(!Buffer.Dequeue(nItem));
+	CHECK(Buffer.GetFreeSpace() == Capacity);
+}
+
+// Bulk copies are split in two where the buffer wraps around; try every start position and count
+static void TestWraparound()
+{
+	for (size_t nStart = 0; nStart < BufferSize; ++nStart)
+	{
+		for (size_t nCount = 0; nCount <= BufferSize + 1; ++nCount)
+		{
+			TTestBuffer Buffer;
+			u32 nItem;
+
+			// Move both indices to the start position
+			for (size_t i = 0; i < nStart; ++i)
+			{
+				Buffer.Enqueue(0);
+				Buffer.Dequeue(nItem);
+			}
+
+			std::vector<u32> Items(nCount);
+			for (size_t i = 0; i < nCount; ++i)
+				Items[i] = static_cast<u32>(nStart * 100 + i);
+
+			// Anything beyond the capacity is refused
+			const size_t nExpected = Utility::Min(nCount, Capacity);
+			CHECK(Buffer.Enqueue(Items.data(), nCount) == nExpected);
+			CHECK(Buffer.GetFreeSpace() == Capacity - nExpected);
+
+			for (size_t i = 0; i < nExpected; ++i)
+				CHECK(Buffer.Peek(nItem, i) && nItem == Items[i]);
+
+			// Take them out in two bulk reads, so that either may be split
+			std::vector<u32> Output(BufferSize + 1, 0xFFFFFFFF);
+			const size_t nFirst = nExpected / 2;
+			CHECK(Buffer.Dequeue(Output.data(), nFirst) == nFirst);
+			CHECK(Buffer.Dequeue(Output.data() + nFirst, BufferSize) == nExpected - nFirst);
+			CHECK(!Buffer.Dequeue(nItem));
+
+			for (size_t i = 0; i < nExpected; ++i)
+				CHECK(Output[i] == Items[i]);
+			CHECK(Output[nExpected] == 0xFFFFFFFF);
+		}
+	}
+}
+
+// A producer and a consumer on separate threads, mixing single and bulk transfers; every item must arrive once, in order
+static void TestConcurrent()
+{
+	constexpr u32 ItemCount = 1000000;
+
+	TTestBuffer Buffer;
+	std::atomic<size_t> nErrors(0);
+
+	std::thread Producer([&] {
+		std::mt19937 Random(1);
+		u32 nNext = 0;
+		u32 Items[BufferSize];
+
+		while (nNext < ItemCount)
+		{
+			const u32 nPrevious = nNext;
+
+			if (Random() % 2)
+			{
+				if (Buffer.Enqueue(nNext))
+					++nNext;
+			}
+			else
+			{
+				const size_t nCount = Utility::Min<size_t>(1 + Random() % BufferSize, ItemCount - nNext);
+				for (size_t i = 0; i < nCount; ++i)
+					Items[i] = nNext + static_cast<u32>(i);
+
+				nNext += static_cast<u32>(Buffer.Enqueue(Items, nCount));
+			}
+
+			// Let the consumer run if the host has fewer cores than threads
+			if (nNext == nPrevious)
+				std::this_thread::yield();
+		}
+	});
+
+	std::thread Consumer([&] {
+		std::mt19937 Random(2);
+		u32 nNext = 0;
+		u32 Items[BufferSize];
+
+		while (nNext < ItemCount)
+		{
+			const u32 nPrevious = nNext;
+
+			if (Random() % 2)
+			{
+				u32 nItem;
+				if (Buffer.Dequeue(nItem))
+				{
+					if (nItem != nNext)
+						++nErrors;
+					nNext = nItem + 1;
+				}
+			}
+			else
+			{
+				const size_t nCount = Buffer.Dequeue(Items, 1 + Random() % BufferSize);
+				for (size_t i = 0; i < nCount; ++i)
+				{
+					if (Items[i] != nNext)
+						++nErrors;
+					nNext = Items[i] + 1;
+				}
+			}
+
+			if (nNext == nPrevious)
+				std::this_thread::yield();
+		}
+	});
+
+	Producer.join();
+	Consumer.join();
+
+	CHECK(nErrors == 0);
+	CHECK(Buffer.GetFreeSpace() == Capacity);
+}
+
+int main()
+{
+	TestSingleItems();
+	TestWraparound();
+	TestConcurrent();
+
+	return Test::Result("spscringbuffertest");
+}
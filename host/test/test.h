@@ -0,0 +1,56 @@
+//
+// test.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _test_h
+#define _test_h
+
+#include <cstdio>
+
+// Minimal checks for the host tests; a failed check is reported and makes the test exit with a non-zero status
+namespace Test
+{
+	extern int nFailures;
+
+	inline int Result(const char* pName)
+	{
+		if (nFailures)
+			fprintf(stderr, "%s: %d check(s) failed\n", pName, nFailures);
+		else
+			fprintf(stderr, "%s: all checks passed\n", pName);
+
+		return nFailures ? 1 : 0;
+	}
+}
+
+#define TEST_DEFINE_FAILURE_COUNT int Test::nFailures = 0
+
+#define CHECK(EXPRESSION)                                                                  \
+	do                                                                                     \
+	{                                                                                      \
+		if (!(EXPRESSION))                                                                 \
+		{                                                                                  \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #EXPRESSION); \
+			++Test::nFailures;                                                             \
+		}                                                                                  \
+	} while (0)
+
+#endif
@@ -0,0 +1,181 @@
+//
+// zoneallocatortest.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <circle/memory.h>
+#include <circle/multicore.h>
+
+#include "test.h"
+#include "zoneallocator.h"
+
+TEST_DEFINE_FAILURE_COUNT;
+
+constexpr size_t HeapSize = 64 * MEGABYTE;
+
+// Must match the reserve in zoneallocator.cpp
+constexpr size_t MallocHeapSize = 32 * MEGABYTE;
+
+static void TestAllocFree(CZoneAllocator& Allocator)
+{
+	void* pA = Allocator.Alloc(100, TZoneTag::Uncategorized);
+	void* pB = Allocator.Alloc(5000, TZoneTag::FluidSynth);
+	CHECK(pA && pB);
+	CHECK((reinterpret_cast<uintptr>(pA) & 15) == 0);
+	CHECK((reinterpret_cast<uintptr>(pB) & 15) == 0);
+	CHECK(Allocator.GetAllocCount() == 2);
+	CHECK(Allocator.GetUsedSize() >= 5100);
+
+	memset(pA, 0xAA, 100);
+	memset(pB, 0xBB, 5000);
+
+	Allocator.Free(pA);
+	Allocator.Free(pB);
+	CHECK(Allocator.GetAllocCount() == 0);
+	CHECK(Allocator.GetUsedSize() == 0);
+
+	// Zero-sized allocations and free tags are refused
+	CHECK(Allocator.Alloc(0, TZoneTag::Uncategorized) == nullptr);
+	CHECK(Allocator.Alloc(16, TZoneTag::Free) == nullptr);
+	CHECK(Allocator.Alloc(HeapSize, TZoneTag::Uncategorized) == nullptr);
+}
+
+static void TestRealloc(CZoneAllocator& Allocator)
+{
+	u8* pBlock = static_cast<u8*>(Allocator.Alloc(64, TZoneTag::Uncategorized));
+	for (u8 i = 0; i < 64; ++i)
+		pBlock[i] = i;
+
+	// Keep the following space in use, so that growing has to move the block
+	void* pNeighbor = Allocator.Alloc(64, TZoneTag::Uncategorized);
+
+	pBlock = static_cast<u8*>(Allocator.Realloc(pBlock, 4096, TZoneTag::Uncategorized));
+	CHECK(pBlock != nullptr);
+	bool bIntact = true;
+	for (u8 i = 0; i < 64; ++i)
+		bIntact &= pBlock[i] == i;
+	CHECK(bIntact);
+
+	pBlock = static_cast<u8*>(Allocator.Realloc(pBlock, 32, TZoneTag::Uncategorized));
+	bIntact = true;
+	for (u8 i = 0; i < 32; ++i)
+		bIntact &= pBlock[i] == i;
+	CHECK(bIntact);
+
+	Allocator.Free(pBlock);
+	Allocator.Free(pNeighbor);
+	CHECK(Allocator.GetUsedSize() == 0);
+}
+
+static void TestFreeTag(CZoneAllocator& Allocator)
+{
+	void* pKept = Allocator.Alloc(256, TZoneTag::Uncategorized);
+	for (int i = 0; i < 100; ++i)
+		Allocator.Alloc(128 + i, TZoneTag::FluidSynth);
+
+	Allocator.FreeTag(TZoneTag::FluidSynth);
+	CHECK(Allocator.GetAllocCount() == 1);
+
+	Allocator.Free(pKept);
+	CHECK(Allocator.GetUsedSize() == 0);
+}
+
+// FluidSynth allocates and frees on the main core and the render cores at the same time
+static void TestConcurrent(CZoneAllocator& Allocator)
+{
+	constexpr unsigned Threads = 3;
+	constexpr size_t Iterations = 100000;
+	std::atomic<size_t> nCorrupted(0);
+
+	std::vector<std::thread> Workers;
+	for (unsigned nThread = 0; nThread < Threads; ++nThread)
+	{
+		Workers.emplace_back([&, nThread] {
+			CMultiCoreSupport::SetThisCore(nThread);
+
+			std::mt19937 Random(nThread);
+			std::vector<std::pair<u8*, size_t>> Blocks;
+
+			for (size_t i = 0; i < Iterations; ++i)
+			{
+				if (Blocks.size() < 64 && (Blocks.empty() || Random() % 2))
+				{
+					const size_t nSize = 1 + Random() % 2048;
+					u8* pBlock = static_cast<u8*>(Allocator.Alloc(nSize, TZoneTag::FluidSynth));
+					if (!pBlock)
+						continue;
+
+					memset(pBlock, static_cast<int>(nThread + 1), nSize);
+					Blocks.emplace_back(pBlock, nSize);
+				}
+				else
+				{
+					const size_t nIndex = Random() % Blocks.size();
+					u8* pBlock = Blocks[nIndex].first;
+					const size_t nSize = Blocks[nIndex].second;
+
+					for (size_t j = 0; j < nSize; ++j)
+					{
+						if (pBlock[j] != nThread + 1)
+						{
+							++nCorrupted;
+							break;
+						}
+					}
+
+					Allocator.Free(pBlock);
+					Blocks[nIndex] = Blocks.back();
+					Blocks.pop_back();
+				}
+			}
+
+			for (const auto& Block : Blocks)
+				Allocator.Free(Block.first);
+		});
+	}
+
+	for (auto& Worker : Workers)
+		Worker.join();
+
+	CHECK(nCorrupted == 0);
+	CHECK(Allocator.GetAllocCount() == 0);
+	CHECK(Allocator.GetUsedSize() == 0);
+}
+
+int main()
+{
+	CMemorySystem::Get()->SetHeapSize(HeapSize + MallocHeapSize);
+
+	CZoneAllocator Allocator;
+	CHECK(Allocator.Initialize());
+
+	TestAllocFree(Allocator);
+	TestRealloc(Allocator);
+	TestFreeTag(Allocator);
+	TestConcurrent(Allocator);
+
+	return Test::Result("zoneallocatortest");
+}
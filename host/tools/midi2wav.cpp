@@ -0,0 +1,562 @@
+//
+// midi2wav.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Renders a Standard MIDI File offline as fast as possible, through the same MIDI parser and Render() calls as the
+// firmware, and reports whether the synth would keep up in real time with the current configuration
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <vector>
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <fatfs/ff.h>
+
+#include "config.h"
+#include "midiparser.h"
+#include "synth/mt32synth.h"
+#include "synth/soundfontsynth.h"
+#include "utility.h"
+
+using TClock = std::chrono::steady_clock;
+
+constexpr u32 DefaultTempo = 500000;
+
+// A DIN MIDI cable carries one byte every 320 microseconds (31250 baud, 10 bits per byte)
+constexpr u64 MIDIByteMicros = 320;
+
+// Rendered after the last event, for release and reverb tails
+constexpr unsigned int TailMillis = 2000;
+
+constexpr size_t ChannelCount = 2;
+
+struct TSMFEvent
+{
+	u64 nTick;
+	u64 nTime;
+
+	// Tempo changes have no bytes
+	u32 nTempo;
+	std::vector<u8> Bytes;
+};
+
+// Song time, in microseconds since the first event; timestamps and the event queue's block timing are based on this
+static unsigned int nSongTicks = 0;
+
+static unsigned int GetSongTicks()
+{
+	return nSongTicks;
+}
+
+static u32 ReadBigEndian(const u8* pData, size_t nSize)
+{
+	u32 nValue = 0;
+	for (size_t i = 0; i < nSize; ++i)
+		nValue = nValue << 8 | pData[i];
+	return nValue;
+}
+
+static bool ReadVarLen(const u8*& pData, const u8* pEnd, u32& nOutValue)
+{
+	nOutValue = 0;
+
+	for (size_t i = 0; i < 4 && pData < pEnd; ++i)
+	{
+		const u8 nByte = *pData++;
+		nOutValue = nOutValue << 7 | (nByte & 0x7F);
+		if (!(nByte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+static bool ParseTrack(const u8* pData, const u8* pEnd, std::vector<TSMFEvent>& OutEvents)
+{
+	u64 nTick = 0;
+	u8 nRunningStatus = 0;
+
+	while (pData < pEnd)
+	{
+		u32 nDelta;
+		if (!ReadVarLen(pData, pEnd, nDelta) || pData == pEnd)
+			return false;
+
+		nTick += nDelta;
+
+		u8 nStatus = *pData;
+		if (nStatus & 0x80)
+			++pData;
+		else if (nRunningStatus)
+			nStatus = nRunningStatus;
+		else
+			return false;
+
+		// Meta event
+		if (nStatus == 0xFF)
+		{
+			u32 nLength;
+			if (pData == pEnd)
+				return false;
+
+			const u8 nType = *pData++;
+			if (!ReadVarLen(pData, pEnd, nLength) || nLength > static_cast<size_t>(pEnd - pData))
+				return false;
+
+			// End of track
+			if (nType == 0x2F)
+				break;
+
+			if (nType == 0x51 && nLength == 3)
+				OutEvents.push_back(TSMFEvent{nTick, 0, ReadBigEndian(pData, 3), {}});
+
+			pData += nLength;
+		}
+
+		// SysEx, or a continuation/escape packet whose bytes are sent as-is
+		else if (nStatus == 0xF0 || nStatus == 0xF7)
+		{
+			u32 nLength;
+			if (!ReadVarLen(pData, pEnd, nLength) || nLength > static_cast<size_t>(pEnd - pData))
+				return false;
+
+			TSMFEvent Event{nTick, 0, 0, {}};
+			if (nStatus == 0xF0)
+				Event.Bytes.push_back(0xF0);
+			Event.Bytes.insert(Event.Bytes.end(), pData, pData + nLength);
+			OutEvents.push_back(std::move(Event));
+
+			pData += nLength;
+			nRunningStatus = 0;
+		}
+
+		// Channel message
+		else if (nStatus < 0xF0)
+		{
+			const size_t nDataBytes = (nStatus & 0xE0) == 0xC0 ? 1 : 2;
+			if (nDataBytes > static_cast<size_t>(pEnd - pData))
+				return false;
+
+			TSMFEvent Event{nTick, 0, 0, {nStatus}};
+			Event.Bytes.insert(Event.Bytes.end(), pData, pData + nDataBytes);
+			OutEvents.push_back(std::move(Event));
+
+			pData += nDataBytes;
+			nRunningStatus = nStatus;
+		}
+
+		// System common and real-time messages aren't allowed in a file
+		else
+			return false;
+	}
+
+	return true;
+}
+
+static bool LoadMIDIFile(const char* pPath, std::vector<TSMFEvent>& OutEvents)
+{
+	FILE* pFile = fopen(pPath, "rb");
+	if (!pFile)
+	{
+		fprintf(stderr, "Couldn't open '%s'\n", pPath);
+		return false;
+	}
+
+	std::vector<u8> File;
+	u8 Buffer[4096];
+	size_t nRead;
+	while ((nRead = fread(Buffer, 1, sizeof(Buffer), pFile)) > 0)
+		File.insert(File.end(), Buffer, Buffer + nRead);
+	fclose(pFile);
+
+	const u8* pData = File.data();
+	const u8* const pEnd = pData + File.size();
+
+	if (File.size() < 14 || memcmp(pData, "MThd", 4) || ReadBigEndian(pData + 4, 4) < 6)
+	{
+		fprintf(stderr, "'%s' is not a Standard MIDI File\n", pPath);
+		return false;
+	}
+
+	const u16 nDivision = ReadBigEndian(pData + 12, 2);
+	pData += 8 + ReadBigEndian(pData + 4, 4);
+
+	// Read every track; chunks of unknown types are skipped
+	while (pEnd - pData >= 8)
+	{
+		const u32 nChunkSize = ReadBigEndian(pData + 4, 4);
+		const u8* const pChunk = pData + 8;
+		if (nChunkSize > static_cast<size_t>(pEnd - pChunk))
+			break;
+
+		if (!memcmp(pData, "MTrk", 4) && !ParseTrack(pChunk, pChunk + nChunkSize, OutEvents))
+		{
+			fprintf(stderr, "'%s' has a corrupt track\n", pPath);
+			return false;
+		}
+
+		pData = pChunk + nChunkSize;
+	}
+
+	// Merge the tracks; events at the same tick keep the order of their tracks
+	std::stable_sort(OutEvents.begin(), OutEvents.end(), [](const TSMFEvent& A, const TSMFEvent& B) { return A.nTick < B.nTick; });
+
+	u64 nTempoTick = 0, nTempoTime = 0;
+	u32 nTempo = DefaultTempo;
+
+	for (TSMFEvent& Event : OutEvents)
+	{
+		// SMPTE time division: frames per second and ticks per frame
+		if (nDivision & 0x8000)
+		{
+			const u64 nTicksPerSecond = static_cast<u64>(-static_cast<s8>(nDivision >> 8)) * (nDivision & 0xFF);
+			Event.nTime = nTicksPerSecond ? Event.nTick * 1000000 / nTicksPerSecond : 0;
+		}
+
+		// Ticks per quarter note
+		else
+		{
+			Event.nTime = nDivision ? nTempoTime + (Event.nTick - nTempoTick) * nTempo / nDivision : 0;
+
+			if (Event.Bytes.empty())
+			{
+				nTempoTick = Event.nTick;
+				nTempoTime = Event.nTime;
+				nTempo = Event.nTempo;
+			}
+		}
+	}
+
+	return true;
+}
+
+class CWAVWriter
+{
+public:
+	CWAVWriter() : m_pFile(nullptr), m_nFrames(0), m_nSampleRate(0) {}
+	~CWAVWriter() { Close(); }
+
+	bool Open(const char* pPath, unsigned int nSampleRate)
+	{
+		m_pFile = fopen(pPath, "wb");
+		if (!m_pFile)
+			return false;
+
+		m_nFrames = 0;
+		m_nSampleRate = nSampleRate;
+
+		// Sizes are filled in on closing
+		return WriteHeader();
+	}
+
+	bool Write(const float* pFrames, size_t nFrames)
+	{
+		m_nFrames += nFrames;
+		return fwrite(pFrames, sizeof(float) * ChannelCount, nFrames, m_pFile) == nFrames;
+	}
+
+	bool Close()
+	{
+		if (!m_pFile)
+			return true;
+
+		const bool bResult = !fseek(m_pFile, 0, SEEK_SET) && WriteHeader();
+		fclose(m_pFile);
+		m_pFile = nullptr;
+		return bResult;
+	}
+
+private:
+	static constexpr u16 FormatIEEEFloat = 3;
+
+	bool WriteHeader()
+	{
+		const u32 nDataSize = m_nFrames * sizeof(float) * ChannelCount;
+
+		u8 Header[58];
+		u8* p = Header;
+		auto Tag = [&](const char* pTag) { memcpy(p, pTag, 4); p += 4; };
+		auto Word = [&](u16 nValue) { *p++ = nValue; *p++ = nValue >> 8; };
+		auto DWord = [&](u32 nValue) { Word(nValue); Word(nValue >> 16); };
+
+		Tag("RIFF");
+		DWord(sizeof(Header) - 8 + nDataSize);
+		Tag("WAVE");
+
+		Tag("fmt ");
+		DWord(18);
+		Word(FormatIEEEFloat);
+		Word(ChannelCount);
+		DWord(m_nSampleRate);
+		DWord(m_nSampleRate * sizeof(float) * ChannelCount);
+		Word(sizeof(float) * ChannelCount);
+		Word(sizeof(float) * 8);
+		Word(0);
+
+		// Required for formats other than PCM
+		Tag("fact");
+		DWord(4);
+		DWord(m_nFrames);
+
+		Tag("data");
+		DWord(nDataSize);
+
+		return fwrite(Header, sizeof(Header), 1, m_pFile) == 1;
+	}
+
+	FILE* m_pFile;
+	u32 m_nFrames;
+	unsigned int m_nSampleRate;
+};
+
+// Passes parsed messages to the synth, as CMT32Pi does
+class CSynthMIDIHandler : public CMIDIParserHandler
+{
+public:
+	CSynthMIDIHandler(CSynthBase* pSynth) : m_pSynth(pSynth), m_nSysExOverflows(0) {}
+
+	virtual void OnShortMessage(u32 nMessage, u32 nTimestamp) override { m_pSynth->HandleMIDIShortMessage(nMessage, nTimestamp); }
+	virtual void OnSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) override { m_pSynth->HandleMIDISysExMessage(pData, nSize, nTimestamp); }
+	virtual void OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) override { m_pSynth->HandleMIDISysExFragment(pData, nSize, Fragment, nTimestamp); }
+	virtual void OnSysExOverflow() override { ++m_nSysExOverflows; }
+
+	size_t GetSysExOverflowCount() const { return m_nSysExOverflows; }
+
+private:
+	CSynthBase* m_pSynth;
+	size_t m_nSysExOverflows;
+};
+
+static float GetPercentileMillis(const std::vector<u32>& SortedTimes, float nPercentile)
+{
+	const size_t nRank = static_cast<size_t>(nPercentile / 100.0f * SortedTimes.size());
+	return SortedTimes[Utility::Min(nRank, SortedTimes.size() - 1)] / 1000.0f;
+}
+
+static void Usage(const char* pProgram)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <input.mid>\n"
+		"  -d <directory>  directory to use as the SD card (default: current directory)\n"
+		"  -c <file>       configuration file on the SD card (default: mt32-pi.cfg)\n"
+		"  -s <synth>      mt32 or soundfont (default: default_synth from the configuration)\n"
+		"  -f <index>      SoundFont index (default: soundfont from the configuration)\n"
+		"  -b <frames>     frames per block (default: chunk_size from the configuration)\n"
+		"  -o <file>       write the output to a 32-bit float WAV file\n"
+		"Polyphony, resampler quality and the other synth settings are read from the configuration file.\n",
+		pProgram);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* pSDDirectory = ".";
+	const char* pConfigPath = "mt32-pi.cfg";
+	const char* pSynthName = nullptr;
+	const char* pOutputPath = nullptr;
+	int nSoundFontIndex = -1;
+	int nBlockFrames = 0;
+	int nOption;
+
+	while ((nOption = getopt(argc, argv, "d:c:s:f:b:o:h")) != -1)
+	{
+		switch (nOption)
+		{
+			case 'd': pSDDirectory = optarg; break;
+			case 'c': pConfigPath = optarg; break;
+			case 's': pSynthName = optarg; break;
+			case 'f': nSoundFontIndex = atoi(optarg); break;
+			case 'b': nBlockFrames = atoi(optarg); break;
+			case 'o': pOutputPath = optarg; break;
+			default:
+				Usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		Usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<TSMFEvent> Events;
+	if (!LoadMIDIFile(argv[optind], Events))
+		return EXIT_FAILURE;
+
+	// This thread is the main task; the SoundFont loader runs as a task alongside it
+	CScheduler Scheduler;
+	CLogger::Get()->SetLogLevel(LogWarning);
+
+	f_hostmap("SD", pSDDirectory);
+
+	CConfig Config;
+	if (!Config.Initialize(pConfigPath))
+		fprintf(stderr, "Using the default configuration\n");
+
+	if (nSoundFontIndex >= 0)
+		Config.FluidSynthSoundFont = nSoundFontIndex;
+	if (nBlockFrames <= 0)
+		nBlockFrames = Config.AudioChunkSize;
+
+	bool bSoundFont = Config.SystemDefaultSynth != CConfig::TSystemDefaultSynth::MT32;
+	if (pSynthName)
+	{
+		if (!strcmp(pSynthName, "soundfont"))
+			bSoundFont = true;
+		else if (!strcmp(pSynthName, "mt32"))
+			bSoundFont = false;
+		else
+		{
+			Usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Timestamps and block timing follow the song, so that events land on the same frames however fast we render
+	CTimer::SetClockSource(GetSongTicks);
+
+	const unsigned int nSampleRate = Config.AudioSampleRate;
+	CMT32Synth* pMT32Synth = nullptr;
+	CSoundFontSynth* pSoundFontSynth = nullptr;
+	CSynthBase* pSynth;
+
+	if (bSoundFont)
+		pSynth = pSoundFontSynth = new CSoundFontSynth(nSampleRate);
+	else
+		pSynth = pMT32Synth = new CMT32Synth(nSampleRate, Config.MT32EmuGain, Config.MT32EmuReverbGain, Config.MT32EmuResamplerQuality);
+
+	if (!pSynth->Initialize())
+	{
+		fprintf(stderr, "Failed to initialize the %s synth; check the ROMs or SoundFonts in '%s'\n", bSoundFont ? "SoundFont" : "MT-32", pSDDirectory);
+		return EXIT_FAILURE;
+	}
+
+	pSynth->m_MIDIEventQueue.SetCoalescing(Config.MIDICoalescing);
+
+	CSynthMIDIHandler Handler(pSynth);
+	CMIDIParser Parser(&Handler);
+	Parser.SetSysExStreaming(Config.MIDISysExStreaming);
+
+	CWAVWriter WAVWriter;
+	if (pOutputPath && !WAVWriter.Open(pOutputPath, nSampleRate))
+	{
+		fprintf(stderr, "Couldn't open '%s' for writing\n", pOutputPath);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<float> Buffer(nBlockFrames * ChannelCount);
+	std::vector<u32> BlockTimes;
+	u64 nRenderedFrames = 0;
+	u64 nLineFreeTime = 0;
+	u32 nPeakVoices = 0;
+	size_t nNextEvent = 0;
+
+	while (true)
+	{
+		const u64 nBlockTime = nRenderedFrames * 1000000 / nSampleRate;
+
+		// Send everything that would have arrived by now, no faster than the MIDI cable allows so that SysEx bursts
+		// don't overflow the event queue
+		while (nNextEvent < Events.size())
+		{
+			const TSMFEvent& Event = Events[nNextEvent];
+			const u64 nArrivalTime = Utility::Max(Event.nTime, nLineFreeTime);
+			if (nArrivalTime > nBlockTime)
+				break;
+
+			if (!Event.Bytes.empty())
+			{
+				Parser.ParseMIDIBytes(Event.Bytes.data(), Event.Bytes.size(), static_cast<u32>(nArrivalTime));
+				nLineFreeTime = nArrivalTime + Event.Bytes.size() * MIDIByteMicros;
+			}
+
+			++nNextEvent;
+		}
+
+		if (nNextEvent == Events.size() && nBlockTime >= nLineFreeTime + Utility::MillisToTicks(TailMillis))
+			break;
+
+		nSongTicks = static_cast<unsigned int>(nBlockTime);
+
+		const TClock::time_point RenderStart = TClock::now();
+		pSynth->Render(Buffer.data(), nBlockFrames);
+		const auto RenderTime = std::chrono::duration_cast<std::chrono::microseconds>(TClock::now() - RenderStart);
+		BlockTimes.push_back(RenderTime.count());
+
+		const u32 nVoices = pSoundFontSynth ? pSoundFontSynth->GetActiveVoiceCount() : pMT32Synth->GetActivePartialCount();
+		nPeakVoices = Utility::Max(nPeakVoices, nVoices);
+
+		if (pOutputPath && !WAVWriter.Write(Buffer.data(), nBlockFrames))
+		{
+			fprintf(stderr, "Error writing '%s'\n", pOutputPath);
+			return EXIT_FAILURE;
+		}
+
+		nRenderedFrames += nBlockFrames;
+
+		// Main task duties: finish background loads, and let the loader task run
+		if (pSoundFontSynth)
+			pSoundFontSynth->Update();
+		Scheduler.Yield();
+	}
+
+	if (!WAVWriter.Close())
+	{
+		fprintf(stderr, "Error writing '%s'\n", pOutputPath);
+		return EXIT_FAILURE;
+	}
+
+	CMIDIEventQueue::TStatistics Statistics;
+	pSynth->m_MIDIEventQueue.GetStatistics(Statistics);
+
+	u64 nTotalRenderTime = 0;
+	for (u32 nTime : BlockTimes)
+		nTotalRenderTime += nTime;
+
+	const u32 nBlockBudget = static_cast<u64>(nBlockFrames) * 1000000 / nSampleRate;
+	const size_t nLateBlocks = std::count_if(BlockTimes.begin(), BlockTimes.end(), [=](u32 nTime) { return nTime > nBlockBudget; });
+	const float nAudioSeconds = static_cast<float>(nRenderedFrames) / nSampleRate;
+	const float nRenderSeconds = nTotalRenderTime / 1000000.0f;
+	std::sort(BlockTimes.begin(), BlockTimes.end());
+
+	printf("Rendered %.1f s of audio in %.2f s; real-time factor %.3f (%.1fx faster than real time)\n",
+		nAudioSeconds, nRenderSeconds, nRenderSeconds / nAudioSeconds, nAudioSeconds / nRenderSeconds);
+	printf("Block render time (%d frames, %.2f ms budget): p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n",
+		nBlockFrames, nBlockBudget / 1000.0f,
+		GetPercentileMillis(BlockTimes, 50.0f), GetPercentileMillis(BlockTimes, 90.0f), GetPercentileMillis(BlockTimes, 99.0f),
+		GetPercentileMillis(BlockTimes, 99.9f), BlockTimes.back() / 1000.0f);
+	printf("Blocks over budget: %zu of %zu (%.2f%%)\n", nLateBlocks, BlockTimes.size(), 100.0f * nLateBlocks / BlockTimes.size());
+	printf("Peak %s: %u\n", pSoundFontSynth ? "voices" : "partials", nPeakVoices);
+
+	if (Statistics.nOverflows || Handler.GetSysExOverflowCount())
+		printf("Dropped: %u events (queue full), %zu SysEx messages (too large)\n", Statistics.nOverflows, Handler.GetSysExOverflowCount());
+
+	delete pSynth;
+	CTimer::SetClockSource(nullptr);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+//
+// latencycontroller.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _latencycontroller_h
+#define _latencycontroller_h
+
+#include <atomic>
+
+#include <circle/types.h>
+
+// Tracks audio render times and deadline misses, and optionally adjusts the amount of audio queued for output
+class CLatencyController
+{
+public:
+	struct TStatistics
+	{
+		// Render time per block (microseconds)
+		u32 nMinRenderTime;
+		u32 nAverageRenderTime;
+		u32 nMaxRenderTime;
+
+		u32 nXRuns;
+		u32 nTargetFrames;
+	};
+
+	// nChunkFrames is the minimum (and step) target, nMaxFrames the maximum; adaptation is disabled when equal
+	CLatencyController(unsigned int nSampleRate, size_t nChunkFrames, size_t nMaxFrames);
+
+	// Number of frames the output queue should be kept filled to
+	size_t GetTargetFrames() const { return m_nTargetFrames.load(std::memory_order_relaxed); }
+
+	// Audio core; nHeadroomFrames is the number of frames that were queued for output when rendering began
+	void RecordBlock(u32 nRenderTime, size_t nHeadroomFrames);
+	void RecordRenderTime(u32 nRenderTime);
+	void RecordXRun();
+
+	// Safe to call from any core
+	void GetStatistics(TStatistics& OutStatistics) const;
+
+private:
+	// Minimum time without deadline misses before the target is reduced
+	static constexpr u32 ShrinkIntervalMillis = 5000;
+
+	u32 FramesToMicroseconds(size_t nFrames) const { return static_cast<u64>(nFrames) * 1000000 / m_nSampleRate; }
+
+	unsigned int m_nSampleRate;
+	size_t m_nChunkFrames;
+	size_t m_nMaxFrames;
+
+	// Adaptation state
+	u32 m_nLastAdjustTime;
+	u32 m_nWindowMaxRenderTime;
+
+	// Statistics
+	std::atomic<size_t> m_nTargetFrames;
+	std::atomic<u32> m_nMinRenderTime;
+	std::atomic<u32> m_nAverageRenderTime;
+	std::atomic<u32> m_nMaxRenderTime;
+	std::atomic<u32> m_nXRuns;
+};
+
+#endif
@@ -0,0 +1,64 @@
+//
+// renderaheadqueue.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _renderaheadqueue_h
+#define _renderaheadqueue_h
+
+#include <atomic>
+
+#include <circle/types.h>
+
+// Lock-free queue of fixed-size stereo float blocks, passed from a single render core to a single output core
+class CRenderAheadQueue
+{
+public:
+	static constexpr size_t MinBlocks = 2;
+	static constexpr size_t MaxBlocks = 4;
+
+	CRenderAheadQueue(size_t nBlocks, size_t nBlockFrames);
+	~CRenderAheadQueue();
+
+	size_t GetBlockCount() const { return m_nBlocks; }
+	size_t GetBlockFrames() const { return m_nBlockFrames; }
+
+	// Producer side; returns nullptr if all blocks are waiting to be consumed
+	float* GetWriteBlock();
+	void CommitWriteBlock();
+
+	// Consumer side; returns nullptr if no rendered blocks are available
+	const float* GetReadBlock();
+	void ReleaseReadBlock();
+
+private:
+	// Keep the producer and consumer counters apart to avoid false sharing
+	static constexpr size_t CacheLineSize = 64;
+
+	size_t m_nBlocks;
+	size_t m_nBlockFrames;
+	float* m_pBuffer;
+
+	std::atomic<size_t> m_nWriteCount;
+	u8 m_Padding[CacheLineSize - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> m_nReadCount;
+};
+
+#endif
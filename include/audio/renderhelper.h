@@ -0,0 +1,61 @@
+//
+// renderhelper.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _renderhelper_h
+#define _renderhelper_h
+
+#include <atomic>
+
+#include <circle/types.h>
+
+// Offloads a single render job at a time from the render core to a helper core.
+// If the helper core hasn't picked up the job by the time the render core needs its
+// result, the render core takes it back and runs it itself, so a busy (or absent)
+// helper core can only cost parallelism, never correctness.
+class CRenderHelper
+{
+public:
+	using TJobFunction = void (*)(void* pParam);
+
+	CRenderHelper();
+
+	// Render core; fails if a job is already in progress (e.g. when called from within a job)
+	bool Submit(TJobFunction pJob, void* pParam);
+	void Wait();
+
+	// Helper core; runs the pending job if there is one
+	bool Poll();
+
+private:
+	enum TState : u32
+	{
+		Idle,
+		Pending,
+		Running,
+	};
+
+	TJobFunction m_pJob;
+	void* m_pParam;
+	std::atomic<u32> m_State;
+};
+
+#endif
@@ -0,0 +1,68 @@
+//
+// sampleconverter.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _sampleconverter_h
+#define _sampleconverter_h
+
+#include <circle/types.h>
+
+// Converts interleaved stereo float samples into the integer formats expected by Circle's sound devices
+class CSampleConverter
+{
+public:
+	enum class TFormat
+	{
+		// Packed 3-byte little-endian samples (PWM/HDMI)
+		Signed24,
+
+		// 24-bit samples in the low bits of a 32-bit word (I2S)
+		Signed24_32,
+	};
+
+	CSampleConverter(TFormat Format, bool bReversedStereo, bool bDither);
+
+	// Clamps, optionally dithers and swaps channels, and writes nFrames stereo frames to pOutBuffer
+	void Convert(const float* pInBuffer, void* pOutBuffer, size_t nFrames);
+
+	size_t GetBytesPerSample() const { return m_Format == TFormat::Signed24_32 ? sizeof(s32) : 3; }
+	size_t GetBytesPerFrame() const { return GetBytesPerSample() * 2; }
+
+	// Vector stores may write up to this many bytes beyond the last frame; output buffers must be padded
+	static constexpr size_t OutputPadding = 16;
+
+private:
+	size_t ConvertScalar(const float* pInBuffer, u8* pOutBuffer, size_t nFrames);
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	size_t ConvertNEON(const float* pInBuffer, u8* pOutBuffer, size_t nFrames);
+#endif
+
+	inline float NextDither();
+
+	TFormat m_Format;
+	bool m_bReversedStereo;
+	bool m_bDither;
+
+	// Independent xorshift32 generator state for each vector lane
+	u32 m_DitherState[4];
+};
+
+#endif
@@ -0,0 +1,70 @@
+//
+// bufferedfile.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _bufferedfile_h
+#define _bufferedfile_h
+
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+// Read-only file with a large read-ahead window, for parsers that issue many small sequential reads
+// Small reads and seeks within the window are served from memory; large reads go straight to the destination
+class CBufferedFile
+{
+public:
+	CBufferedFile();
+	~CBufferedFile();
+
+	bool Open(const char* pPath);
+	bool Close();
+
+	// Fails unless all nCount bytes could be read
+	bool Read(void* pBuffer, size_t nCount);
+	bool Seek(u64 nOffset);
+	u64 Tell() const { return m_nPosition; }
+	u64 GetSize() const { return f_size(&m_File); }
+
+	// Reads at least this large bypass the read-ahead window
+	static constexpr size_t DirectReadSize = 16 * 1024;
+
+private:
+	static constexpr size_t ReadAheadSize = 128 * 1024;
+	static constexpr size_t SectorSize = 512;
+	static constexpr size_t CacheLineSize = 64;
+
+	bool Fill();
+	bool SeekFile(u64 nOffset);
+
+	FIL m_File;
+	bool m_bOpen;
+
+	// Position seen by the caller, and the actual position of the underlying file
+	u64 m_nPosition;
+	u64 m_nFilePosition;
+
+	u8* m_pBufferMemory;
+	u8* m_pBuffer;
+	u64 m_nBufferStart;
+	size_t m_nBufferSize;
+};
+
+#endif
@@ -37,7 +37,8 @@ class CConfig
 public:
 	#define ENUM_SYSTEMDEFAULTSYNTH(ENUM) \
 		ENUM(MT32, mt32)                  \
-		ENUM(SoundFont, soundfont)
+		ENUM(SoundFont, soundfont)        \
+		ENUM(Split, split)
 
 	#define ENUM_AUDIOOUTPUTDEVICE(ENUM) \
 		ENUM(PWM, pwm)                   \
@@ -65,12 +66,18 @@ public:
 		ENUM(SH1106I2C, sh1106_i2c)        \
 		ENUM(SSD1306I2C, ssd1306_i2c)
 
+	#define ENUM_MIDIRECORD(ENUM) \
+		ENUM(Off, off)            \
+		ENUM(SD, sd)              \
+		ENUM(USB, usb)
+
 	#define ENUM_NETWORKMODE(ENUM) \
 		ENUM(Off, off)             \
 		ENUM(Ethernet, ethernet)   \
 		ENUM(WiFi, wifi)
 
 	CONFIG_ENUM(TSystemDefaultSynth, ENUM_SYSTEMDEFAULTSYNTH);
+	CONFIG_ENUM(TMIDIRecord, ENUM_MIDIRECORD);
 	CONFIG_ENUM(TAudioOutputDevice, ENUM_AUDIOOUTPUTDEVICE);
 	CONFIG_ENUM(TControlScheme, ENUM_CONTROLSCHEME);
 	CONFIG_ENUM(TLCDType, ENUM_LCDTYPE);
@@ -92,6 +99,7 @@ public:
 	static bool ParseOption(const char *pString, CString* pOut);
 	static bool ParseOption(const char *pString, CIPAddress* pOut);
 	static bool ParseOption(const char* pString, TSystemDefaultSynth* pOut);
+	static bool ParseOption(const char* pString, TMIDIRecord* pOut);
 	static bool ParseOption(const char* pString, TAudioOutputDevice* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuResamplerQuality* pOut);
 	static bool ParseOption(const char* pString, TMT32EmuMIDIChannels* pOut);
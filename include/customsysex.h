@@ -0,0 +1,44 @@
+//
+// customsysex.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _customsysex_h
+#define _customsysex_h
+
+#include <circle/types.h>
+
+// mt32-pi's own SysEx messages, under the 'Educational' manufacturer ID (F0 7D ...)
+enum class TCustomSysExCommand : u8
+{
+	Reboot                = 0x00,
+	SwitchMT32ROMSet      = 0x01,
+	SwitchSoundFont       = 0x02,
+	SwitchSynth           = 0x03,
+	SetMT32ReversedStereo = 0x04,
+	SetMIDIRecording      = 0x05,
+};
+
+// Returns true if the complete SysEx message (including F0 and F7) is a valid custom command, and fills in the
+// command and its parameter (0 for commands without one); anything else should be passed on to the synth
+bool ParseCustomSysEx(const u8* pData, size_t nSize, TCustomSysExCommand& Command, u8& nParameter);
+
+#endif
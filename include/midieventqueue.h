@@ -0,0 +1,150 @@
+//
+// midieventqueue.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _midieventqueue_h
+#define _midieventqueue_h
+
+#include <atomic>
+
+#include <circle/types.h>
+
+#include "midiparser.h"
+#include "spscringbuffer.h"
+
+struct TMIDIEvent
+{
+	enum class TType : u8
+	{
+		ShortMessage,
+		SysEx,
+		AllSoundOff,
+		SetMasterVolume,
+		SwapSoundFont,
+	};
+
+	TType Type;
+
+	// Time the event was received (CTimer clock ticks)
+	u32 nTimestamp;
+
+	// Short message, SysEx size, or command parameter
+	u32 nData;
+
+	// SysEx data; only valid until the next event is dequeued
+	const u8* pSysExData;
+};
+
+// Timestamped queue of MIDI events and synth commands, from the MIDI core to the core that renders the synth
+class CMIDIEventQueue
+{
+public:
+	// Larger than the MIDI parser's SysEx buffer
+	static constexpr size_t MaxSysExSize = 1024;
+	static_assert(MaxSysExSize >= CMIDIParser::SysExBufferSize, "Every SysEx message from the MIDI parser must fit");
+
+	struct TStatistics
+	{
+		u32 nEvents;
+		u32 nOverflows;
+		u32 nAverageLatency;
+		u32 nMaxLatency;
+		u32 nMaxLockWait;
+		u32 nCoalesced;
+	};
+
+	CMIDIEventQueue();
+
+	// Producer
+	bool EnqueueShortMessage(u32 nMessage, u32 nTimestamp);
+	bool EnqueueSysEx(const u8* pData, size_t nSize, u32 nTimestamp);
+	bool EnqueueCommand(TMIDIEvent::TType Type, u32 nParameter = 0);
+
+	// Drop controller, pitch bend and channel pressure messages that are overridden later in the same block
+	void SetCoalescing(bool bEnabled) { m_bCoalescing = bEnabled; }
+
+	// Consumer; nTicks is the current time, used to measure queueing latency
+	bool Dequeue(TMIDIEvent& OutEvent, u32 nTicks);
+	bool Peek(TMIDIEvent& OutEvent) const { return m_Events.Peek(OutEvent); }
+	void RecordLockWait(u32 nTicks);
+
+	// Events received during the previous block are played back one block later at the same relative position
+	void BeginBlock(unsigned int nSampleRate);
+	size_t GetNextEventFrame(size_t nFrames) const;
+
+	// Safe to call from any core
+	void GetStatistics(TStatistics& OutStatistics) const;
+
+private:
+	static constexpr size_t EventBufferSize = 1024;
+
+	// SysEx messages arriving while a single block renders, e.g. a game uploading patches; the ring holds one byte less
+	static constexpr size_t SysExBurstSize = 16;
+	static constexpr size_t SysExBufferSize = MaxSysExSize * SysExBurstSize;
+
+	// Dropped events are reported at most this often
+	static constexpr unsigned int OverflowWarningMillis = 1000;
+
+	// Maximum number of events per block considered for coalescing
+	static constexpr size_t CoalesceWindow = 256;
+
+	// Per channel: one key for each controller, then pitch bend and channel pressure
+	static constexpr size_t CoalesceKeyCount = 128 + 2;
+
+	bool Enqueue(TMIDIEvent::TType Type, u32 nData, u32 nTimestamp);
+	void ReportOverflow();
+
+	void FindSupersededEvents();
+	void DropSupersededEvents();
+	static bool GetCoalesceKey(u32 nMessage, size_t& nOutKey);
+
+	CSPSCRingBuffer<TMIDIEvent, EventBufferSize> m_Events;
+	CSPSCRingBuffer<u8, SysExBufferSize> m_SysExData;
+
+	// Consumer-side copy of the current SysEx message
+	u8 m_SysExBuffer[MaxSysExSize];
+
+	// Producer-side overflow reporting
+	u32 m_nUnreportedOverflows;
+	u32 m_nLastOverflowWarningTime;
+
+	// Block scheduling
+	unsigned int m_nSampleRate;
+	u32 m_nBlockStartTime;
+	u32 m_nPrevBlockStartTime;
+
+	// Coalescing; event indices are relative to the front of the queue when the block started
+	bool m_bCoalescing;
+	size_t m_nBlockEventIndex;
+	size_t m_nBlockEventCount;
+	u32 m_SupersededEvents[CoalesceWindow / 32];
+
+	// Statistics
+	std::atomic<u32> m_nEvents;
+	std::atomic<u32> m_nOverflows;
+	std::atomic<u32> m_nAverageLatency;
+	std::atomic<u32> m_nMaxLatency;
+	std::atomic<u32> m_nMaxLockWait;
+	std::atomic<u32> m_nCoalesced;
+	u64 m_nTotalLatency;
+};
+
+#endif
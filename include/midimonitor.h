@@ -23,29 +23,41 @@
 #ifndef _midimonitor_h
 #define _midimonitor_h
 
+#include <atomic>
+
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
 #include "utility.h"
 
+// Note/controller state is written by the MIDI core and read by the UI core; a sequence lock
+// lets the reader take a consistent snapshot without ever blocking the writer
 class CMIDIMonitor
 {
 public:
 	CMIDIMonitor();
 
+	// Writers; may be called from any core
 	void OnShortMessage(u32 nMessage);
-	void GetChannelLevels(unsigned int nTicks, float* pOutLevels, float* pOutPeaks, u16 nPercussionBitMask = (1 << 9));
 	void AllNotesOff();
 	void ResetControllers(bool bIsResetAllControllers);
 
+	// Reader; UI core only
+	void GetChannelLevels(unsigned int nTicks, float* pOutLevels, float* pOutPeaks, u16 nPercussionBitMask = (1 << 9));
+
 private:
 	static constexpr u8 ChannelCount = 16;
-	static constexpr u8 NoteCount = 127;
+	static constexpr u8 NoteCount = 128;
+	static constexpr u8 ActiveNoteWords = NoteCount / 32;
 
 	static constexpr float AttackTimeMillis = 20.0f;
 	static constexpr float DecayTimeMillis = 100.0f;
 	static constexpr float SustainLevel = 0.8f;
 	static constexpr float ReleaseTimeMillis = 150.0f;
 
+	// All channels are pruned this often, so that notes on channels that have gone quiet are removed too
+	static constexpr float PruneIntervalMillis = 50.0f;
+
 	static constexpr float PeakHoldTimeMillis = 2000.0f;
 	static constexpr float PeakFalloffTimeMillis = 1000.0f;
 
@@ -72,13 +84,46 @@ private:
 		u8 nPan;
 		u8 nDamper;
 		TNoteState Notes[NoteCount];
+
+		// Bitmap of notes whose envelope hasn't finished
+		u32 ActiveNotes[ActiveNoteWords];
 	};
 
+	// Consistent copy of the sounding notes of one channel
+	struct TChannelSnapshot
+	{
+		u8 nVolume;
+		u8 nExpression;
+		size_t nNotes;
+		TNoteState Notes[NoteCount];
+	};
+
+	void BeginWrite();
+	void EndWrite();
+	void ReadChannel(u8 nChannel, TChannelSnapshot& OutSnapshot) const;
+
 	void ProcessCC(u8 nChannel, u8 nCC, u8 nValue, unsigned int nTicks);
-	inline float ComputeEnvelope(TNoteState& NoteState) const;
-	inline float ComputePercussionEnvelope(TNoteState& NoteState) const;
+	void ReleaseAllNotes(unsigned int nTicks);
+	void ResetControllerState(bool bIsResetAllControllers);
+	void PruneAllNotes(unsigned int nTicks);
+	void PruneNotes(TChannelState& ChannelState, bool bIsPercussionChannel, unsigned int nTicks);
+	static inline void SetNoteActive(TChannelState& ChannelState, u8 nNote);
+	static inline float ComputeEnvelope(const TNoteState& NoteState, unsigned int nTicks);
+	static inline float ComputePercussionEnvelope(const TNoteState& NoteState, unsigned int nTicks);
+
+	// Serializes writers (e.g. the MIDI core and a synth reset on the render core); never taken by the reader
+	CSpinLock m_WriteLock;
+
+	// Odd while a write is in progress
+	std::atomic<u32> m_nSequence;
 
 	TChannelState m_State[ChannelCount];
+	unsigned int m_nLastPruneTime;
+
+	// Percussion notes never sustain, so they can be pruned before they're released; set by the reader
+	std::atomic<u16> m_nPercussionBitMask;
+
+	// Only accessed by the reader
 	float m_PeakLevels[ChannelCount];
 	unsigned int m_PeakTimes[ChannelCount];
 };
@@ -25,19 +25,52 @@
 
 #include <circle/types.h>
 
+// Position of a piece of a SysEx message too large to be buffered whole
+enum class TSysExFragment
+{
+	// Starts with F0
+	Begin,
+	Continue,
+
+	// Ends with F7
+	End,
+
+	// The message was cut short by an unexpected status byte; no data
+	Abort,
+};
+
+class CMIDIParserHandler
+{
+public:
+	virtual void OnShortMessage(u32 nMessage, u32 nTimestamp) = 0;
+	virtual void OnSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) = 0;
+
+	// Only called if SysEx streaming is enabled, for messages that don't fit in the parser's buffer
+	virtual void OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) {}
+
+	virtual void OnUnexpectedStatus() {}
+	virtual void OnSysExOverflow() {}
+};
+
+// Use one parser per MIDI input, so that running status and partial SysEx messages from different inputs can't mix
 class CMIDIParser
 {
 public:
-	CMIDIParser();
+	CMIDIParser(CMIDIParserHandler* pHandler = nullptr);
+
+	void SetHandler(CMIDIParserHandler* pHandler) { m_pHandler = pHandler; }
 
-	void ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNoteOns = false);
+	// Deliver oversized SysEx messages in fragments instead of dropping them
+	void SetSysExStreaming(bool bEnabled) { m_bSysExStreaming = bEnabled; }
 
-protected:
-	virtual void OnShortMessage(u32 nMessage) = 0;
-	virtual void OnSysExMessage(const u8* pData, size_t nSize) = 0;
+	// nTimestamp is the time the bytes were received (CTimer clock ticks), and is passed on with each message
+	void ParseMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp, bool bIgnoreNoteOns = false);
 
-	virtual void OnUnexpectedStatus();
-	virtual void OnSysExOverflow();
+	// True if the bytes are exactly one well-formed short message, which can bypass the parser (e.g. a USB MIDI packet)
+	static bool IsCompleteShortMessage(const u8* pData, size_t nSize);
+
+	// Largest SysEx message (or fragment) passed to the handler; matches mt32emu's SysEx buffer size
+	static constexpr size_t SysExBufferSize = 1000;
 
 private:
 	enum class TState
@@ -47,17 +80,23 @@ private:
 		SysExByte
 	};
 
-	// Matches mt32emu's SysEx buffer size
-	static constexpr size_t SysExBufferSize = 1000;
+	static size_t FindStatusByte(const u8* pData, size_t nSize);
 
+	void UnexpectedStatus();
+	void SysExOverflow();
 	void ParseStatusByte(u8 nByte);
 	bool CheckCompleteShortMessage(bool bIgnoreNoteOns = false);
 	u32 PrepareShortMessage() const;
 	void ResetState(bool bClearStatusByte);
 
+	CMIDIParserHandler* m_pHandler;
+	bool m_bSysExStreaming;
+	bool m_bSysExFragmented;
+
 	TState m_State;
 	u8 m_MessageBuffer[SysExBufferSize];
 	size_t m_nMessageLength;
+	u32 m_nTimestamp;
 };
 
 #endif
@@ -0,0 +1,123 @@
+//
+// midirecorder.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _midirecorder_h
+#define _midirecorder_h
+
+#include <atomic>
+
+#include <circle/sched/task.h>
+#include <circle/string.h>
+#include <circle/types.h>
+#include <fatfs/ff.h>
+
+#include "midiparser.h"
+#include "spscringbuffer.h"
+
+// Captures received MIDI messages and their arrival times to a Standard MIDI File
+// Messages are encoded into a lock-free buffer by the main task, and written to disk in large blocks by this task
+class CMIDIRecorder : protected CTask
+{
+public:
+	CMIDIRecorder();
+	virtual ~CMIDIRecorder() override;
+
+	bool Initialize();
+
+	// Main task only; pVolume is the FatFs volume to record to, e.g. "SD:"
+	bool StartRecording(const char* pVolume);
+	void StopRecording();
+	bool IsRecording() const { return m_bRecording; }
+	bool IsBusy() const { return m_State != TState::Idle; }
+
+	// Main task only; never blocks, and drops messages if the buffer is full
+	void RecordShortMessage(u32 nMessage, u32 nTimestamp);
+	void RecordSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp);
+	void RecordSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp);
+
+	u32 GetDroppedMessageCount() const { return m_nDroppedMessages.load(std::memory_order_relaxed); }
+
+	virtual void Run() override;
+
+private:
+	enum class TState
+	{
+		Idle,
+		Starting,
+		Recording,
+		Stopping,
+	};
+
+	// 5000 ticks per quarter note at 120 BPM gives a resolution of 100 microseconds
+	static constexpr u16 TicksPerQuarterNote = 5000;
+	static constexpr u32 MicrosecondsPerQuarterNote = 500000;
+	static constexpr u32 MicrosecondsPerTick = MicrosecondsPerQuarterNote / TicksPerQuarterNote;
+
+	// Largest possible event: 4-byte delta time, SysEx status, 4-byte length, and a full parser buffer
+	static constexpr size_t MaxEventSize = 4 + 1 + 4 + 1000;
+
+	static constexpr size_t BufferSize = 64 * 1024;
+	static constexpr size_t WriteBlockSize = 4096;
+
+	static constexpr unsigned int PollIntervalMillis = 20;
+	static constexpr unsigned int SyncIntervalMillis = 2000;
+
+	// Producer
+	void BeginEvent(u32 nTimestamp);
+	void WriteVariableLength(u32 nValue);
+	void WriteSysExPacket(u8 nStatus, const u8* pData, size_t nSize);
+	bool EndEvent();
+
+	// Consumer
+	bool OpenFile();
+	bool WriteBlocks(bool bFlushAll);
+	void CloseFile();
+	bool WriteTrackLength();
+	void DiscardBuffer();
+
+	volatile TState m_State;
+	volatile bool m_bRecording;
+	CString m_Volume;
+
+	// Producer state
+	u32 m_nLastTimestamp;
+	u64 m_nElapsedMicroseconds;
+	u32 m_nLastTick;
+	u32 m_nEventTick;
+	bool m_bSysExOpen;
+	bool m_bDroppingSysEx;
+	size_t m_nEventSize;
+	u8 m_EventBuffer[MaxEventSize];
+	std::atomic<u32> m_nDroppedMessages;
+
+	CSPSCRingBuffer<u8, BufferSize> m_Buffer;
+
+	// Consumer state
+	bool m_bFileOpen;
+	FIL m_File;
+	CString m_FileName;
+	size_t m_nWriteBlockSize;
+	u8 m_WriteBlock[WriteBlockSize];
+	unsigned int m_nLastWriteTime;
+};
+
+#endif
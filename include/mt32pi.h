@@ -47,26 +47,33 @@
 #include <wlan/bcm4343.h>
 #include <wlan/hostap/wpa_supplicant/wpasupplicant.h>
 
+#include "audio/latencycontroller.h"
+#include "audio/renderaheadqueue.h"
+#include "audio/renderhelper.h"
 #include "config.h"
 #include "control/control.h"
 #include "control/mister.h"
 #include "event.h"
 #include "lcd/ui.h"
 #include "midiparser.h"
+#include "midirecorder.h"
 #include "net/applemidi.h"
 #include "net/ftpdaemon.h"
 #include "net/udpmidi.h"
 #include "pisound.h"
 #include "power.h"
-#include "ringbuffer.h"
+#include "spscringbuffer.h"
 #include "synth/mt32romset.h"
 #include "synth/mt32synth.h"
 #include "synth/soundfontsynth.h"
+#include "synth/splitsynth.h"
 #include "synth/synth.h"
 
 //#define MONITOR_TEMPERATURE
+//#define MONITOR_MIDI_EVENTS
+//#define MONITOR_AUDIO_LATENCY
 
-class CMT32Pi : CMultiCoreSupport, CPower, CMIDIParser, CAppleMIDIHandler, CUDPMIDIHandler
+class CMT32Pi : CMultiCoreSupport, CPower, CMIDIParserHandler, CAppleMIDIHandler, CUDPMIDIHandler
 {
 public:
 	CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSystem* pInterrupt, CGPIOManager* pGPIOManager, CSerialDevice* pSerialDevice, CUSBHCIDevice* pUSBHCI);
@@ -86,7 +93,35 @@ private:
 		Spinner,
 	};
 
+	// Each MIDI input has its own parser; complete messages from all of them are merged in arrival order
+	enum class TMIDISource : u8
+	{
+		SerialGPIO,
+		USBSerial,
+		Pisound,
+		AppleMIDI,
+		UDPMIDI,
+
+		// Must be last; each USB-MIDI cable number is a separate source
+		USBMIDI,
+	};
+
+	static constexpr size_t USBMIDICableCount = 16;
+	static constexpr size_t MIDIParserCount = static_cast<size_t>(TMIDISource::USBMIDI) + USBMIDICableCount;
+
+	// A complete short message decoded by the interrupt handler, or the source, cable and size of a chunk of
+	// bytes in the MIDI receive buffer that still needs parsing, along with its arrival time
+	struct TMIDIRxPacket
+	{
+		TMIDISource Source;
+		u8 nCable;
+		bool bShortMessage;
+		u32 nTimestamp;
+		u32 nData;
+	};
+
 	static constexpr size_t MIDIRxBufferSize = 2048;
+	static constexpr size_t MIDIRxPacketBufferSize = 1024;
 
 	// CPower
 	virtual void OnEnterPowerSavingMode() override;
@@ -94,36 +129,42 @@ private:
 	virtual void OnThrottleDetected() override;
 	virtual void OnUnderVoltageDetected() override;
 
-	// CMIDIParser
-	virtual void OnShortMessage(u32 nMessage) override;
-	virtual void OnSysExMessage(const u8* pData, size_t nSize) override;
+	// CMIDIParserHandler
+	virtual void OnShortMessage(u32 nMessage, u32 nTimestamp) override;
+	virtual void OnSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) override;
+	virtual void OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) override;
 	virtual void OnUnexpectedStatus() override;
 	virtual void OnSysExOverflow() override;
 
 	// CAppleMIDIHandler
-	virtual void OnAppleMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(pData, nSize); };
+	virtual void OnAppleMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(TMIDISource::AppleMIDI, pData, nSize, CTimer::GetClockTicks()); };
 	virtual void OnAppleMIDIConnect(const CIPAddress* pIPAddress, const char* pName) override;
 	virtual void OnAppleMIDIDisconnect(const CIPAddress* pIPAddress, const char* pName) override;
 
 	// CUDPMIDIHandler
-	virtual void OnUDPMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(pData, nSize); };
+	virtual void OnUDPMIDIDataReceived(const u8* pData, size_t nSize) override { ParseMIDIBytes(TMIDISource::UDPMIDI, pData, nSize, CTimer::GetClockTicks()); };
 
 	// Initialization
 	bool InitNetwork();
 	bool InitMT32Synth();
 	bool InitSoundFontSynth();
+	bool InitSplitSynth();
 
 	// Tasks for specific CPU cores
 	void MainTask();
 	void UITask();
 	void AudioTask();
+	void RenderTask();
 
 	void UpdateUSB(bool bStartup = false);
 	void UpdateNetwork();
 	void UpdateMIDI();
 	void PurgeMIDIBuffers();
 	size_t ReceiveSerialMIDI(u8* pOutData, size_t nSize);
+	size_t ProcessBufferedMIDI(bool bIgnoreNoteOns = false);
+	void ParseMIDIBytes(TMIDISource Source, const u8* pData, size_t nSize, u32 nTimestamp, bool bIgnoreNoteOns = false, u8 nCable = 0);
 	bool ParseCustomSysEx(const u8* pData, size_t nSize);
+	void SetMIDIRecording(u8 nMode);
 
 	void ProcessEventQueue();
 	void ProcessButtonEvent(const TButtonEvent& Event);
@@ -172,6 +213,12 @@ private:
 #ifdef MONITOR_TEMPERATURE
 	unsigned m_nTempUpdateTime;
 #endif
+#ifdef MONITOR_MIDI_EVENTS
+	unsigned m_nMIDIEventStatsTime;
+#endif
+#ifdef MONITOR_AUDIO_LATENCY
+	unsigned m_nLatencyStatsTime;
+#endif
 
 	CControl* m_pControl;
 
@@ -203,6 +250,11 @@ private:
 
 	// Audio output
 	CSoundBaseDevice* m_pSound;
+	CRenderAheadQueue* m_pRenderAheadQueue;
+	CLatencyController* m_pLatencyController;
+	u32 m_nLastXRuns;
+	size_t m_nLastTargetFrames;
+	CRenderHelper m_RenderHelper;
 
 	// Extra devices
 	CPisound* m_pPisound;
@@ -212,9 +264,17 @@ private:
 	CSynthBase* m_pCurrentSynth;
 	CMT32Synth* m_pMT32Synth;
 	CSoundFontSynth* m_pSoundFontSynth;
+	CSplitSynth* m_pSplitSynth;
+
+	// MIDI capture to a Standard MIDI File
+	CMIDIRecorder* m_pMIDIRecorder;
+
+	// MIDI parsers, indexed by TMIDISource plus USB-MIDI cable number; all are fed on core 0 by the main task or network tasks
+	CMIDIParser m_MIDIParsers[MIDIParserCount];
 
-	// MIDI receive buffer
-	CRingBuffer<u8, MIDIRxBufferSize> m_MIDIRxBuffer;
+	// MIDI receive buffer; filled by interrupt handlers on core 0, emptied by the main task
+	CSPSCRingBuffer<u8, MIDIRxBufferSize> m_MIDIRxBuffer;
+	CSPSCRingBuffer<TMIDIRxPacket, MIDIRxPacketBufferSize> m_MIDIRxPackets;
 
 	// Event handling
 	TEventQueue m_EventQueue;
@@ -222,7 +282,8 @@ private:
 	static void EventHandler(const TEvent& Event);
 	static void USBMIDIDeviceRemovedHandler(CDevice* pDevice, void* pContext);
 	static void USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength);
-	static void IRQMIDIReceiveHandler(const u8* pData, size_t nSize);
+	static void PisoundMIDIReceiveHandler(const u8* pData, size_t nSize);
+	static void IRQMIDIReceive(TMIDISource Source, u8 nCable, const u8* pData, size_t nSize);
 
 	static void PanicHandler();
 
@@ -24,6 +24,8 @@
 #define _soundfontmanager_h
 
 #include <circle/string.h>
+#include <circle/types.h>
+#include <fatfs/ff.h>
 
 #include "synth/fxprofile.h"
 
@@ -47,11 +49,32 @@ private:
 	{
 		CString Name;
 		CString Path;
+		u16 nPresets;
+		bool bHasFXProfile;
+	};
+
+	// Result of probing a file in a SoundFont directory; cached on disk so unchanged files aren't probed again
+	struct TSoundFontIndexEntry
+	{
+		CString FileName;
+		FSIZE_t nFileSize;
+		u16 nFileDate;
+		u16 nFileTime;
+		bool bSoundFont;
+		CString Name;
+		u16 nPresets;
 	};
 
 	static constexpr size_t MaxSoundFontNameLength = 256;
+	// Every SoundFont, plus as many other files (e.g. effects profiles)
+	static constexpr size_t MaxIndexEntries = MaxSoundFonts * 2;
+
+	void ScanDirectory(const char* pDirectoryPath);
+	static bool ProbeSoundFont(const char* pFullPath, TSoundFontIndexEntry& Entry);
+	static void GetFXProfilePath(const char* pSoundFontPath, CString& FXProfilePath);
 
-	void CheckSoundFont(const char* pFullPath, const char* pFileName);
+	static size_t LoadIndex(const char* pDirectoryPath, TSoundFontIndexEntry*& pEntries);
+	static bool SaveIndex(const char* pDirectoryPath, const TSoundFontIndexEntry* pEntries, size_t nEntries);
 
 	size_t m_nSoundFonts;
 	TSoundFontListEntry m_SoundFontList[MaxSoundFonts];
@@ -0,0 +1,143 @@
+//
+// spscringbuffer.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _spscringbuffer_h
+#define _spscringbuffer_h
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+#include <circle/types.h>
+
+#include "utility.h"
+
+// Lock-free ring buffer for exactly one producer and one consumer, which may be on different cores or in
+// interrupt context; neither side ever waits for the other
+template <class T, size_t N>
+class CSPSCRingBuffer
+{
+public:
+	CSPSCRingBuffer()
+		: m_nInPtr(0),
+		  m_InPadding{},
+		  m_nOutPtr(0),
+		  m_OutPadding{},
+		  m_Data{}
+	{
+	}
+
+	// Producer
+	bool Enqueue(const T& Item)
+	{
+		const size_t nInPtr = m_nInPtr.load(std::memory_order_relaxed);
+		const size_t nNextInPtr = (nInPtr + 1) & BufferMask;
+
+		if (nNextInPtr == m_nOutPtr.load(std::memory_order_acquire))
+			return false;
+
+		m_Data[nInPtr] = Item;
+		m_nInPtr.store(nNextInPtr, std::memory_order_release);
+		return true;
+	}
+
+	size_t Enqueue(const T* pItems, size_t nCount)
+	{
+		const size_t nInPtr = m_nInPtr.load(std::memory_order_relaxed);
+		const size_t nOutPtr = m_nOutPtr.load(std::memory_order_acquire);
+		const size_t nFree = (nOutPtr - nInPtr - 1) & BufferMask;
+		const size_t nEnqueued = Utility::Min(nCount, nFree);
+
+		// Copy in up to two segments, split where the buffer wraps around
+		const size_t nFirstCount = Utility::Min(nEnqueued, N - nInPtr);
+		memcpy(m_Data + nInPtr, pItems, nFirstCount * sizeof(T));
+		memcpy(m_Data, pItems + nFirstCount, (nEnqueued - nFirstCount) * sizeof(T));
+
+		m_nInPtr.store((nInPtr + nEnqueued) & BufferMask, std::memory_order_release);
+		return nEnqueued;
+	}
+
+	// Free space can only grow until the producer enqueues more items
+	size_t GetFreeSpace() const
+	{
+		const size_t nInPtr = m_nInPtr.load(std::memory_order_relaxed);
+		const size_t nOutPtr = m_nOutPtr.load(std::memory_order_acquire);
+		return (nOutPtr - nInPtr - 1) & BufferMask;
+	}
+
+	// Consumer; nOffset selects an item further from the front of the queue
+	bool Peek(T& OutItem, size_t nOffset = 0) const
+	{
+		const size_t nOutPtr = m_nOutPtr.load(std::memory_order_relaxed);
+		const size_t nInPtr = m_nInPtr.load(std::memory_order_acquire);
+
+		if (nOffset >= ((nInPtr - nOutPtr) & BufferMask))
+			return false;
+
+		OutItem = m_Data[(nOutPtr + nOffset) & BufferMask];
+		return true;
+	}
+
+	bool Dequeue(T& OutItem)
+	{
+		const size_t nOutPtr = m_nOutPtr.load(std::memory_order_relaxed);
+
+		if (nOutPtr == m_nInPtr.load(std::memory_order_acquire))
+			return false;
+
+		OutItem = m_Data[nOutPtr];
+		m_nOutPtr.store((nOutPtr + 1) & BufferMask, std::memory_order_release);
+		return true;
+	}
+
+	size_t Dequeue(T* pOutBuffer, size_t nMaxCount)
+	{
+		const size_t nOutPtr = m_nOutPtr.load(std::memory_order_relaxed);
+		const size_t nInPtr = m_nInPtr.load(std::memory_order_acquire);
+		const size_t nUsed = (nInPtr - nOutPtr) & BufferMask;
+		const size_t nDequeued = Utility::Min(nMaxCount, nUsed);
+
+		const size_t nFirstCount = Utility::Min(nDequeued, N - nOutPtr);
+		memcpy(pOutBuffer, m_Data + nOutPtr, nFirstCount * sizeof(T));
+		memcpy(pOutBuffer + nFirstCount, m_Data, (nDequeued - nFirstCount) * sizeof(T));
+
+		m_nOutPtr.store((nOutPtr + nDequeued) & BufferMask, std::memory_order_release);
+		return nDequeued;
+	}
+
+private:
+	static_assert(Utility::IsPowerOfTwo(N), "Ring buffer size must be a power of 2");
+	static_assert(std::is_trivially_copyable<T>::value, "Ring buffer items are copied with memcpy");
+
+	static constexpr size_t BufferMask = N - 1;
+
+	// Keep the producer and consumer indices on separate cache lines to avoid false sharing
+	static constexpr size_t CacheLineSize = 64;
+
+	std::atomic<size_t> m_nInPtr;
+	u8 m_InPadding[CacheLineSize - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> m_nOutPtr;
+	u8 m_OutPadding[CacheLineSize - sizeof(std::atomic<size_t>)];
+	T m_Data[N];
+};
+
+#endif
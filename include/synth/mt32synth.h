@@ -54,8 +54,9 @@ public:
 
 	// CSynthBase
 	virtual bool Initialize() override;
-	virtual void HandleMIDIShortMessage(u32 nMessage) override;
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) override;
+	virtual void HandleMIDIShortMessage(u32 nMessage, u32 nTimestamp) override;
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) override;
+	virtual void HandleMIDISysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) override;
 	virtual bool IsActive() override { return m_pSynth->isActive(); }
 	virtual void AllSoundOff() override;
 	virtual void SetMasterVolume(u8 nVolume) override;
@@ -74,12 +75,20 @@ public:
 
 	u8 GetMasterVolume() const;
 
+	// Render core only
+	u32 GetActivePartialCount() const;
+
 private:
 	static constexpr size_t MT32ChannelCount = 9;
 
 	// N characters plus null terminator
 	static constexpr size_t LCDTextBufferSize = 20 + 1;
 
+	// Streamed data sets are passed on to mt32emu as a series of data sets of up to this many bytes
+	static constexpr size_t SysExStreamChunkSize = 256;
+
+	void SendSysExStreamChunk(size_t nSize, u32 nTimestamp);
+	void BeginRender(size_t nFrames);
 	void GetPartLevels(unsigned int nTicks, float PartLevels[9], float PartPeaks[9]);
 
 	// MT32Emu::ReportHandler
@@ -106,6 +115,14 @@ private:
 
 	// LCD state
 	char m_LCDTextBuffer[LCDTextBufferSize];
+
+	// Streamed SysEx data set; one extra byte is held back because the last one before EOX is the checksum
+	bool m_bSysExStreamActive;
+	u8 m_nSysExStreamDeviceID;
+	u32 m_nSysExStreamAddress;
+	u8 m_nSysExStreamChecksum;
+	size_t m_nSysExStreamLength;
+	u8 m_SysExStreamData[SysExStreamChunkSize + 1];
 };
 
 #endif
@@ -0,0 +1,92 @@
+//
+// presetcache.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _presetcache_h
+#define _presetcache_h
+
+#include <circle/types.h>
+
+#include <fluidsynth.h>
+
+#include "synth/soundfontloader.h"
+
+// Keeps the samples of recently selected presets loaded when FluidSynth is loading samples on demand
+// Presets are pinned by the main task before the program change that selects them reaches the synth, so that
+// samples are never loaded from storage by the render core; the least recently used are unpinned to stay within a memory limit
+class CPresetCache
+{
+public:
+	// Bank 0 program 0 and the standard drum kit are pinned when the SoundFont is loaded, and are never evicted
+	static constexpr int DrumBank = 128;
+
+	CPresetCache(size_t nMemoryLimit);
+
+	// Main task only
+	// Presets are pinned on every instance of the SoundFont; pSecondarySynth is only used if it has a secondary instance
+	void SetSoundFont(fluid_synth_t* pSynth, fluid_synth_t* pSecondarySynth, const TSoundFont& SoundFont);
+	void UnpinAll();
+	void ResetChannels();
+
+	// Main task only; resolves the preset that FluidSynth will select for a program change the same way it does
+	// Returns true if its samples are already pinned (or it doesn't exist); otherwise Pin() must be called before the synth selects it
+	bool Lookup(u8 nChannel, bool bDrums, int& nBank, int& nProgram);
+	bool Pin(u8 nChannel, int nBank, int nProgram);
+
+	// Called by the SoundFont loader with its own synth
+	static bool PinDefaultPresets(fluid_synth_t* pSynth, int nSoundFontID);
+	static void UnpinDefaultPresets(fluid_synth_t* pSynth, int nSoundFontID);
+
+private:
+	static constexpr size_t MaxEntries = 256;
+	static constexpr int NoEntry = -1;
+
+	struct TEntry
+	{
+		int nBank;
+		int nProgram;
+		size_t nSize;
+		u32 nLastUsed;
+	};
+
+	bool ResolvePreset(bool bDrums, int& nBank, int& nProgram) const;
+	bool PinPreset(int nBank, int nProgram);
+	void UnpinPreset(int nBank, int nProgram);
+	int FindEntry(int nBank, int nProgram) const;
+	bool IsSelected(int nEntry) const;
+	bool EvictLeastRecentlyUsed();
+	void RemoveEntry(int nEntry);
+
+	fluid_synth_t* m_pSynth;
+	fluid_synth_t* m_pSecondarySynth;
+	TSoundFont m_SoundFont;
+	size_t m_nMemoryLimit;
+	size_t m_nUsedMemory;
+
+	TEntry m_Entries[MaxEntries];
+	size_t m_nEntries;
+	u32 m_nUseCounter;
+
+	// Entry selected on each channel, so that presets in use are never evicted
+	int m_ChannelEntries[16];
+};
+
+#endif
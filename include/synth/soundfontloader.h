@@ -0,0 +1,121 @@
+//
+// soundfontloader.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _soundfontloader_h
+#define _soundfontloader_h
+
+#include <atomic>
+
+#include <circle/sched/task.h>
+#include <circle/spinlock.h>
+#include <circle/string.h>
+#include <circle/types.h>
+
+#include <fluidsynth.h>
+
+// A SoundFont loaded once for each synth, so that the reference counts of its samples are only ever updated by the core rendering
+// that synth; FluidSynth's sample cache shares the sample data itself between the instances
+struct TSoundFont
+{
+	fluid_sfont_t* pPrimary;
+	fluid_sfont_t* pSecondary;
+};
+
+// Loads SoundFonts without blocking the main task, ready to be added to a synth that's already running
+// Storage can only be accessed from core 0, so this is a task on core 0 that yields to the others between file reads
+class CSoundFontLoader : protected CTask
+{
+public:
+	CSoundFontLoader();
+	virtual ~CSoundFontLoader() override;
+
+	// pSynthLock is held while samples are pinned or SoundFonts unloaded; voices ending in the synths can unload samples too
+	bool Initialize(CSpinLock* pSynthLock, bool bSecondaryInstance, bool bDynamicSamples);
+
+	// Main task and loader only; takes the synth lock, yielding first if the other task is holding it
+	void LockSynth();
+	void UnlockSynth();
+
+	// Main task only; a load already in progress for a different SoundFont is cancelled
+	void Load(size_t nIndex, const char* pSoundFontPath);
+	void Cancel();
+	bool IsBusy() const { return m_bRequestPending || m_bLoading || m_bResultReady; }
+	bool IsLoading(size_t nIndex) const;
+
+	// Main task only; returns true when a load has finished, with a null primary instance if it failed
+	bool TakeResult(size_t& nIndex, TSoundFont& SoundFont);
+
+	// Main task only; loads a SoundFont in the foreground
+	bool LoadNow(const char* pSoundFontPath, TSoundFont& SoundFont);
+
+	// The SoundFont must no longer be part of any synth
+	// Unloading is deferred until any voices still playing its samples have finished
+	void FreeSoundFont(const TSoundFont& SoundFont);
+
+	// Main task only; retries deferred unloads, and returns true if any SoundFonts are still in use
+	bool UnloadPendingSoundFonts();
+
+	// Called from FluidSynth's file reading functions
+	static bool IsLoaderTask();
+	static bool YieldIfDue();
+
+	virtual void Run() override;
+
+private:
+	static constexpr unsigned int PollIntervalMillis = 10;
+	static constexpr unsigned int YieldIntervalMicros = 1000;
+	static constexpr unsigned int UnloadRetryMillis = 100;
+
+	bool LoadSoundFont(const char* pSoundFontPath, TSoundFont& SoundFont);
+	fluid_sfont_t* LoadInstance(const char* pSoundFontPath);
+	void FreeInstance(fluid_sfont_t* pSoundFont);
+
+	// Never renders; SoundFonts are loaded into and unloaded from this synth only
+	fluid_settings_t* m_pSettings;
+	fluid_synth_t* m_pSynth;
+	CSpinLock* m_pSynthLock;
+	CTask* m_pSynthLockOwner;
+	bool m_bSecondaryInstance;
+	bool m_bDynamicSamples;
+	bool m_bUnloadPending;
+	unsigned int m_nLastUnloadTime;
+
+	// Request from the main task
+	std::atomic<bool> m_bRequestPending;
+	size_t m_nRequestIndex;
+	CString m_RequestPath;
+
+	// Load in progress
+	std::atomic<bool> m_bLoading;
+	std::atomic<bool> m_bCancel;
+	size_t m_nLoadingIndex;
+	unsigned int m_nLastYieldTime;
+
+	// Finished load waiting to be collected
+	std::atomic<bool> m_bResultReady;
+	size_t m_nResultIndex;
+	TSoundFont m_ResultSoundFont;
+
+	static CSoundFontLoader* s_pThis;
+};
+
+#endif
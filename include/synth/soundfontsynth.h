@@ -23,12 +23,16 @@
 #ifndef _soundfontsynth_h
 #define _soundfontsynth_h
 
+#include <atomic>
+
 #include <circle/types.h>
 
 #include <fluidsynth.h>
 
 #include "soundfontmanager.h"
 #include "synth/fxprofile.h"
+#include "synth/presetcache.h"
+#include "synth/soundfontloader.h"
 #include "synth/synthbase.h"
 
 class CSoundFontSynth : public CSynthBase
@@ -39,8 +43,8 @@ public:
 
 	// CSynthBase
 	virtual bool Initialize() override;
-	virtual void HandleMIDIShortMessage(u32 nMessage) override;
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) override;
+	virtual void HandleMIDIShortMessage(u32 nMessage, u32 nTimestamp) override;
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) override;
 	virtual bool IsActive() override;
 	virtual void AllSoundOff() override;
 	virtual void SetMasterVolume(u8 nVolume) override;
@@ -49,13 +53,96 @@ public:
 	virtual void ReportStatus() const override;
 	virtual void UpdateLCD(CLCD& LCD, unsigned int nTicks) override;
 
+	// Load governor
+	u32 GetShedVoiceCount() const { return m_nShedVoices.load(std::memory_order_relaxed); }
+	int GetPolyphonyLimit() const { return m_nPolyphonyLimit.load(std::memory_order_relaxed); }
+
+	// Voices playing at the end of the last rendered block
+	int GetActiveVoiceCount() const { return m_nActiveVoices.load(std::memory_order_relaxed); }
+
+	// Returns true if the SoundFont was already loaded and is being swapped in; otherwise it's loaded in the background
 	bool SwitchSoundFont(size_t nIndex);
 	size_t GetSoundFontIndex() const { return m_nCurrentSoundFontIndex; }
 	CSoundFontManager& GetSoundFontManager() { return m_SoundFontManager; }
+	bool RescanSoundFonts();
+
+	// Main task only; returns true when a SoundFont loaded in the background or foreground is being swapped in
+	bool Update();
 
 private:
-	bool Reinitialize(const char* pSoundFontPath, const TFXProfile* pFXProfile);
+	// Maximum number of frames rendered by the secondary synth per job in parallel mode
+	static constexpr size_t ParallelRenderFrames = 512;
+
+	// Load governor thresholds (percentage of the block's duration spent rendering)
+	static constexpr u32 GovernorHighLoadPercent = 85;
+	static constexpr u32 GovernorLowLoadPercent = 60;
+	static constexpr u32 GovernorRestoreMillis = 2000;
+
+	// SoundFonts kept loaded either side of the current one
+	static constexpr size_t PreloadSlotCount = 2;
+	static constexpr unsigned int MaxCrossfadeMillis = 1000;
+	static constexpr unsigned int UnloadTimeoutMillis = 500;
+	static constexpr unsigned int SwapTimeoutMillis = 100;
+
+	struct TPreloadedSoundFont
+	{
+		size_t nIndex;
+		TSoundFont SoundFont;
+	};
+
+	// Prepared by the main task, applied by the render core when it reaches the command in the MIDI event queue, then
+	// finished by the main task; the main task applies it itself if the synth isn't being rendered
+	enum class TSwapState
+	{
+		None,
+		Prepared,
+		Queued,
+		Applied,
+	};
+
+	struct TSoundFontSwap
+	{
+		size_t nIndex;
+		size_t nOldIndex;
+		TSoundFont SoundFont;
+		TSoundFont OldSoundFont;
+		TFXProfile FXProfile;
+		float nInitialGain;
+		int nPolyphony;
+	};
+
+	bool SwitchSoundFontNow(size_t nIndex);
+	bool LoadSoundFontNow(size_t nIndex);
+	void ActivateSoundFont(size_t nIndex, const TSoundFont& SoundFont);
+	void UnloadSoundFont();
+	void PrepareSwap(size_t nIndex, const TSoundFont& SoundFont);
+	void QueueSwap();
+	void SwapSoundFont();
+	void FinishSwap();
+	bool IsSwitchInProgress() const { return m_SwapState.load(std::memory_order_relaxed) != TSwapState::None || m_bForegroundLoadPending; }
+	void RetireSoundFont(size_t nIndex, const TSoundFont& SoundFont);
+	bool IsNeighbor(size_t nIndex, size_t nCenterIndex) const;
+	void PreloadNeighbors();
+	bool AddPreloaded(size_t nIndex, const TSoundFont& SoundFont);
+	bool TakePreloaded(size_t nIndex, TSoundFont& SoundFont);
+	void FreePreloaded(bool bKeepNeighbors, size_t nCenterIndex = 0);
+	bool CreateSynths();
+	void ResetForSwitch(fluid_synth_t* pSynth);
+	void ApplySettings(fluid_synth_t* pSynth, const TFXProfile* pFXProfile, int nPolyphony, float nInitialGain);
+	void DeleteSynths();
+	void BeginRender();
+	void EndRender(size_t nFrames);
+	size_t ProcessMIDIEvents(size_t nFrame, size_t nFrames, bool& bHoldPresetEvents);
+	void ProcessShortMessage(u32 nMessage);
+	void RenderFrames(float* pOutBuffer, size_t nFrames);
+	void RenderFrames(s16* pOutBuffer, size_t nFrames);
+	void UpdateLoadGovernor(u32 nRenderTime, size_t nFrames);
+	size_t ShedReleasedVoices(fluid_synth_t* pSynth, size_t nMaxVoices);
+	void SetPolyphonyLimit(int nPolyphony);
+	fluid_synth_t* GetNoteOnSynth(u8 nChannel);
 	void ResetMIDIMonitor();
+	void PrepareProgramChange(u32 nMessage);
+	void PinProgram(u8 nChannel, int nBank, int nProgram);
 #ifndef NDEBUG
 	void DumpFXSettings() const;
 #endif
@@ -63,18 +150,80 @@ private:
 	bool ParseRolandSysEx(const u8* pData, size_t nSize);
 	bool ParseYamahaSysEx(const u8* pData, size_t nSize);
 
+	// Created once and kept across SoundFont switches; only the SoundFont is replaced
+	// m_SoundFont is the main task's view, i.e. what the synth will have once any queued swap is applied
 	fluid_settings_t* m_pSettings;
 	fluid_synth_t* m_pSynth;
+	TSoundFont m_SoundFont;
+
+	// Parallel rendering; a second synth with its own instance of the SoundFont renders half of the voices on a helper core
+	fluid_synth_t* m_pSecondarySynth;
+	size_t m_nSecondaryFrames;
+	float m_SecondaryBuffer[ParallelRenderFrames * 2];
+
+	// Updated by the render core for IsActive()
+	std::atomic<int> m_nActiveVoices;
+
+	// Load governor
+	bool m_bLoadGovernor;
+	u32 m_nRenderStartTime;
+	u32 m_nLowLoadStartTime;
+	std::atomic<u32> m_nShedVoices;
+	std::atomic<int> m_nPolyphonyLimit;
+	int m_nMaxPolyphony;
+
+	// Large enough for every voice of either synth
+	fluid_voice_t** m_pVoiceList;
+	size_t m_nVoiceListSize;
 
 	u8 m_nVolume;
 	float m_nInitialGain;
 
-	u16 m_nPercussionMask;
+	// Written by the main task's SysEx parsing, read on the render core to choose a synth for each note
+	std::atomic<u16> m_nPercussionMask;
 	size_t m_nCurrentSoundFontIndex;
 
 	CSoundFontManager m_SoundFontManager;
 
+	// Loading samples on demand; the main task tracks bank selects so that it knows which preset a program change selects
+	// Samples are pinned and unpinned with the synth's lock held, as voices ending on the render core can unload them
+	CPresetCache* m_pPresetCache;
+	u8 m_BankMSB[16];
+
+	// Program changes received while a swap is in progress; their presets are pinned once the new SoundFont is in the synth
+	u16 m_nRepinChannelMask;
+	u8 m_RepinBanks[16];
+	u8 m_RepinPrograms[16];
+
+	// Background loading; switches take effect between two renders
+	CSoundFontLoader* m_pLoader;
+	bool m_bSwitchPending;
+	size_t m_nPendingSoundFontIndex;
+	bool m_bPreloadNeighbors;
+	bool m_bPreloadFailed;
+	TPreloadedSoundFont m_Preloaded[PreloadSlotCount];
+
+	// SoundFont swaps; events after a swap are held by the render core until the main task has finished it
+	TSoundFontSwap m_Swap;
+	std::atomic<TSwapState> m_SwapState;
+	unsigned int m_nSwapPrepareTime;
+
+	// Foreground loads wait for the render core to let go of the current SoundFont's samples first
+	bool m_bForegroundLoadPending;
+	size_t m_nForegroundLoadIndex;
+	unsigned int m_nUnloadStartTime;
+
+	// Switch requested while another was in progress
+	bool m_bSwitchDeferred;
+	size_t m_nDeferredSoundFontIndex;
+
+	// Voices still playing the previous SoundFont are released over this time instead of being cut off
+	unsigned int m_nCrossfadeMillis;
+
 	static void FluidSynthLogCallback(int nLevel, const char* pMessage, void* pUser);
+	static void RenderSecondaryJob(void* pParam);
+	static void DispatchShortMessage(fluid_synth_t* pSynth, u8 nStatus, u8 nChannel, u8 nData1, u8 nData2);
+	static bool SelectsPresets(const TMIDIEvent& Event);
 };
 
 #endif
@@ -0,0 +1,73 @@
+//
+// splitsynth.h
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _splitsynth_h
+#define _splitsynth_h
+
+#include <circle/types.h>
+
+#include "synth/mt32synth.h"
+#include "synth/soundfontsynth.h"
+#include "synth/synthbase.h"
+
+// Plays a range of MIDI channels on the MT-32 synth and the remainder on the SoundFont synth, mixing both outputs
+class CSplitSynth : public CSynthBase
+{
+public:
+	CSplitSynth(unsigned nSampleRate, CMT32Synth* pMT32Synth, CSoundFontSynth* pSoundFontSynth);
+
+	// CSynthBase
+	virtual bool Initialize() override;
+	virtual void HandleMIDIShortMessage(u32 nMessage, u32 nTimestamp) override;
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) override;
+	virtual void HandleMIDISysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) override;
+	virtual bool IsActive() override;
+	virtual void AllSoundOff() override;
+	virtual void SetMasterVolume(u8 nVolume) override;
+	virtual size_t Render(s16* pOutBuffer, size_t nFrames) override;
+	virtual size_t Render(float* pOutBuffer, size_t nFrames) override;
+	virtual void ReportStatus() const override;
+	virtual void UpdateLCD(CLCD& LCD, unsigned int nTicks) override;
+
+private:
+	// Maximum number of frames rendered by the SoundFont synth per job
+	static constexpr size_t RenderFrames = 512;
+
+	bool IsMT32SysEx(const u8* pData, size_t nSize) const;
+
+	CMT32Synth* m_pMT32Synth;
+	CSoundFontSynth* m_pSoundFontSynth;
+
+	// Destination of the SysEx message currently being streamed
+	CSynthBase* m_pSysExFragmentSynth;
+
+	u16 m_nMT32ChannelMask;
+	float m_nMT32Gain;
+	float m_nSoundFontGain;
+
+	size_t m_nSoundFontFrames;
+	float m_SoundFontBuffer[RenderFrames * 2];
+
+	static void RenderSoundFontJob(void* pParam);
+};
+
+#endif
@@ -26,9 +26,12 @@
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+#include "audio/renderhelper.h"
 #include "lcd/lcd.h"
 #include "lcd/ui.h"
+#include "midieventqueue.h"
 #include "midimonitor.h"
+#include "midiparser.h"
 
 class CSynthBase
 {
@@ -36,15 +39,19 @@ public:
 	CSynthBase(unsigned int nSampleRate)
 		: m_Lock(TASK_LEVEL),
 		  m_nSampleRate(nSampleRate),
-		  m_pUI(nullptr)
+		  m_pUI(nullptr),
+		  m_pRenderHelper(nullptr)
 	{
 	}
 
 	virtual ~CSynthBase() = default;
 
 	virtual bool Initialize() = 0;
-	virtual void HandleMIDIShortMessage(u32 nMessage) { m_MIDIMonitor.OnShortMessage(nMessage); };
-	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize) = 0;
+	// nTimestamp is the time the message was received (CTimer clock ticks)
+	virtual void HandleMIDIShortMessage(u32 nMessage, u32 nTimestamp) { m_MIDIMonitor.OnShortMessage(nMessage); };
+	virtual void HandleMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp) = 0;
+	// Pieces of a SysEx message too large to be buffered whole; ignored unless the synth can make use of them
+	virtual void HandleMIDISysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp) {}
 	virtual bool IsActive() = 0;
 	virtual void AllSoundOff() { m_MIDIMonitor.AllNotesOff(); };
 	virtual void SetMasterVolume(u8 nVolume) = 0;
@@ -53,11 +60,14 @@ public:
 	virtual void ReportStatus() const = 0;
 	virtual void UpdateLCD(CLCD& LCD, unsigned int nTicks) = 0;
 	void SetUserInterface(CUserInterface* pUI) { m_pUI = pUI; }
+	void SetRenderHelper(CRenderHelper* pRenderHelper) { m_pRenderHelper = pRenderHelper; }
 
 	CSpinLock m_Lock;
 	unsigned int m_nSampleRate;
 	CMIDIMonitor m_MIDIMonitor;
+	CMIDIEventQueue m_MIDIEventQueue;
 	CUserInterface* m_pUI;
+	CRenderHelper* m_pRenderHelper;
 };
 
 #endif
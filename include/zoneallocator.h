@@ -23,6 +23,7 @@
 #ifndef _zoneallocator_h
 #define _zoneallocator_h
 
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
 // Block allocation tags
@@ -39,12 +40,13 @@ public:
 	CZoneAllocator();
 	~CZoneAllocator();
 
-	// Allocator interface
+	// Allocator interface; safe to call from any core, but not from interrupt handlers
 	bool Initialize();
 	void* Alloc(size_t nSize, TZoneTag Tag);
 	void* Realloc(void* pPtr, size_t nSize, TZoneTag Tag);
 	void Free(void* pPtr);
 	size_t GetAllocCount() const { return m_nAllocCount; }
+	size_t GetUsedSize() const { return m_nUsedSize; }
 
 	void FreeTag(u32 nTag);
 	void Clear();
@@ -70,6 +72,10 @@ private:
 	static constexpr u32 BlockMagic         = 0xDA1EDEAD;
 	static constexpr size_t MinFragmentSize = 16;
 
+	void* AllocBlock(size_t nSize, TZoneTag Tag);
+	void* ReallocBlock(void* pPtr, size_t nSize, TZoneTag Tag);
+	void FreeBlock(void* pPtr);
+
 	inline u32& GetEndMagic(TBlock* pBlock) const
 	{
 		return *reinterpret_cast<u32*>(reinterpret_cast<u8*>(pBlock) + pBlock->nSize - sizeof(BlockMagic));
@@ -81,6 +87,10 @@ private:
 	TBlock* m_pCurrentBlock;
 
 	size_t m_nAllocCount;
+	size_t m_nUsedSize;
+
+	// FluidSynth allocates on the main task and the render cores at the same time
+	CSpinLock m_Lock;
 
 	static CZoneAllocator* s_pThis;
 };
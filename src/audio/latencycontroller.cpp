@@ -0,0 +1,106 @@
+//
+// latencycontroller.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/timer.h>
+
+#include "audio/latencycontroller.h"
+#include "utility.h"
+
+constexpr u32 CLatencyController::ShrinkIntervalMillis;
+
+CLatencyController::CLatencyController(unsigned int nSampleRate, size_t nChunkFrames, size_t nMaxFrames)
+	: m_nSampleRate(nSampleRate),
+	  m_nChunkFrames(nChunkFrames),
+	  m_nMaxFrames(Utility::Max(nChunkFrames, nMaxFrames)),
+
+	  m_nLastAdjustTime(CTimer::GetClockTicks()),
+	  m_nWindowMaxRenderTime(0),
+
+	  m_nTargetFrames(nChunkFrames),
+	  m_nMinRenderTime(UINT32_MAX),
+	  m_nAverageRenderTime(0),
+	  m_nMaxRenderTime(0),
+	  m_nXRuns(0)
+{
+}
+
+void CLatencyController::RecordBlock(u32 nRenderTime, size_t nHeadroomFrames)
+{
+	RecordRenderTime(nRenderTime);
+
+	const u32 nTicks = CTimer::GetClockTicks();
+	const size_t nTargetFrames = m_nTargetFrames.load(std::memory_order_relaxed);
+
+	// Missed the deadline if rendering took longer than the audio that was queued plus the chunk being played out
+	if (nRenderTime > FramesToMicroseconds(nHeadroomFrames + m_nChunkFrames))
+	{
+		RecordXRun();
+
+		if (nTargetFrames < m_nMaxFrames)
+			m_nTargetFrames.store(Utility::Min(nTargetFrames + m_nChunkFrames, m_nMaxFrames), std::memory_order_relaxed);
+
+		m_nLastAdjustTime = nTicks;
+		m_nWindowMaxRenderTime = 0;
+		return;
+	}
+
+	m_nWindowMaxRenderTime = Utility::Max(m_nWindowMaxRenderTime, nRenderTime);
+
+	if (nTicks - m_nLastAdjustTime < Utility::MillisToTicks(ShrinkIntervalMillis))
+		return;
+
+	// Shrink if the slowest block in the last interval would have fit comfortably within the smaller target
+	if (nTargetFrames > m_nChunkFrames && m_nWindowMaxRenderTime < FramesToMicroseconds(nTargetFrames - m_nChunkFrames) * 3 / 4)
+		m_nTargetFrames.store(nTargetFrames - m_nChunkFrames, std::memory_order_relaxed);
+
+	m_nLastAdjustTime = nTicks;
+	m_nWindowMaxRenderTime = 0;
+}
+
+void CLatencyController::RecordRenderTime(u32 nRenderTime)
+{
+	// Only one core records render times, so no read-modify-write atomics are needed
+	if (nRenderTime < m_nMinRenderTime.load(std::memory_order_relaxed))
+		m_nMinRenderTime.store(nRenderTime, std::memory_order_relaxed);
+	if (nRenderTime > m_nMaxRenderTime.load(std::memory_order_relaxed))
+		m_nMaxRenderTime.store(nRenderTime, std::memory_order_relaxed);
+
+	// Exponential moving average
+	const u32 nAverage = m_nAverageRenderTime.load(std::memory_order_relaxed);
+	m_nAverageRenderTime.store(nAverage - nAverage / 16 + nRenderTime / 16, std::memory_order_relaxed);
+}
+
+void CLatencyController::RecordXRun()
+{
+	m_nXRuns.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CLatencyController::GetStatistics(TStatistics& OutStatistics) const
+{
+	const u32 nMinRenderTime = m_nMinRenderTime.load(std::memory_order_relaxed);
+
+	OutStatistics.nMinRenderTime     = nMinRenderTime == UINT32_MAX ? 0 : nMinRenderTime;
+	OutStatistics.nAverageRenderTime = m_nAverageRenderTime.load(std::memory_order_relaxed);
+	OutStatistics.nMaxRenderTime     = m_nMaxRenderTime.load(std::memory_order_relaxed);
+	OutStatistics.nXRuns             = m_nXRuns.load(std::memory_order_relaxed);
+	OutStatistics.nTargetFrames      = m_nTargetFrames.load(std::memory_order_relaxed);
+}
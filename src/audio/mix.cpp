@@ -0,0 +1,53 @@
+//
+// mix.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "audio/mix.h"
+
+void Audio::Mix(float* pOut, float nOutGain, const float* pIn, float nInGain, size_t nSamples)
+{
+	size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	// Eight samples per iteration
+	for (; i + 8 <= nSamples; i += 8)
+	{
+		float32x4_t OutA = vld1q_f32(pOut + i);
+		float32x4_t OutB = vld1q_f32(pOut + i + 4);
+		const float32x4_t InA = vld1q_f32(pIn + i);
+		const float32x4_t InB = vld1q_f32(pIn + i + 4);
+
+		OutA = vmlaq_n_f32(vmulq_n_f32(OutA, nOutGain), InA, nInGain);
+		OutB = vmlaq_n_f32(vmulq_n_f32(OutB, nOutGain), InB, nInGain);
+
+		vst1q_f32(pOut + i, OutA);
+		vst1q_f32(pOut + i + 4, OutB);
+	}
+#endif
+
+	// Handle any leftover samples
+	for (; i < nSamples; ++i)
+		pOut[i] = pOut[i] * nOutGain + pIn[i] * nInGain;
+}
@@ -0,0 +1,76 @@
+//
+// renderaheadqueue.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "audio/renderaheadqueue.h"
+#include "utility.h"
+
+constexpr u8 nChannels = 2;
+
+CRenderAheadQueue::CRenderAheadQueue(size_t nBlocks, size_t nBlockFrames)
+	: m_nBlocks(Utility::Clamp(nBlocks, static_cast<size_t>(MinBlocks), static_cast<size_t>(MaxBlocks))),
+	  m_nBlockFrames(nBlockFrames),
+	  m_pBuffer(new float[m_nBlocks * nBlockFrames * nChannels]),
+
+	  m_nWriteCount(0),
+	  m_Padding{},
+	  m_nReadCount(0)
+{
+}
+
+CRenderAheadQueue::~CRenderAheadQueue()
+{
+	delete[] m_pBuffer;
+}
+
+float* CRenderAheadQueue::GetWriteBlock()
+{
+	const size_t nWriteCount = m_nWriteCount.load(std::memory_order_relaxed);
+	const size_t nReadCount = m_nReadCount.load(std::memory_order_acquire);
+
+	if (nWriteCount - nReadCount == m_nBlocks)
+		return nullptr;
+
+	return m_pBuffer + (nWriteCount % m_nBlocks) * m_nBlockFrames * nChannels;
+}
+
+void CRenderAheadQueue::CommitWriteBlock()
+{
+	// Publish the rendered samples before the block becomes visible to the consumer
+	m_nWriteCount.fetch_add(1, std::memory_order_release);
+}
+
+const float* CRenderAheadQueue::GetReadBlock()
+{
+	const size_t nReadCount = m_nReadCount.load(std::memory_order_relaxed);
+	const size_t nWriteCount = m_nWriteCount.load(std::memory_order_acquire);
+
+	if (nWriteCount == nReadCount)
+		return nullptr;
+
+	return m_pBuffer + (nReadCount % m_nBlocks) * m_nBlockFrames * nChannels;
+}
+
+void CRenderAheadQueue::ReleaseReadBlock()
+{
+	// Don't let the producer overwrite the block until we've finished reading it
+	m_nReadCount.fetch_add(1, std::memory_order_release);
+}
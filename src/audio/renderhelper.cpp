@@ -0,0 +1,77 @@
+//
+// renderhelper.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "audio/renderhelper.h"
+
+CRenderHelper::CRenderHelper()
+	: m_pJob(nullptr),
+	  m_pParam(nullptr),
+	  m_State(Idle)
+{
+}
+
+bool CRenderHelper::Submit(TJobFunction pJob, void* pParam)
+{
+	// Jobs can only be submitted by the render core, so the slot can't become busy after this check
+	if (m_State.load(std::memory_order_acquire) != Idle)
+		return false;
+
+	m_pJob = pJob;
+	m_pParam = pParam;
+
+	// Publish job parameters before the helper can see the job
+	m_State.store(Pending, std::memory_order_release);
+
+	return true;
+}
+
+void CRenderHelper::Wait()
+{
+	u32 nExpected = Pending;
+
+	// Helper hasn't started yet; run the job ourselves
+	if (m_State.compare_exchange_strong(nExpected, Running, std::memory_order_acquire))
+	{
+		m_pJob(m_pParam);
+		m_State.store(Idle, std::memory_order_relaxed);
+		return;
+	}
+
+	// Helper is running the job; wait for it to finish and for its results to become visible
+	while (m_State.load(std::memory_order_acquire) != Idle)
+		;
+}
+
+bool CRenderHelper::Poll()
+{
+	u32 nExpected = Pending;
+
+	if (!m_State.compare_exchange_strong(nExpected, Running, std::memory_order_acquire))
+		return false;
+
+	m_pJob(m_pParam);
+
+	// Publish results
+	m_State.store(Idle, std::memory_order_release);
+
+	return true;
+}
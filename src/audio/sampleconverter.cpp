@@ -0,0 +1,188 @@
+//
+// sampleconverter.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "audio/sampleconverter.h"
+#include "utility.h"
+
+constexpr float Sample24BitMax = (1 << 23) - 1;
+constexpr float Sample24BitMin = -(1 << 23);
+
+// Scales the top 24 bits of a random word to [0, 1)
+constexpr float DitherScale = 1.0f / (1 << 24);
+
+CSampleConverter::CSampleConverter(TFormat Format, bool bReversedStereo, bool bDither)
+	: m_Format(Format),
+	  m_bReversedStereo(bReversedStereo),
+	  m_bDither(bDither),
+
+	  // Arbitrary non-zero seeds
+	  m_DitherState{0x12345678, 0x9ABCDEF1, 0x2468ACE0, 0x13579BDF}
+{
+}
+
+void CSampleConverter::Convert(const float* pInBuffer, void* pOutBuffer, size_t nFrames)
+{
+	u8* pOut = static_cast<u8*>(pOutBuffer);
+	size_t nConverted = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	nConverted = ConvertNEON(pInBuffer, pOut, nFrames);
+#endif
+
+	// Handle any leftover frames
+	if (nConverted < nFrames)
+		ConvertScalar(pInBuffer + nConverted * 2, pOut + nConverted * GetBytesPerFrame(), nFrames - nConverted);
+}
+
+float CSampleConverter::NextDither()
+{
+	u32& nState = m_DitherState[0];
+
+	// Triangular PDF dither (difference of two uniform random values) in the range [-1, 1) LSB
+	nState ^= nState << 13;
+	nState ^= nState >> 17;
+	nState ^= nState << 5;
+	const float nRandomA = (nState >> 8) * DitherScale;
+
+	nState ^= nState << 13;
+	nState ^= nState >> 17;
+	nState ^= nState << 5;
+	const float nRandomB = (nState >> 8) * DitherScale;
+
+	return nRandomA - nRandomB;
+}
+
+size_t CSampleConverter::ConvertScalar(const float* pInBuffer, u8* pOutBuffer, size_t nFrames)
+{
+	const size_t nBytesPerSample = GetBytesPerSample();
+	const size_t nLeft = m_bReversedStereo ? 1 : 0;
+	const size_t nRight = m_bReversedStereo ? 0 : 1;
+
+	for (size_t i = 0; i < nFrames; ++i)
+	{
+		const float Frame[2] = { pInBuffer[i * 2 + nLeft], pInBuffer[i * 2 + nRight] };
+
+		for (float nSample : Frame)
+		{
+			nSample = Utility::Clamp(nSample, -1.0f, 1.0f) * Sample24BitMax;
+			if (m_bDither)
+				nSample = Utility::Clamp(nSample + NextDither(), Sample24BitMin, Sample24BitMax);
+
+			const s32 nIntSample = static_cast<s32>(nSample);
+
+			// Little-endian; the sound device ignores the top byte for 24-in-32-bit samples
+			pOutBuffer[0] = nIntSample & 0xFF;
+			pOutBuffer[1] = (nIntSample >> 8) & 0xFF;
+			pOutBuffer[2] = (nIntSample >> 16) & 0xFF;
+			if (nBytesPerSample == sizeof(s32))
+				pOutBuffer[3] = (nIntSample >> 24) & 0xFF;
+
+			pOutBuffer += nBytesPerSample;
+		}
+	}
+
+	return nFrames;
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+size_t CSampleConverter::ConvertNEON(const float* pInBuffer, u8* pOutBuffer, size_t nFrames)
+{
+	// Two stereo frames (four samples) per iteration
+	const size_t nVectorFrames = nFrames & ~static_cast<size_t>(1);
+
+	const float32x4_t Min = vdupq_n_f32(Sample24BitMin);
+	const float32x4_t Max = vdupq_n_f32(Sample24BitMax);
+	const float32x4_t One = vdupq_n_f32(1.0f);
+	const float32x4_t MinusOne = vdupq_n_f32(-1.0f);
+
+	uint32x4_t DitherState = vld1q_u32(m_DitherState);
+
+#ifdef __aarch64__
+	// Byte shuffle that drops the top byte of each 32-bit sample; out-of-range indices produce 0
+	static const u8 PackIndices[16] = { 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 0xFF, 0xFF, 0xFF, 0xFF };
+	const uint8x16_t PackTable = vld1q_u8(PackIndices);
+#else
+	static const u8 PackIndicesLow[8] = { 0, 1, 2, 4, 5, 6, 8, 9 };
+	static const u8 PackIndicesHigh[8] = { 10, 12, 13, 14, 0xFF, 0xFF, 0xFF, 0xFF };
+	const uint8x8_t PackTableLow = vld1_u8(PackIndicesLow);
+	const uint8x8_t PackTableHigh = vld1_u8(PackIndicesHigh);
+#endif
+
+	for (size_t i = 0; i < nVectorFrames; i += 2)
+	{
+		float32x4_t Samples = vld1q_f32(pInBuffer + i * 2);
+
+		// LRLR -> RLRL
+		if (m_bReversedStereo)
+			Samples = vrev64q_f32(Samples);
+
+		Samples = vmaxq_f32(vminq_f32(Samples, One), MinusOne);
+		Samples = vmulq_n_f32(Samples, Sample24BitMax);
+
+		if (m_bDither)
+		{
+			DitherState = veorq_u32(DitherState, vshlq_n_u32(DitherState, 13));
+			DitherState = veorq_u32(DitherState, vshrq_n_u32(DitherState, 17));
+			DitherState = veorq_u32(DitherState, vshlq_n_u32(DitherState, 5));
+			const float32x4_t RandomA = vcvtq_f32_u32(vshrq_n_u32(DitherState, 8));
+
+			DitherState = veorq_u32(DitherState, vshlq_n_u32(DitherState, 13));
+			DitherState = veorq_u32(DitherState, vshrq_n_u32(DitherState, 17));
+			DitherState = veorq_u32(DitherState, vshlq_n_u32(DitherState, 5));
+			const float32x4_t RandomB = vcvtq_f32_u32(vshrq_n_u32(DitherState, 8));
+
+			Samples = vmlaq_n_f32(Samples, vsubq_f32(RandomA, RandomB), DitherScale);
+			Samples = vmaxq_f32(vminq_f32(Samples, Max), Min);
+		}
+
+		const int32x4_t IntSamples = vcvtq_s32_f32(Samples);
+
+		if (m_Format == TFormat::Signed24_32)
+		{
+			vst1q_s32(reinterpret_cast<s32*>(pOutBuffer), IntSamples);
+			pOutBuffer += 4 * sizeof(s32);
+		}
+		else
+		{
+			const uint8x16_t Bytes = vreinterpretq_u8_s32(IntSamples);
+
+			// 16 bytes are stored, of which 12 are valid; the next iteration overwrites the rest
+#ifdef __aarch64__
+			vst1q_u8(pOutBuffer, vqtbl1q_u8(Bytes, PackTable));
+#else
+			const uint8x8x2_t Table = { { vget_low_u8(Bytes), vget_high_u8(Bytes) } };
+			vst1_u8(pOutBuffer, vtbl2_u8(Table, PackTableLow));
+			vst1_u8(pOutBuffer + 8, vtbl2_u8(Table, PackTableHigh));
+#endif
+			pOutBuffer += 4 * 3;
+		}
+	}
+
+	vst1q_u32(m_DitherState, DitherState);
+
+	return nVectorFrames;
+}
+#endif
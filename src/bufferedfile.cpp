@@ -0,0 +1,156 @@
+//
+// bufferedfile.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/util.h>
+
+#include "bufferedfile.h"
+#include "utility.h"
+
+constexpr size_t CBufferedFile::DirectReadSize;
+
+CBufferedFile::CBufferedFile()
+	: m_File{},
+	  m_bOpen(false),
+
+	  m_nPosition(0),
+	  m_nFilePosition(0),
+
+	  m_pBufferMemory(nullptr),
+	  m_pBuffer(nullptr),
+	  m_nBufferStart(0),
+	  m_nBufferSize(0)
+{
+}
+
+CBufferedFile::~CBufferedFile()
+{
+	Close();
+}
+
+bool CBufferedFile::Open(const char* pPath)
+{
+	if (m_bOpen || f_open(&m_File, pPath, FA_READ) != FR_OK)
+		return false;
+
+	// Align the window to a cache line so that the storage driver can transfer into it directly
+	m_pBufferMemory = new u8[ReadAheadSize + CacheLineSize];
+	m_pBuffer = reinterpret_cast<u8*>((reinterpret_cast<uintptr>(m_pBufferMemory) + CacheLineSize - 1) & ~static_cast<uintptr>(CacheLineSize - 1));
+
+	m_bOpen = true;
+	m_nPosition = 0;
+	m_nFilePosition = 0;
+	m_nBufferStart = 0;
+	m_nBufferSize = 0;
+
+	return true;
+}
+
+bool CBufferedFile::Close()
+{
+	if (!m_bOpen)
+		return false;
+
+	delete[] m_pBufferMemory;
+	m_pBufferMemory = nullptr;
+	m_pBuffer = nullptr;
+	m_bOpen = false;
+
+	return f_close(&m_File) == FR_OK;
+}
+
+bool CBufferedFile::Read(void* pBuffer, size_t nCount)
+{
+	u8* pOut = static_cast<u8*>(pBuffer);
+
+	while (nCount)
+	{
+		// Copy whatever the window already holds
+		if (m_nPosition >= m_nBufferStart && m_nPosition < m_nBufferStart + m_nBufferSize)
+		{
+			const size_t nOffset = m_nPosition - m_nBufferStart;
+			const size_t nSize = Utility::Min(nCount, m_nBufferSize - nOffset);
+
+			memcpy(pOut, m_pBuffer + nOffset, nSize);
+			pOut += nSize;
+			nCount -= nSize;
+			m_nPosition += nSize;
+			continue;
+		}
+
+		// Bulk data (e.g. samples); FatFs transfers whole sectors straight into the destination
+		if (nCount >= DirectReadSize)
+		{
+			UINT nRead;
+			if (!SeekFile(m_nPosition) || f_read(&m_File, pOut, nCount, &nRead) != FR_OK)
+				return false;
+
+			m_nFilePosition += nRead;
+			m_nPosition += nRead;
+			return nRead == nCount;
+		}
+
+		if (!Fill())
+			return false;
+	}
+
+	return true;
+}
+
+bool CBufferedFile::Seek(u64 nOffset)
+{
+	if (nOffset > GetSize())
+		return false;
+
+	// The underlying file is only repositioned on the next read that misses the window
+	m_nPosition = nOffset;
+	return true;
+}
+
+bool CBufferedFile::Fill()
+{
+	// Start on a sector boundary so that FatFs reads whole sectors into the window rather than through its own buffer
+	const u64 nStart = m_nPosition & ~static_cast<u64>(SectorSize - 1);
+	UINT nRead;
+
+	m_nBufferSize = 0;
+	if (!SeekFile(nStart) || f_read(&m_File, m_pBuffer, ReadAheadSize, &nRead) != FR_OK)
+		return false;
+
+	m_nFilePosition += nRead;
+	m_nBufferStart = nStart;
+	m_nBufferSize = nRead;
+
+	// Nothing left to read
+	return m_nPosition < m_nBufferStart + m_nBufferSize;
+}
+
+bool CBufferedFile::SeekFile(u64 nOffset)
+{
+	if (nOffset == m_nFilePosition)
+		return true;
+
+	if (f_lseek(&m_File, nOffset) != FR_OK)
+		return false;
+
+	m_nFilePosition = nOffset;
+	return true;
+}
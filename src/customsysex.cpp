@@ -0,0 +1,65 @@
+//
+// customsysex.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "customsysex.h"
+
+constexpr u8 EducationalManufacturerID = 0x7D;
+
+bool ParseCustomSysEx(const u8* pData, size_t nSize, TCustomSysExCommand& Command, u8& nParameter)
+{
+	// Reboot (F0 7D 00 F7) has no parameter; every other command has one (F0 7D cc xx F7)
+	if (nSize != 4 && nSize != 5)
+		return false;
+
+	if (pData[0] != 0xF0 || pData[1] != EducationalManufacturerID || pData[nSize - 1] != 0xF7)
+		return false;
+
+	// Data bytes only
+	for (size_t i = 2; i < nSize - 1; ++i)
+	{
+		if (pData[i] & 0x80)
+			return false;
+	}
+
+	Command = static_cast<TCustomSysExCommand>(pData[2]);
+
+	if (nSize == 4)
+	{
+		nParameter = 0;
+		return Command == TCustomSysExCommand::Reboot;
+	}
+
+	nParameter = pData[3];
+	switch (Command)
+	{
+		case TCustomSysExCommand::SwitchMT32ROMSet:
+		case TCustomSysExCommand::SwitchSoundFont:
+		case TCustomSysExCommand::SwitchSynth:
+		case TCustomSysExCommand::SetMT32ReversedStereo:
+		case TCustomSysExCommand::SetMIDIRecording:
+			return true;
+
+		default:
+			return false;
+	}
+}
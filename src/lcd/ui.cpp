@@ -34,6 +34,10 @@ constexpr u32 ScrollRateMillis = 175;
 constexpr u8 BarSpacingPixels = 2;
 constexpr u8 SpinnerChars[] = {'_', '_', '_', '-', '\'', '\'', '^', '^', '`', '`', '-', '_', '_', '_'};
 
+constexpr unsigned CUserInterface::SystemMessageDisplayTimeMillis;
+constexpr unsigned CUserInterface::SystemMessageSpinnerTimeMillis;
+constexpr unsigned CUserInterface::SC55DisplayTimeMillis;
+
 CUserInterface::CUserInterface()
 	: m_State(TState::None),
 	  m_nStateTime(0),
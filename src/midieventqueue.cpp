@@ -0,0 +1,284 @@
+//
+// midieventqueue.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+
+#include "midieventqueue.h"
+#include "utility.h"
+
+LOGMODULE("midieventqueue");
+
+constexpr unsigned int CMIDIEventQueue::OverflowWarningMillis;
+
+CMIDIEventQueue::CMIDIEventQueue()
+	: m_SysExBuffer{},
+
+	  m_nUnreportedOverflows(0),
+	  m_nLastOverflowWarningTime(0),
+
+	  m_nSampleRate(0),
+	  m_nBlockStartTime(0),
+	  m_nPrevBlockStartTime(0),
+
+	  m_bCoalescing(false),
+	  m_nBlockEventIndex(0),
+	  m_nBlockEventCount(0),
+	  m_SupersededEvents{},
+
+	  m_nEvents(0),
+	  m_nOverflows(0),
+	  m_nAverageLatency(0),
+	  m_nMaxLatency(0),
+	  m_nMaxLockWait(0),
+	  m_nCoalesced(0),
+	  m_nTotalLatency(0)
+{
+}
+
+bool CMIDIEventQueue::EnqueueShortMessage(u32 nMessage, u32 nTimestamp)
+{
+	return Enqueue(TMIDIEvent::TType::ShortMessage, nMessage, nTimestamp);
+}
+
+bool CMIDIEventQueue::EnqueueSysEx(const u8* pData, size_t nSize, u32 nTimestamp)
+{
+	// Only the producer can reduce free space, so if both fit now, they'll still fit after enqueueing the data
+	if (nSize > MaxSysExSize || m_SysExData.GetFreeSpace() < nSize || m_Events.GetFreeSpace() < 1)
+	{
+		ReportOverflow();
+		return false;
+	}
+
+	m_SysExData.Enqueue(pData, nSize);
+	return Enqueue(TMIDIEvent::TType::SysEx, nSize, nTimestamp);
+}
+
+bool CMIDIEventQueue::EnqueueCommand(TMIDIEvent::TType Type, u32 nParameter)
+{
+	return Enqueue(Type, nParameter, CTimer::GetClockTicks());
+}
+
+bool CMIDIEventQueue::Enqueue(TMIDIEvent::TType Type, u32 nData, u32 nTimestamp)
+{
+	const TMIDIEvent Event{Type, nTimestamp, nData, nullptr};
+
+	if (!m_Events.Enqueue(Event))
+	{
+		ReportOverflow();
+		return false;
+	}
+
+	return true;
+}
+
+void CMIDIEventQueue::ReportOverflow()
+{
+	m_nOverflows.fetch_add(1, std::memory_order_relaxed);
+	++m_nUnreportedOverflows;
+
+	// A lost note off leaves a note hanging, so this is always worth knowing about, but don't flood the log
+	const u32 nTicks = CTimer::GetClockTicks();
+	if (m_nLastOverflowWarningTime && nTicks - m_nLastOverflowWarningTime < Utility::MillisToTicks(OverflowWarningMillis))
+		return;
+
+	LOGWARN("MIDI event queue full; %d events dropped", m_nUnreportedOverflows);
+	m_nUnreportedOverflows = 0;
+	m_nLastOverflowWarningTime = nTicks;
+}
+
+bool CMIDIEventQueue::Dequeue(TMIDIEvent& OutEvent, u32 nTicks)
+{
+	if (!m_Events.Dequeue(OutEvent))
+		return false;
+
+	if (OutEvent.Type == TMIDIEvent::TType::SysEx)
+	{
+		m_SysExData.Dequeue(m_SysExBuffer, OutEvent.nData);
+		OutEvent.pSysExData = m_SysExBuffer;
+	}
+
+	// Only the consumer writes these, so no read-modify-write atomics are needed
+	const u32 nLatency = nTicks - OutEvent.nTimestamp;
+	const u32 nEvents = m_nEvents.load(std::memory_order_relaxed) + 1;
+	m_nTotalLatency += nLatency;
+
+	m_nEvents.store(nEvents, std::memory_order_relaxed);
+	m_nAverageLatency.store(m_nTotalLatency / nEvents, std::memory_order_relaxed);
+	if (nLatency > m_nMaxLatency.load(std::memory_order_relaxed))
+		m_nMaxLatency.store(nLatency, std::memory_order_relaxed);
+
+	++m_nBlockEventIndex;
+	DropSupersededEvents();
+
+	return true;
+}
+
+void CMIDIEventQueue::RecordLockWait(u32 nTicks)
+{
+	if (nTicks > m_nMaxLockWait.load(std::memory_order_relaxed))
+		m_nMaxLockWait.store(nTicks, std::memory_order_relaxed);
+}
+
+void CMIDIEventQueue::BeginBlock(unsigned int nSampleRate)
+{
+	m_nSampleRate         = nSampleRate;
+	m_nPrevBlockStartTime = m_nBlockStartTime;
+	m_nBlockStartTime     = CTimer::GetClockTicks();
+
+	if (m_bCoalescing)
+	{
+		FindSupersededEvents();
+		DropSupersededEvents();
+	}
+}
+
+size_t CMIDIEventQueue::GetNextEventFrame(size_t nFrames) const
+{
+	// Nothing can be played in an empty block
+	TMIDIEvent Event;
+	if (!nFrames || !m_Events.Peek(Event))
+		return nFrames;
+
+	// Received after this block started; leave it for the next block
+	const s32 nSinceBlockStart = static_cast<s32>(Event.nTimestamp - m_nBlockStartTime);
+	if (nSinceBlockStart > 0)
+		return nFrames;
+
+	// Received before the previous block started; play as soon as possible
+	const s32 nSincePrevBlockStart = static_cast<s32>(Event.nTimestamp - m_nPrevBlockStartTime);
+	if (nSincePrevBlockStart <= 0)
+		return 0;
+
+	const size_t nFrame = static_cast<u64>(nSincePrevBlockStart) * m_nSampleRate / CLOCKHZ;
+
+	// Everything received before this block started must be played during it
+	return Utility::Min(nFrame, nFrames - 1);
+}
+
+void CMIDIEventQueue::GetStatistics(TStatistics& OutStatistics) const
+{
+	OutStatistics.nEvents         = m_nEvents.load(std::memory_order_relaxed);
+	OutStatistics.nOverflows      = m_nOverflows.load(std::memory_order_relaxed);
+	OutStatistics.nAverageLatency = m_nAverageLatency.load(std::memory_order_relaxed);
+	OutStatistics.nMaxLatency     = m_nMaxLatency.load(std::memory_order_relaxed);
+	OutStatistics.nMaxLockWait    = m_nMaxLockWait.load(std::memory_order_relaxed);
+	OutStatistics.nCoalesced      = m_nCoalesced.load(std::memory_order_relaxed);
+}
+
+void CMIDIEventQueue::FindSupersededEvents()
+{
+	TMIDIEvent Event{};
+	size_t nCount = 0;
+
+	// Count the events due during this block
+	while (nCount < CoalesceWindow && m_Events.Peek(Event, nCount) && static_cast<s32>(Event.nTimestamp - m_nBlockStartTime) <= 0)
+		++nCount;
+
+	m_nBlockEventIndex = 0;
+	m_nBlockEventCount = nCount;
+	memset(m_SupersededEvents, 0, sizeof(m_SupersededEvents));
+
+	// Keys that have a later value in this block, with nothing in between that could depend on the current one
+	u32 Seen[16][(CoalesceKeyCount + 31) / 32] = {};
+
+	// Walk backwards, so the last value for each key is found first
+	for (size_t i = nCount; i-- > 0;)
+	{
+		m_Events.Peek(Event, i);
+
+		const bool bShortMessage = Event.Type == TMIDIEvent::TType::ShortMessage;
+		const u8 nStatus = Event.nData & 0xFF;
+		size_t nKey;
+
+		if (bShortMessage && GetCoalesceKey(Event.nData, nKey))
+		{
+			u32& nSeenWord = Seen[nStatus & 0x0F][nKey / 32];
+			const u32 nSeenBit = 1u << (nKey % 32);
+
+			if (nSeenWord & nSeenBit)
+				m_SupersededEvents[i / 32] |= 1u << (i % 32);
+			else
+				nSeenWord |= nSeenBit;
+		}
+
+		// Notes, program changes etc. may depend on their channel's controllers, so must see the values in effect
+		else if (bShortMessage && nStatus < 0xF0)
+			memset(Seen[nStatus & 0x0F], 0, sizeof(Seen[0]));
+
+		// System Real-Time messages (except System Reset) don't affect any channel; anything else might affect all
+		else if (!(bShortMessage && nStatus >= 0xF8 && nStatus != 0xFF))
+			memset(Seen, 0, sizeof(Seen));
+	}
+}
+
+void CMIDIEventQueue::DropSupersededEvents()
+{
+	TMIDIEvent Event;
+
+	while (m_nBlockEventIndex < m_nBlockEventCount && (m_SupersededEvents[m_nBlockEventIndex / 32] & (1u << (m_nBlockEventIndex % 32))))
+	{
+		// Superseded events are always short messages, so have no SysEx data
+		m_Events.Dequeue(Event);
+		++m_nBlockEventIndex;
+		m_nCoalesced.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+bool CMIDIEventQueue::GetCoalesceKey(u32 nMessage, size_t& nOutKey)
+{
+	const u8 nStatus = nMessage & 0xF0;
+	const u8 nData1 = (nMessage >> 8) & 0x7F;
+
+	switch (nStatus)
+	{
+		// Control Change
+		case 0xB0:
+		{
+			// Bank Select, Data Entry, pedals/switches, Data Increment/Decrement, NRPN/RPN and Channel Mode
+			// messages are order-sensitive or act on other state; never drop them
+			const bool bOrderSensitive = nData1 == 0x00 || nData1 == 0x06 || nData1 == 0x20 || nData1 == 0x26 ||
+						     (nData1 >= 0x40 && nData1 <= 0x45) ||
+						     (nData1 >= 0x60 && nData1 <= 0x65) ||
+						     nData1 >= 0x78;
+			if (bOrderSensitive)
+				return false;
+
+			nOutKey = nData1;
+			return true;
+		}
+
+		// Pitch Bend
+		case 0xE0:
+			nOutKey = 128;
+			return true;
+
+		// Channel Pressure
+		case 0xD0:
+			nOutKey = 129;
+			return true;
+
+		default:
+			return false;
+	}
+}
@@ -25,7 +25,11 @@
 #include "midimonitor.h"
 
 CMIDIMonitor::CMIDIMonitor()
-	: m_PeakLevels{0.0f},
+	: m_WriteLock(TASK_LEVEL),
+	  m_nSequence(0),
+	  m_nLastPruneTime(0),
+	  m_nPercussionBitMask(1 << 9),
+	  m_PeakLevels{0.0f},
 	  m_PeakTimes{0}
 {
 	for (auto& Channel : m_State)
@@ -38,6 +42,9 @@ CMIDIMonitor::CMIDIMonitor()
 			Note.nVelocity = 0;
 			Note.bDamperFlag = false;
 		}
+
+		for (auto& nWord : Channel.ActiveNotes)
+			nWord = 0;
 	}
 
 	ResetControllers(false);
@@ -52,6 +59,9 @@ void CMIDIMonitor::OnShortMessage(u32 nMessage)
 
 	TChannelState& ChannelState = m_State[nChannel];
 	TNoteState& NoteState = ChannelState.Notes[nData1];
+
+	// Read the time with the lock held so that pruning never sees a note that started after it
+	BeginWrite();
 	const unsigned int nTicks = CTimer::GetClockTicks();
 
 	switch (nStatus)
@@ -62,6 +72,7 @@ void CMIDIMonitor::OnShortMessage(u32 nMessage)
 			{
 				NoteState.EnvelopePhase = TEnvelopePhase::NoteOff;
 				NoteState.nNoteOffTime = nTicks;
+				SetNoteActive(ChannelState, nData1);
 			}
 
 			break;
@@ -74,11 +85,13 @@ void CMIDIMonitor::OnShortMessage(u32 nMessage)
 				NoteState.nNoteOnTime = nTicks;
 				NoteState.nVelocity = nData2;
 				NoteState.bDamperFlag = ChannelState.nDamper;
+				SetNoteActive(ChannelState, nData1);
 			}
 			else if (!NoteState.bDamperFlag)
 			{
 				NoteState.EnvelopePhase = TEnvelopePhase::NoteOff;
 				NoteState.nNoteOffTime = nTicks;
+				SetNoteActive(ChannelState, nData1);
 			}
 			break;
 
@@ -88,30 +101,52 @@ void CMIDIMonitor::OnShortMessage(u32 nMessage)
 			break;
 
 		// System Reset
-		case 0xFF:
-			AllNotesOff();
-			ResetControllers(false);
+		case 0xF0:
+			if (nMessage == 0xFF)
+			{
+				ReleaseAllNotes(nTicks);
+				ResetControllerState(false);
+			}
+			break;
 
 		default:
 			break;
 	}
+
+	// The reader can't modify state, so finished notes are removed here
+	if (Utility::TicksToMillis(nTicks - m_nLastPruneTime) >= PruneIntervalMillis)
+		PruneAllNotes(nTicks);
+	else if (nStatus < 0xF0)
+		PruneNotes(ChannelState, m_nPercussionBitMask.load(std::memory_order_relaxed) & (1 << nChannel), nTicks);
+
+	EndWrite();
 }
 
 void CMIDIMonitor::GetChannelLevels(unsigned int nTicks, float* pOutLevels, float* pOutPeaks, u16 nPercussionBitMask)
 {
+	TChannelSnapshot Snapshot;
+
+	m_nPercussionBitMask.store(nPercussionBitMask, std::memory_order_relaxed);
+
 	for (size_t nChannel = 0; nChannel < ChannelCount; ++nChannel)
 	{
 		const bool bIsPercussionChannel = nPercussionBitMask & (1 << nChannel);
-		float nChannelVolume = 0.0f;
+		float nMaxNoteVolume = 0.0f;
 
-		for (size_t nNote = 0; nNote < NoteCount; ++nNote)
+		ReadChannel(nChannel, Snapshot);
+
+		// Read the time after taking the snapshot so that no note appears to start in the future
+		const unsigned int nNow = CTimer::GetClockTicks();
+
+		for (size_t i = 0; i < Snapshot.nNotes; ++i)
 		{
-			TNoteState& NoteState = m_State[nChannel].Notes[nNote];
-			const float nEnvelope = bIsPercussionChannel ? ComputePercussionEnvelope(NoteState) : ComputeEnvelope(NoteState);
-			const float nNoteVolume = nEnvelope * (NoteState.nVelocity / 127.0f) * (m_State[nChannel].nVolume / 127.0f) * (m_State[nChannel].nExpression / 127.0f);
-			nChannelVolume = Utility::Max(nChannelVolume, nNoteVolume);
+			const TNoteState& NoteState = Snapshot.Notes[i];
+			const float nEnvelope = bIsPercussionChannel ? ComputePercussionEnvelope(NoteState, nNow) : ComputeEnvelope(NoteState, nNow);
+			nMaxNoteVolume = Utility::Max(nMaxNoteVolume, nEnvelope * NoteState.nVelocity);
 		}
 
+		// Channel volume and expression are common to all notes, so apply them once
+		float nChannelVolume = nMaxNoteVolume / 127.0f * (Snapshot.nVolume / 127.0f) * (Snapshot.nExpression / 127.0f);
 		nChannelVolume = Utility::Clamp(nChannelVolume, 0.0f, 1.0f);
 
 		float nPeakLevel = m_PeakLevels[nChannel];
@@ -140,22 +175,19 @@ void CMIDIMonitor::AllNotesOff()
 {
 	const unsigned int nTicks = CTimer::GetClockTicks();
 
-	for (auto& Channel : m_State)
-	{
-		for (auto& Note : Channel.Notes)
-		{
-			if (Note.EnvelopePhase == TEnvelopePhase::NoteOn)
-			{
-				Note.EnvelopePhase = TEnvelopePhase::NoteOff;
-				Note.nNoteOffTime = nTicks;
-			}
-
-			Note.bDamperFlag = false;
-		}
-	}
+	BeginWrite();
+	ReleaseAllNotes(nTicks);
+	EndWrite();
 }
 
 void CMIDIMonitor::ResetControllers(bool bIsResetAllControllers)
+{
+	BeginWrite();
+	ResetControllerState(bIsResetAllControllers);
+	EndWrite();
+}
+
+void CMIDIMonitor::ResetControllerState(bool bIsResetAllControllers)
 {
 	for (auto& Channel : m_State)
 	{
@@ -172,6 +204,56 @@ void CMIDIMonitor::ResetControllers(bool bIsResetAllControllers)
 	}
 }
 
+void CMIDIMonitor::BeginWrite()
+{
+	m_WriteLock.Acquire();
+
+	// Mark the state as being modified before touching it
+	const u32 nSequence = m_nSequence.load(std::memory_order_relaxed);
+	m_nSequence.store(nSequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void CMIDIMonitor::EndWrite()
+{
+	const u32 nSequence = m_nSequence.load(std::memory_order_relaxed);
+	m_nSequence.store(nSequence + 1, std::memory_order_release);
+
+	m_WriteLock.Release();
+}
+
+void CMIDIMonitor::ReadChannel(u8 nChannel, TChannelSnapshot& OutSnapshot) const
+{
+	const TChannelState& ChannelState = m_State[nChannel];
+	u32 nSequence;
+
+	// Retry until no write happened while copying
+	do
+	{
+		nSequence = m_nSequence.load(std::memory_order_acquire);
+		if (nSequence & 1)
+			continue;
+
+		OutSnapshot.nVolume = ChannelState.nVolume;
+		OutSnapshot.nExpression = ChannelState.nExpression;
+		OutSnapshot.nNotes = 0;
+
+		for (size_t nWord = 0; nWord < ActiveNoteWords; ++nWord)
+		{
+			u32 nActiveNotes = ChannelState.ActiveNotes[nWord];
+
+			while (nActiveNotes)
+			{
+				const size_t nBit = __builtin_ctz(nActiveNotes);
+				nActiveNotes &= nActiveNotes - 1;
+				OutSnapshot.Notes[OutSnapshot.nNotes++] = ChannelState.Notes[nWord * 32 + nBit];
+			}
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((nSequence & 1) || nSequence != m_nSequence.load(std::memory_order_relaxed));
+}
+
 void CMIDIMonitor::ProcessCC(u8 nChannel, u8 nCC, u8 nValue, unsigned int nTicks)
 {
 	TChannelState& ChannelState = m_State[nChannel];
@@ -200,13 +282,15 @@ void CMIDIMonitor::ProcessCC(u8 nChannel, u8 nCC, u8 nValue, unsigned int nTicks
 			// Damper released; trigger note-off for flagged notes
 			if (!nValue)
 			{
-				for (auto& Note : ChannelState.Notes)
+				for (u8 nNote = 0; nNote < NoteCount; ++nNote)
 				{
+					TNoteState& Note = ChannelState.Notes[nNote];
 					if (Note.bDamperFlag)
 					{
 						Note.EnvelopePhase = TEnvelopePhase::NoteOff;
 						Note.nNoteOffTime = nTicks;
 						Note.bDamperFlag = false;
+						SetNoteActive(ChannelState, nNote);
 					}
 				}
 			}
@@ -220,12 +304,12 @@ void CMIDIMonitor::ProcessCC(u8 nChannel, u8 nCC, u8 nValue, unsigned int nTicks
 		case 0x7D:	// Omni On
 		case 0x7E:	// Mono On
 		case 0x7F:	// Mono Off
-			AllNotesOff();
+			ReleaseAllNotes(nTicks);
 			break;
 
 		// Reset All Controllers
 		case 0x79:
-			ResetControllers(true);
+			ResetControllerState(true);
 			break;
 
 		default:
@@ -233,14 +317,71 @@ void CMIDIMonitor::ProcessCC(u8 nChannel, u8 nCC, u8 nValue, unsigned int nTicks
 	}
 }
 
-float CMIDIMonitor::ComputeEnvelope(TNoteState& NoteState) const
+void CMIDIMonitor::ReleaseAllNotes(unsigned int nTicks)
+{
+	for (auto& Channel : m_State)
+	{
+		for (auto& Note : Channel.Notes)
+		{
+			if (Note.EnvelopePhase == TEnvelopePhase::NoteOn)
+			{
+				Note.EnvelopePhase = TEnvelopePhase::NoteOff;
+				Note.nNoteOffTime = nTicks;
+			}
+
+			Note.bDamperFlag = false;
+		}
+	}
+}
+
+void CMIDIMonitor::PruneAllNotes(unsigned int nTicks)
+{
+	const u16 nPercussionBitMask = m_nPercussionBitMask.load(std::memory_order_relaxed);
+
+	for (size_t nChannel = 0; nChannel < ChannelCount; ++nChannel)
+		PruneNotes(m_State[nChannel], nPercussionBitMask & (1 << nChannel), nTicks);
+
+	m_nLastPruneTime = nTicks;
+}
+
+void CMIDIMonitor::PruneNotes(TChannelState& ChannelState, bool bIsPercussionChannel, unsigned int nTicks)
+{
+	for (size_t nWord = 0; nWord < ActiveNoteWords; ++nWord)
+	{
+		u32 nActiveNotes = ChannelState.ActiveNotes[nWord];
+
+		while (nActiveNotes)
+		{
+			const size_t nBit = __builtin_ctz(nActiveNotes);
+			nActiveNotes &= nActiveNotes - 1;
+
+			// Notes whose envelope has finished; percussion envelopes run from the note on, whether or not it's released
+			TNoteState& NoteState = ChannelState.Notes[nWord * 32 + nBit];
+			const bool bFinished = bIsPercussionChannel
+				? Utility::TicksToMillis(nTicks - NoteState.nNoteOnTime) > ReleaseTimeMillis
+				: NoteState.EnvelopePhase == TEnvelopePhase::NoteOff && Utility::TicksToMillis(nTicks - NoteState.nNoteOffTime) > ReleaseTimeMillis;
+
+			if (bFinished)
+			{
+				NoteState.EnvelopePhase = TEnvelopePhase::Idle;
+				ChannelState.ActiveNotes[nWord] &= ~(1u << nBit);
+			}
+		}
+	}
+}
+
+void CMIDIMonitor::SetNoteActive(TChannelState& ChannelState, u8 nNote)
+{
+	ChannelState.ActiveNotes[nNote / 32] |= 1u << (nNote % 32);
+}
+
+float CMIDIMonitor::ComputeEnvelope(const TNoteState& NoteState, unsigned int nTicks)
 {
 	switch (NoteState.EnvelopePhase)
 	{
 		// Note is on
 		case TEnvelopePhase::NoteOn:
 		{
-			const unsigned int nTicks = CTimer::GetClockTicks();
 			const float nNoteOnDurationMillis = Utility::TicksToMillis(nTicks - NoteState.nNoteOnTime);
 
 			// Attack phase
@@ -276,15 +417,11 @@ float CMIDIMonitor::ComputeEnvelope(TNoteState& NoteState) const
 			else
 				nVolume = SustainLevel;
 
-			const unsigned int nTicks = CTimer::GetClockTicks();
 			const float nNoteOffDurationMillis = Utility::TicksToMillis(nTicks - NoteState.nNoteOffTime);
 
 			// Envelope is complete
 			if (nNoteOffDurationMillis > ReleaseTimeMillis)
-			{
-				NoteState.EnvelopePhase = TEnvelopePhase::Idle;
 				return 0.0f;
-			}
 
 			return nVolume - nNoteOffDurationMillis / ReleaseTimeMillis;
 		}
@@ -295,20 +432,16 @@ float CMIDIMonitor::ComputeEnvelope(TNoteState& NoteState) const
 	}
 }
 
-float CMIDIMonitor::ComputePercussionEnvelope(TNoteState& NoteState) const
+float CMIDIMonitor::ComputePercussionEnvelope(const TNoteState& NoteState, unsigned int nTicks)
 {
 	if (NoteState.EnvelopePhase == TEnvelopePhase::Idle)
 		return 0.0f;
 
-	const unsigned int nTicks = CTimer::GetClockTicks();
 	const float nNoteOnDurationMillis = Utility::TicksToMillis(nTicks - NoteState.nNoteOnTime);
 
 	// Envelope is complete
 	if (nNoteOnDurationMillis > ReleaseTimeMillis)
-	{
-		NoteState.EnvelopePhase = TEnvelopePhase::Idle;
 		return 0.0f;
-	}
 
 	// No decay/sustain for percussion
 	return 1.0f - nNoteOnDurationMillis / ReleaseTimeMillis;
@@ -21,24 +21,47 @@
 //
 
 #include <circle/logger.h>
+#include <circle/util.h>
 
 #include "midiparser.h"
+#include "utility.h"
 
 LOGMODULE("midiparser");
 
-CMIDIParser::CMIDIParser()
-	: m_State(TState::StatusByte),
+CMIDIParser::CMIDIParser(CMIDIParserHandler* pHandler)
+	: m_pHandler(pHandler),
+	  m_bSysExStreaming(false),
+	  m_bSysExFragmented(false),
+
+	  m_State(TState::StatusByte),
 	  m_MessageBuffer{0},
-	  m_nMessageLength(0)
+	  m_nMessageLength(0),
+	  m_nTimestamp(0)
 {
 }
 
-void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNoteOns)
+void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, u32 nTimestamp, bool bIgnoreNoteOns)
 {
+	m_nTimestamp = nTimestamp;
+
 	// Process MIDI messages
 	// See: https://www.midi.org/specifications/item/table-1-summary-of-midi-message
 	for (size_t i = 0; i < nSize; ++i)
 	{
+		// Copy runs of SysEx data bytes in one go; only a status byte or a full buffer needs further attention
+		if (m_State == TState::SysExByte)
+		{
+			const size_t nFree = sizeof(m_MessageBuffer) - m_nMessageLength;
+			const size_t nRunLength = FindStatusByte(pData + i, Utility::Min(nSize - i, nFree));
+
+			memcpy(m_MessageBuffer + m_nMessageLength, pData + i, nRunLength);
+			m_nMessageLength += nRunLength;
+			i += nRunLength;
+
+			if (i == nSize)
+				break;
+		}
+
 		u8 nByte = pData[i];
 
 		// System Real-Time message - single byte, handle immediately
@@ -47,7 +70,7 @@ void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNote
 		{
 			// Ignore undefined System Real-Time
 			if (nByte != 0xF9 && nByte != 0xFD)
-				OnShortMessage(nByte);
+				m_pHandler->OnShortMessage(nByte, m_nTimestamp);
 
 			continue;
 		}
@@ -64,7 +87,7 @@ void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNote
 				// Expected a data byte, but received a status
 				if (nByte & 0x80)
 				{
-					OnUnexpectedStatus();
+					UnexpectedStatus();
 					ResetState(true);
 					ParseStatusByte(nByte);
 					break;
@@ -79,19 +102,27 @@ void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNote
 				// Received a status that wasn't EOX
 				if (nByte & 0x80 && nByte != 0xF7)
 				{
-					OnUnexpectedStatus();
+					UnexpectedStatus();
 					ResetState(true);
 					ParseStatusByte(nByte);
 					break;
 				}
 
-				// Buffer overflow
+				// Buffer full
 				if (m_nMessageLength == sizeof(m_MessageBuffer))
 				{
-					OnSysExOverflow();
-					ResetState(true);
-					ParseStatusByte(nByte);
-					break;
+					if (!m_bSysExStreaming)
+					{
+						SysExOverflow();
+						ResetState(true);
+						ParseStatusByte(nByte);
+						break;
+					}
+
+					// Pass on what we have so far and keep receiving
+					m_pHandler->OnSysExFragment(m_MessageBuffer, m_nMessageLength, m_bSysExFragmented ? TSysExFragment::Continue : TSysExFragment::Begin, m_nTimestamp);
+					m_bSysExFragmented = true;
+					m_nMessageLength = 0;
 				}
 
 				m_MessageBuffer[m_nMessageLength++] = nByte;
@@ -99,7 +130,14 @@ void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNote
 				// End of SysEx
 				if (nByte == 0xF7)
 				{
-					OnSysExMessage(m_MessageBuffer, m_nMessageLength);
+					if (m_bSysExFragmented)
+					{
+						m_bSysExFragmented = false;
+						m_pHandler->OnSysExFragment(m_MessageBuffer, m_nMessageLength, TSysExFragment::End, m_nTimestamp);
+					}
+					else
+						m_pHandler->OnSysExMessage(m_MessageBuffer, m_nMessageLength, m_nTimestamp);
+
 					ResetState(true);
 				}
 
@@ -108,17 +146,95 @@ void CMIDIParser::ParseMIDIBytes(const u8* pData, size_t nSize, bool bIgnoreNote
 	}
 }
 
-void CMIDIParser::OnUnexpectedStatus()
+bool CMIDIParser::IsCompleteShortMessage(const u8* pData, size_t nSize)
+{
+	if (nSize == 0)
+		return false;
+
+	const u8 nStatus = pData[0];
+
+	// Data bytes must not have the top bit set; a packet that breaks the rules is left for the parser to sort out
+	for (size_t i = 1; i < nSize; ++i)
+	{
+		if (pData[i] & 0x80)
+			return false;
+	}
+
+	// Channel messages; Program Change and Channel Pressure have one data byte
+	if (nStatus >= 0x80 && nStatus <= 0xEF)
+		return nSize == ((nStatus >= 0xC0 && nStatus <= 0xDF) ? 2 : 3);
+
+	switch (nStatus)
+	{
+		// Time Code Quarter Frame, Song Select
+		case 0xF1:
+		case 0xF3:
+			return nSize == 2;
+
+		// Song Position Pointer
+		case 0xF2:
+			return nSize == 3;
+
+		// Tune Request and defined System Real-Time messages
+		case 0xF6:
+		case 0xF8:
+		case 0xFA:
+		case 0xFB:
+		case 0xFC:
+		case 0xFE:
+		case 0xFF:
+			return nSize == 1;
+
+		// SysEx fragments and anything unusual go through the parser
+		default:
+			return false;
+	}
+}
+
+size_t CMIDIParser::FindStatusByte(const u8* pData, size_t nSize)
+{
+	using TWord = uintptr;
+	constexpr TWord HighBitMask = static_cast<TWord>(0x8080808080808080ULL);
+
+	size_t i = 0;
+
+	// Byte at a time until aligned
+	while (i < nSize && (reinterpret_cast<uintptr>(pData + i) & (sizeof(TWord) - 1)))
+	{
+		if (pData[i] & 0x80)
+			return i;
+		++i;
+	}
+
+	// A word at a time until one contains a byte with the high bit set
+	while (nSize - i >= sizeof(TWord))
+	{
+		if (*reinterpret_cast<const TWord*>(pData + i) & HighBitMask)
+			break;
+		i += sizeof(TWord);
+	}
+
+	// Find the exact position within that word, or check the remainder
+	while (i < nSize && !(pData[i] & 0x80))
+		++i;
+
+	return i;
+}
+
+void CMIDIParser::UnexpectedStatus()
 {
 	if (m_State == TState::SysExByte)
 		LOGWARN("Received illegal status byte during SysEx message; SysEx ignored");
 	else
 		LOGWARN("Received illegal status byte when data expected");
+
+	m_pHandler->OnUnexpectedStatus();
 }
 
-void CMIDIParser::OnSysExOverflow()
+void CMIDIParser::SysExOverflow()
 {
 	LOGWARN("Buffer overrun when receiving SysEx message; SysEx ignored");
+	m_pHandler->OnSysExOverflow();
 }
 
 void CMIDIParser::ParseStatusByte(u8 nByte)
@@ -142,9 +258,9 @@ void CMIDIParser::ParseStatusByte(u8 nByte)
 
 			// Tune Request - single byte, handle immediately and clear running status
 			case 0xF6:
-				OnShortMessage(nByte);
+				m_pHandler->OnShortMessage(nByte, m_nTimestamp);
 				m_MessageBuffer[0] = 0;
-				break;
+				return;
 
 			// Channel or System Common message
 			default:
@@ -179,7 +295,7 @@ bool CMIDIParser::CheckCompleteShortMessage(bool bIgnoreNoteOns)
 		const bool bIsNoteOn = (nStatus & 0xF0) == 0x90;
 
 		if (!(bIsNoteOn && bIgnoreNoteOns))
-			OnShortMessage(PrepareShortMessage());
+			m_pHandler->OnShortMessage(PrepareShortMessage(), m_nTimestamp);
 
 		// Clear running status if System Common
 		ResetState(nStatus >= 0xF1 && nStatus <= 0xF7);
@@ -202,6 +318,13 @@ u32 CMIDIParser::PrepareShortMessage() const
 
 void CMIDIParser::ResetState(bool bClearStatusByte)
 {
+	// A streamed SysEx message was interrupted
+	if (m_bSysExFragmented)
+	{
+		m_bSysExFragmented = false;
+		m_pHandler->OnSysExFragment(nullptr, 0, TSysExFragment::Abort, m_nTimestamp);
+	}
+
 	if (bClearStatusByte)
 		m_MessageBuffer[0] = 0;
 
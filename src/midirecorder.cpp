@@ -0,0 +1,420 @@
+//
+// midirecorder.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+#include <circle/util.h>
+
+#include "midirecorder.h"
+#include "utility.h"
+
+LOGMODULE("midirecorder");
+
+constexpr unsigned int MaxFileIndex = 9999;
+
+// Largest value that fits in a 4-byte variable-length quantity
+constexpr u32 MaxVariableLengthValue = 0x0FFFFFFF;
+
+// Offsets of the track chunk's length field and data within the file
+constexpr FSIZE_t TrackLengthOffset = 18;
+constexpr FSIZE_t TrackDataOffset   = 22;
+
+CMIDIRecorder::CMIDIRecorder()
+	: CTask(TASK_STACK_SIZE, true),
+
+	  m_State(TState::Idle),
+	  m_bRecording(false),
+
+	  m_nLastTimestamp(0),
+	  m_nElapsedMicroseconds(0),
+	  m_nLastTick(0),
+	  m_nEventTick(0),
+	  m_bSysExOpen(false),
+	  m_bDroppingSysEx(false),
+	  m_nEventSize(0),
+	  m_EventBuffer{0},
+	  m_nDroppedMessages(0),
+
+	  m_bFileOpen(false),
+	  m_File{},
+	  m_nWriteBlockSize(0),
+	  m_WriteBlock{0},
+	  m_nLastWriteTime(0)
+{
+}
+
+CMIDIRecorder::~CMIDIRecorder()
+{
+	if (m_bFileOpen)
+		f_close(&m_File);
+}
+
+bool CMIDIRecorder::Initialize()
+{
+	// We started as a suspended task; run now that initialization is successful
+	Start();
+
+	return true;
+}
+
+bool CMIDIRecorder::StartRecording(const char* pVolume)
+{
+	// Still busy with the previous recording
+	if (m_State != TState::Idle)
+		return false;
+
+	m_Volume = pVolume;
+
+	m_nLastTimestamp       = CTimer::GetClockTicks();
+	m_nElapsedMicroseconds = 0;
+	m_nLastTick            = 0;
+	m_bSysExOpen           = false;
+	m_bDroppingSysEx       = false;
+	m_nDroppedMessages.store(0, std::memory_order_relaxed);
+
+	// Messages are buffered while the task opens the file
+	m_State = TState::Starting;
+	m_bRecording = true;
+
+	return true;
+}
+
+void CMIDIRecorder::StopRecording()
+{
+	if (!m_bRecording)
+		return;
+
+	m_bRecording = false;
+	m_State = TState::Stopping;
+}
+
+void CMIDIRecorder::RecordShortMessage(u32 nMessage, u32 nTimestamp)
+{
+	if (!m_bRecording)
+		return;
+
+	// System Common and System Real-Time messages can't be stored in a MIDI file
+	const u8 nStatus = nMessage & 0xFF;
+	if (nStatus >= 0xF0)
+		return;
+
+	// Program Change and Channel Pressure have one data byte
+	const size_t nLength = (nStatus >= 0xC0 && nStatus <= 0xDF) ? 2 : 3;
+
+	BeginEvent(nTimestamp);
+	for (size_t i = 0; i < nLength; ++i)
+		m_EventBuffer[m_nEventSize++] = (nMessage >> 8 * i) & 0xFF;
+	EndEvent();
+}
+
+void CMIDIRecorder::RecordSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp)
+{
+	if (!m_bRecording)
+		return;
+
+	// F0 <length> <data after F0, including F7>
+	BeginEvent(nTimestamp);
+	WriteSysExPacket(0xF0, pData + 1, nSize - 1);
+	EndEvent();
+}
+
+void CMIDIRecorder::RecordSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp)
+{
+	if (!m_bRecording)
+		return;
+
+	if (Fragment == TSysExFragment::Begin)
+	{
+		m_bSysExOpen     = false;
+		m_bDroppingSysEx = false;
+	}
+
+	// The first packet was dropped, or recording started in the middle of the message
+	else if (!m_bSysExOpen)
+		return;
+
+	const bool bLastFragment = Fragment == TSysExFragment::End || Fragment == TSysExFragment::Abort;
+
+	// Continuation packets start with F7 instead of F0; if any data was lost, just terminate the message
+	BeginEvent(nTimestamp);
+	if (m_bDroppingSysEx || Fragment == TSysExFragment::Abort)
+	{
+		if (!bLastFragment)
+			return;
+
+		const u8 EndOfExclusive = 0xF7;
+		WriteSysExPacket(0xF7, &EndOfExclusive, 1);
+	}
+	else if (Fragment == TSysExFragment::Begin)
+		WriteSysExPacket(0xF0, pData + 1, nSize - 1);
+	else
+		WriteSysExPacket(0xF7, pData, nSize);
+
+	const bool bEnqueued = EndEvent();
+
+	if (Fragment == TSysExFragment::Begin)
+		m_bSysExOpen = bEnqueued;
+	else if (bLastFragment)
+		m_bSysExOpen = false;
+	else if (!bEnqueued)
+		m_bDroppingSysEx = true;
+}
+
+void CMIDIRecorder::Run()
+{
+	CScheduler* const pScheduler = CScheduler::Get();
+
+	while (true)
+	{
+		switch (m_State)
+		{
+			case TState::Starting:
+				if (!OpenFile())
+				{
+					m_bRecording = false;
+					DiscardBuffer();
+					m_State = TState::Idle;
+				}
+
+				// We may have been asked to stop while the file was being opened
+				else if (m_State == TState::Starting)
+					m_State = TState::Recording;
+				break;
+
+			case TState::Recording:
+				if (!WriteBlocks(false))
+				{
+					m_bRecording = false;
+					CloseFile();
+					DiscardBuffer();
+					m_State = TState::Idle;
+				}
+				break;
+
+			case TState::Stopping:
+				if (m_bFileOpen)
+				{
+					WriteBlocks(true);
+					CloseFile();
+				}
+				DiscardBuffer();
+				m_State = TState::Idle;
+				break;
+
+			case TState::Idle:
+				break;
+		}
+
+		pScheduler->MsSleep(PollIntervalMillis);
+	}
+}
+
+void CMIDIRecorder::BeginEvent(u32 nTimestamp)
+{
+	// Timestamps from different inputs can be slightly out of order; never go backwards in time
+	const s32 nDelta = static_cast<s32>(nTimestamp - m_nLastTimestamp);
+	if (nDelta > 0)
+	{
+		m_nElapsedMicroseconds += nDelta;
+		m_nLastTimestamp = nTimestamp;
+	}
+
+	m_nEventTick = m_nElapsedMicroseconds / MicrosecondsPerTick;
+	m_nEventSize = 0;
+
+	// Relative to the last event that was actually recorded, so dropped events don't affect timing
+	WriteVariableLength(Utility::Min(m_nEventTick - m_nLastTick, MaxVariableLengthValue));
+}
+
+void CMIDIRecorder::WriteVariableLength(u32 nValue)
+{
+	// 7 bits per byte, most significant first, with the top bit set on all but the last byte
+	u8 Bytes[4];
+	size_t nBytes = 0;
+
+	do
+	{
+		Bytes[nBytes++] = nValue & 0x7F;
+		nValue >>= 7;
+	} while (nValue && nBytes < sizeof(Bytes));
+
+	while (nBytes > 1)
+		m_EventBuffer[m_nEventSize++] = Bytes[--nBytes] | 0x80;
+	m_EventBuffer[m_nEventSize++] = Bytes[0];
+}
+
+void CMIDIRecorder::WriteSysExPacket(u8 nStatus, const u8* pData, size_t nSize)
+{
+	assert(m_nEventSize + 1 + 4 + nSize <= sizeof(m_EventBuffer));
+
+	m_EventBuffer[m_nEventSize++] = nStatus;
+	WriteVariableLength(nSize);
+	memcpy(m_EventBuffer + m_nEventSize, pData, nSize);
+	m_nEventSize += nSize;
+}
+
+bool CMIDIRecorder::EndEvent()
+{
+	// Only the producer reduces free space, so if it fits now, it'll still fit when enqueued
+	if (m_Buffer.GetFreeSpace() < m_nEventSize)
+	{
+		m_nDroppedMessages.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	m_Buffer.Enqueue(m_EventBuffer, m_nEventSize);
+	m_nLastTick = m_nEventTick;
+
+	return true;
+}
+
+bool CMIDIRecorder::OpenFile()
+{
+	FILINFO FileInfo;
+	FRESULT Result = FR_OK;
+
+	// Find the first unused file name
+	for (unsigned int i = 1; i <= MaxFileIndex && Result == FR_OK; ++i)
+	{
+		m_FileName.Format("%scapture_%04d.mid", static_cast<const char*>(m_Volume), i);
+		Result = f_stat(m_FileName, &FileInfo);
+	}
+
+	if (Result != FR_NO_FILE || f_open(&m_File, m_FileName, FA_CREATE_NEW | FA_WRITE) != FR_OK)
+	{
+		LOGERR("Couldn't create a MIDI recording file on %s", static_cast<const char*>(m_Volume));
+		return false;
+	}
+
+	// Format 0 file with a single track, followed by a tempo event
+	const u8 Header[] =
+	{
+		'M', 'T', 'h', 'd',
+		0x00, 0x00, 0x00, 0x06,
+		0x00, 0x00,
+		0x00, 0x01,
+		static_cast<u8>(TicksPerQuarterNote >> 8), static_cast<u8>(TicksPerQuarterNote & 0xFF),
+
+		// Track length is filled in when recording stops
+		'M', 'T', 'r', 'k',
+		0x00, 0x00, 0x00, 0x00,
+
+		0x00, 0xFF, 0x51, 0x03,
+		static_cast<u8>(MicrosecondsPerQuarterNote >> 16),
+		static_cast<u8>((MicrosecondsPerQuarterNote >> 8) & 0xFF),
+		static_cast<u8>(MicrosecondsPerQuarterNote & 0xFF),
+	};
+
+	// The header goes at the start of the first block
+	memcpy(m_WriteBlock, Header, sizeof(Header));
+	m_nWriteBlockSize = sizeof(Header);
+	m_nLastWriteTime = CTimer::Get()->GetTicks();
+	m_bFileOpen = true;
+
+	LOGNOTE("Recording MIDI to %s", static_cast<const char*>(m_FileName));
+	return true;
+}
+
+bool CMIDIRecorder::WriteBlocks(bool bFlushAll)
+{
+	const unsigned int nTicks = CTimer::Get()->GetTicks();
+
+	// Only write whole blocks, unless flushing or nothing has been written for a while (limits loss on power failure)
+	const bool bWritePartial = bFlushAll || (nTicks - m_nLastWriteTime) >= MSEC2HZ(SyncIntervalMillis);
+
+	while (true)
+	{
+		m_nWriteBlockSize += m_Buffer.Dequeue(m_WriteBlock + m_nWriteBlockSize, WriteBlockSize - m_nWriteBlockSize);
+
+		const bool bFullBlock = m_nWriteBlockSize == WriteBlockSize;
+		if (m_nWriteBlockSize == 0 || !(bFullBlock || bWritePartial))
+			return true;
+
+		UINT nWritten;
+		if (f_write(&m_File, m_WriteBlock, m_nWriteBlockSize, &nWritten) != FR_OK || nWritten != m_nWriteBlockSize)
+		{
+			LOGERR("Error writing to %s; recording stopped", static_cast<const char*>(m_FileName));
+			return false;
+		}
+
+		m_nWriteBlockSize = 0;
+		m_nLastWriteTime = nTicks;
+
+		// Keep the track length up to date so that the file is readable even if recording is never stopped
+		if (!bFullBlock)
+		{
+			WriteTrackLength();
+			f_sync(&m_File);
+			return true;
+		}
+	}
+}
+
+void CMIDIRecorder::CloseFile()
+{
+	UINT nWritten;
+
+	// End of Track meta event
+	const u8 EndOfTrack[] = { 0x00, 0xFF, 0x2F, 0x00 };
+	f_write(&m_File, EndOfTrack, sizeof(EndOfTrack), &nWritten);
+
+	if (!WriteTrackLength())
+		LOGERR("Couldn't finalize %s", static_cast<const char*>(m_FileName));
+
+	f_close(&m_File);
+	m_bFileOpen = false;
+	m_nWriteBlockSize = 0;
+
+	const u32 nDroppedMessages = m_nDroppedMessages.load(std::memory_order_relaxed);
+	if (nDroppedMessages)
+		LOGWARN("%d MIDI messages were dropped from the recording", nDroppedMessages);
+
+	LOGNOTE("MIDI recording saved to %s", static_cast<const char*>(m_FileName));
+}
+
+bool CMIDIRecorder::WriteTrackLength()
+{
+	const FSIZE_t nFileSize = f_size(&m_File);
+	const u32 nTrackLength = nFileSize - TrackDataOffset;
+	const u8 TrackLength[] =
+	{
+		static_cast<u8>(nTrackLength >> 24),
+		static_cast<u8>((nTrackLength >> 16) & 0xFF),
+		static_cast<u8>((nTrackLength >> 8) & 0xFF),
+		static_cast<u8>(nTrackLength & 0xFF),
+	};
+
+	UINT nWritten;
+	const bool bResult = f_lseek(&m_File, TrackLengthOffset) == FR_OK &&
+			     f_write(&m_File, TrackLength, sizeof(TrackLength), &nWritten) == FR_OK &&
+			     nWritten == sizeof(TrackLength);
+
+	// Return to the end of the file for the next write
+	return f_lseek(&m_File, nFileSize) == FR_OK && bResult;
+}
+
+void CMIDIRecorder::DiscardBuffer()
+{
+	while (m_Buffer.Dequeue(m_WriteBlock, sizeof(m_WriteBlock)))
+		;
+}
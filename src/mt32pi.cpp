@@ -28,6 +28,8 @@
 
 #include <cstdarg>
 
+#include "audio/sampleconverter.h"
+#include "customsysex.h"
 #include "lcd/drivers/hd44780.h"
 #include "lcd/drivers/ssd1306.h"
 #include "lcd/ui.h"
@@ -45,22 +47,10 @@ constexpr u32 MisterUpdatePeriodMillis             = 50;
 constexpr u32 LEDTimeoutMillis                     = 50;
 constexpr u32 ActiveSenseTimeoutMillis             = 330;
 
-constexpr float Sample24BitMax = (1 << 24 - 1) - 1;
-
-enum class TCustomSysExCommand : u8
-{
-	Reboot                = 0x00,
-	SwitchMT32ROMSet      = 0x01,
-	SwitchSoundFont       = 0x02,
-	SwitchSynth           = 0x03,
-	SetMT32ReversedStereo = 0x04,
-};
-
 CMT32Pi* CMT32Pi::s_pThis = nullptr;
 
 CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSystem* pInterrupt, CGPIOManager* pGPIOManager, CSerialDevice* pSerialDevice, CUSBHCIDevice* pUSBHCI)
 	: CMultiCoreSupport(CMemorySystem::Get()),
-	  CMIDIParser(),
 
 	  m_pConfig(CConfig::Get()),
 
@@ -90,6 +80,12 @@ CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSyste
 #ifdef MONITOR_TEMPERATURE
 	  m_nTempUpdateTime(0),
 #endif
+#ifdef MONITOR_MIDI_EVENTS
+	  m_nMIDIEventStatsTime(0),
+#endif
+#ifdef MONITOR_AUDIO_LATENCY
+	  m_nLatencyStatsTime(0),
+#endif
 
 	  m_pControl(nullptr),
 	  m_MisterControl(pI2CMaster, m_EventQueue),
@@ -114,14 +110,24 @@ CMT32Pi::CMT32Pi(CI2CMaster* pI2CMaster, CSPIMaster* pSPIMaster, CInterruptSyste
 	  m_nLEDOnTime(0),
 
 	  m_pSound(nullptr),
+	  m_pRenderAheadQueue(nullptr),
+	  m_pLatencyController(nullptr),
+	  m_nLastXRuns(0),
+	  m_nLastTargetFrames(0),
 	  m_pPisound(nullptr),
 
 	  m_nMasterVolume(100),
 	  m_pCurrentSynth(nullptr),
 	  m_pMT32Synth(nullptr),
-	  m_pSoundFontSynth(nullptr)
+	  m_pSoundFontSynth(nullptr),
+	  m_pSplitSynth(nullptr),
+
+	  m_pMIDIRecorder(nullptr)
 {
 	s_pThis = this;
+
+	for (CMIDIParser& Parser : m_MIDIParsers)
+		Parser.SetHandler(this);
 }
 
 CMT32Pi::~CMT32Pi()
@@ -133,6 +139,9 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 	m_bSerialMIDIAvailable = bSerialMIDIAvailable;
 	m_bSerialMIDIEnabled = bSerialMIDIAvailable;
 
+	for (CMIDIParser& Parser : m_MIDIParsers)
+		Parser.SetSysExStreaming(m_pConfig->MIDISysExStreaming);
+
 	switch (m_pConfig->LCDType)
 	{
 		case CConfig::TLCDType::HD44780FourBit:
@@ -202,7 +211,7 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		if (m_pPisound->Initialize())
 		{
 			LOGWARN("Blokas Pisound detected");
-			m_pPisound->RegisterMIDIReceiveHandler(IRQMIDIReceiveHandler);
+			m_pPisound->RegisterMIDIReceiveHandler(PisoundMIDIReceiveHandler);
 			m_bSerialMIDIEnabled = false;
 		}
 		else
@@ -214,6 +223,7 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 
 	// Queue size of just one chunk
 	unsigned int nQueueSize = m_pConfig->AudioChunkSize;
+	unsigned int nChunkSize = m_pConfig->AudioChunkSize;
 	TSoundFormat Format = TSoundFormat::SoundFormatSigned24;
 
 	switch (m_pConfig->AudioOutputDevice)
@@ -228,7 +238,7 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 			LCDLog(TLCDLogType::Startup, "Init audio (HDMI)");
 
 			// Chunk size must be a multiple of 384
-			const unsigned int nChunkSize = Utility::RoundToNearestMultiple(m_pConfig->AudioChunkSize, IEC958_SUBFRAMES_PER_BLOCK);
+			nChunkSize = Utility::RoundToNearestMultiple(m_pConfig->AudioChunkSize, IEC958_SUBFRAMES_PER_BLOCK);
 			nQueueSize = nChunkSize;
 
 			m_pSound = new CHDMISoundBaseDevice(m_pInterrupt, m_pConfig->AudioSampleRate, nChunkSize);
@@ -252,10 +262,32 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		}
 	}
 
+	// Adaptive latency; allocate for the largest amount of audio we may queue
+	// Render-ahead keeps the output queue full, so the latency controller's target would never be applied
+	const bool bAdaptiveLatency = m_pConfig->AudioAdaptiveLatency && m_pConfig->AudioRenderAhead == 0;
+	if (m_pConfig->AudioAdaptiveLatency && !bAdaptiveLatency)
+		LOGWARN("Adaptive latency can't be used with render-ahead; disabled");
+
+	unsigned int nMaxQueueSize = nQueueSize;
+	if (bAdaptiveLatency)
+	{
+		nMaxQueueSize = Utility::Max(nQueueSize, Utility::RoundToNearestMultiple(static_cast<unsigned int>(m_pConfig->AudioMaxChunkSize), nChunkSize));
+		LOGNOTE("Adaptive latency enabled (%d-%d frames)", nQueueSize, nMaxQueueSize);
+	}
+
 	m_pSound->SetWriteFormat(Format);
-	if (!m_pSound->AllocateQueueFrames(nQueueSize))
+	if (!m_pSound->AllocateQueueFrames(nMaxQueueSize))
 		LOGPANIC("Failed to allocate sound queue");
 
+	m_pLatencyController = new CLatencyController(m_pConfig->AudioSampleRate, nQueueSize, nMaxQueueSize);
+
+	// Render blocks on core 3 ahead of output on core 2
+	if (m_pConfig->AudioRenderAhead > 0)
+	{
+		m_pRenderAheadQueue = new CRenderAheadQueue(m_pConfig->AudioRenderAhead, m_pSound->GetQueueSizeFrames());
+		LOGNOTE("Render-ahead enabled (%d blocks)", m_pRenderAheadQueue->GetBlockCount());
+	}
+
 	LCDLog(TLCDLogType::Startup, "Init controls");
 	if (m_pConfig->ControlScheme == CConfig::TControlScheme::SimpleButtons)
 		m_pControl = new CControlSimpleButtons(m_EventQueue);
@@ -275,11 +307,15 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 	LCDLog(TLCDLogType::Startup, "Init FluidSynth");
 	InitSoundFontSynth();
 
+	InitSplitSynth();
+
 	// Set initial synthesizer
 	if (m_pConfig->SystemDefaultSynth == CConfig::TSystemDefaultSynth::MT32)
 		m_pCurrentSynth = m_pMT32Synth;
 	else if (m_pConfig->SystemDefaultSynth == CConfig::TSystemDefaultSynth::SoundFont)
 		m_pCurrentSynth = m_pSoundFontSynth;
+	else if (m_pConfig->SystemDefaultSynth == CConfig::TSystemDefaultSynth::Split)
+		m_pCurrentSynth = m_pSplitSynth;
 
 	if (!m_pCurrentSynth)
 	{
@@ -297,6 +333,20 @@ bool CMT32Pi::Initialize(bool bSerialMIDIAvailable)
 		}
 	}
 
+	m_pMIDIRecorder = new CMIDIRecorder();
+	if (m_pMIDIRecorder->Initialize())
+	{
+		if (m_pConfig->MIDIRecord == CConfig::TMIDIRecord::SD)
+			SetMIDIRecording(1);
+		else if (m_pConfig->MIDIRecord == CConfig::TMIDIRecord::USB)
+			SetMIDIRecording(2);
+	}
+	else
+	{
+		delete m_pMIDIRecorder;
+		m_pMIDIRecorder = nullptr;
+	}
+
 	if (m_pPisound)
 		LOGNOTE("Using Pisound MIDI interface");
 	else if (m_bSerialMIDIEnabled)
@@ -388,6 +438,7 @@ bool CMT32Pi::InitMT32Synth()
 	m_pMT32Synth->SetReversedStereo(m_pConfig->MT32EmuReversedStereo);
 
 	m_pMT32Synth->SetUserInterface(&m_UserInterface);
+	m_pMT32Synth->m_MIDIEventQueue.SetCoalescing(m_pConfig->MIDICoalescing);
 
 	return true;
 }
@@ -397,6 +448,11 @@ bool CMT32Pi::InitSoundFontSynth()
 	assert(m_pSoundFontSynth == nullptr);
 
 	m_pSoundFontSynth = new CSoundFontSynth(m_pConfig->AudioSampleRate);
+
+	// Must be set before initialization, as that is where the FluidSynth instances are created
+	if (m_pConfig->FluidSynthParallelRender)
+		m_pSoundFontSynth->SetRenderHelper(&m_RenderHelper);
+
 	if (!m_pSoundFontSynth->Initialize())
 	{
 		LOGWARN("FluidSynth init failed; no SoundFonts present?");
@@ -406,6 +462,31 @@ bool CMT32Pi::InitSoundFontSynth()
 	}
 
 	m_pSoundFontSynth->SetUserInterface(&m_UserInterface);
+	m_pSoundFontSynth->m_MIDIEventQueue.SetCoalescing(m_pConfig->MIDICoalescing);
+
+	return true;
+}
+
+bool CMT32Pi::InitSplitSynth()
+{
+	assert(m_pSplitSynth == nullptr);
+
+	// Requires both synths
+	if (!m_pMT32Synth || !m_pSoundFontSynth)
+		return false;
+
+	m_pSplitSynth = new CSplitSynth(m_pConfig->AudioSampleRate, m_pMT32Synth, m_pSoundFontSynth);
+	if (!m_pSplitSynth->Initialize())
+	{
+		LOGWARN("Split synth init failed");
+		delete m_pSplitSynth;
+		m_pSplitSynth = nullptr;
+		return false;
+	}
+
+	// Render the SoundFont synth on another core while the MT-32 renders
+	m_pSplitSynth->SetRenderHelper(&m_RenderHelper);
+	m_pSplitSynth->SetUserInterface(&m_UserInterface);
 
 	return true;
 }
@@ -454,6 +535,21 @@ void CMT32Pi::MainTask()
 		if (m_pCurrentSynth->IsActive())
 			Awaken();
 
+		// Report audio dropouts and latency changes from the audio core
+		CLatencyController::TStatistics LatencyStats;
+		m_pLatencyController->GetStatistics(LatencyStats);
+		if (LatencyStats.nXRuns != m_nLastXRuns)
+		{
+			LOGERR("Sound data dropped (%d total)", LatencyStats.nXRuns);
+			m_nLastXRuns = LatencyStats.nXRuns;
+		}
+		if (LatencyStats.nTargetFrames != m_nLastTargetFrames)
+		{
+			if (m_nLastTargetFrames)
+				LOGNOTE("Audio latency adjusted to %d frames", LatencyStats.nTargetFrames);
+			m_nLastTargetFrames = LatencyStats.nTargetFrames;
+		}
+
 #ifdef MONITOR_TEMPERATURE
 		if (nTicks - m_nTempUpdateTime >= MSEC2HZ(5000))
 		{
@@ -464,6 +560,37 @@ void CMT32Pi::MainTask()
 		}
 #endif
 
+#ifdef MONITOR_MIDI_EVENTS
+		if (nTicks - m_nMIDIEventStatsTime >= MSEC2HZ(5000))
+		{
+			CSynthBase* const Synths[] = { m_pMT32Synth, m_pSoundFontSynth };
+			for (CSynthBase* pSynth : Synths)
+			{
+				if (!pSynth)
+					continue;
+
+				CMIDIEventQueue::TStatistics Stats;
+				pSynth->m_MIDIEventQueue.GetStatistics(Stats);
+				LOGDBG("%s: %d events, %d coalesced, %d overflows, latency avg %dus max %dus, lock wait max %dus",
+					pSynth == m_pMT32Synth ? "MT-32" : "SoundFont", Stats.nEvents, Stats.nCoalesced, Stats.nOverflows,
+					Stats.nAverageLatency, Stats.nMaxLatency, Stats.nMaxLockWait);
+			}
+			m_nMIDIEventStatsTime = nTicks;
+		}
+#endif
+
+#ifdef MONITOR_AUDIO_LATENCY
+		if (nTicks - m_nLatencyStatsTime >= MSEC2HZ(5000))
+		{
+			LOGDBG("Render time min %dus avg %dus max %dus, %d xruns, target %d frames",
+				LatencyStats.nMinRenderTime, LatencyStats.nAverageRenderTime, LatencyStats.nMaxRenderTime,
+				LatencyStats.nXRuns, LatencyStats.nTargetFrames);
+			if (m_pSoundFontSynth)
+				LOGDBG("SoundFont polyphony limit %d, %d voices shed", m_pSoundFontSynth->GetPolyphonyLimit(), m_pSoundFontSynth->GetShedVoiceCount());
+			m_nLatencyStatsTime = nTicks;
+		}
+#endif
+
 		CPower::Update();
 
 		// Check for deferred SoundFont switch
@@ -482,6 +609,10 @@ void CMT32Pi::MainTask()
 			}
 		}
 
+		// Complete any SoundFont switch that was loading in the background
+		if (m_pSoundFontSynth && m_pSoundFontSynth->Update() && m_pCurrentSynth == m_pSoundFontSynth)
+			m_pSoundFontSynth->ReportStatus();
+
 		// Check for USB PnP events
 		UpdateUSB();
 
@@ -489,6 +620,13 @@ void CMT32Pi::MainTask()
 		pScheduler->Yield();
 	}
 
+	// Let the recorder finish writing its file
+	if (m_pMIDIRecorder)
+	{
+		m_pMIDIRecorder->StopRecording();
+		while (m_pMIDIRecorder->IsBusy())
+			pScheduler->Yield();
+	}
 
 	// Stop audio
 	m_pSound->Cancel();
@@ -561,47 +699,110 @@ void CMT32Pi::AudioTask()
 
 	// Circle's "fast path" for I2S 24-bit really expects 32-bit samples
 	const bool bI2S = m_pConfig->AudioOutputDevice == CConfig::TAudioOutputDevice::I2S;
-	const bool bReversedStereo = m_pConfig->AudioReversedStereo;
-	const u8 nBytesPerSample = bI2S ? sizeof(s32) : (sizeof(s8) * 3);
-	const u8 nBytesPerFrame = 2 * nBytesPerSample;
+	const auto Format = bI2S ? CSampleConverter::TFormat::Signed24_32 : CSampleConverter::TFormat::Signed24;
+	CSampleConverter Converter(Format, m_pConfig->AudioReversedStereo, m_pConfig->AudioDither);
+	const size_t nBytesPerFrame = Converter.GetBytesPerFrame();
 
 	const size_t nQueueSizeFrames = m_pSound->GetQueueSizeFrames();
 
-	// Extra byte so that we can write to the 24-bit buffer with overlapping 32-bit writes (efficiency)
 	float FloatBuffer[nQueueSizeFrames * nChannels];
-	s8 IntBuffer[nQueueSizeFrames * nBytesPerFrame + bI2S ? 0 : 1];
+
+	// Padded so that the converter can use full-width vector stores
+	u8 IntBuffer[nQueueSizeFrames * nBytesPerFrame + CSampleConverter::OutputPadding];
+
+	// Render-ahead mode; offset of the next frame to be written from the current converted block
+	size_t nBlockOffset = nQueueSizeFrames;
 
 	while (m_bRunning)
 	{
-		const size_t nFrames = nQueueSizeFrames - m_pSound->GetQueueFramesAvail();
-		const size_t nWriteBytes = nFrames * nBytesPerFrame;
+		const size_t nFramesAvail = m_pSound->GetQueueFramesAvail();
+		size_t nFrames;
+		const u8* pWriteData;
 
-		m_pCurrentSynth->Render(FloatBuffer, nFrames);
-
-		if (bReversedStereo)
+		if (m_pRenderAheadQueue)
 		{
-			// Convert to signed 24-bit integers with channel swap
-			for (size_t i = 0; i < nFrames * nChannels; i += nChannels)
+			// Synthesis runs on core 3, so help it out from here
+			m_RenderHelper.Poll();
+
+			// Fetch the next block from the render core once the current one has been written
+			if (nBlockOffset == nQueueSizeFrames)
 			{
-				s32* const pLeftSample = reinterpret_cast<s32*>(IntBuffer + i * nBytesPerSample);
-				s32* const pRightSample = reinterpret_cast<s32*>(IntBuffer + (i + 1) * nBytesPerSample);
-				*pLeftSample = FloatBuffer[i + 1] * Sample24BitMax;
-				*pRightSample = FloatBuffer[i] * Sample24BitMax;
+				const float* pBlock = m_pRenderAheadQueue->GetReadBlock();
+				if (!pBlock)
+					continue;
+
+				Converter.Convert(pBlock, IntBuffer, nQueueSizeFrames);
+				m_pRenderAheadQueue->ReleaseReadBlock();
+				nBlockOffset = 0;
 			}
+
+			// Output queue is full; don't take the sound driver's lock just to write nothing
+			nFrames = Utility::Min(nQueueSizeFrames - nFramesAvail, nQueueSizeFrames - nBlockOffset);
+			if (nFrames == 0)
+				continue;
+
+			pWriteData = IntBuffer + nBlockOffset * nBytesPerFrame;
+			nBlockOffset += nFrames;
 		}
 		else
 		{
+			// Keep the output queue filled up to the latency controller's target
+			const size_t nTargetFrames = m_pLatencyController->GetTargetFrames();
+			if (nFramesAvail >= nTargetFrames)
+				continue;
+
+			nFrames = nTargetFrames - nFramesAvail;
+			pWriteData = IntBuffer;
+
+			const unsigned int nRenderStart = CTimer::GetClockTicks();
+			m_pCurrentSynth->Render(FloatBuffer, nFrames);
+			m_pLatencyController->RecordBlock(CTimer::GetClockTicks() - nRenderStart, nFramesAvail);
+
 			// Convert to signed 24-bit integers
-			for (size_t i = 0; i < nFrames * nChannels; ++i)
-			{
-				s32* const pSample = reinterpret_cast<s32*>(IntBuffer + i * nBytesPerSample);
-				*pSample = FloatBuffer[i] * Sample24BitMax;
-			}
+			Converter.Convert(FloatBuffer, IntBuffer, nFrames);
 		}
 
-		const int nResult = m_pSound->Write(IntBuffer, nWriteBytes);
+		const size_t nWriteBytes = nFrames * nBytesPerFrame;
+		const int nResult = m_pSound->Write(pWriteData, nWriteBytes);
+
+		// Reported by the main task
 		if (nResult != static_cast<int>(nWriteBytes))
-			LOGERR("Sound data dropped");
+			m_pLatencyController->RecordXRun();
+	}
+}
+
+void CMT32Pi::RenderTask()
+{
+	// Without render-ahead, this core is only used to assist with parallel rendering
+	if (!m_pRenderAheadQueue)
+	{
+		if (!m_pConfig->FluidSynthParallelRender && !m_pSplitSynth)
+			return;
+
+		LOGNOTE("Render helper task on Core 3 starting up");
+
+		while (m_bRunning)
+			m_RenderHelper.Poll();
+
+		return;
+	}
+
+	LOGNOTE("Render task on Core 3 starting up");
+
+	const size_t nBlockFrames = m_pRenderAheadQueue->GetBlockFrames();
+
+	while (m_bRunning)
+	{
+		// Wait for the audio task to free up a block
+		float* pBlock = m_pRenderAheadQueue->GetWriteBlock();
+		if (!pBlock)
+			continue;
+
+		const unsigned int nRenderStart = CTimer::GetClockTicks();
+		m_pCurrentSynth->Render(pBlock, nBlockFrames);
+		m_pLatencyController->RecordRenderTime(CTimer::GetClockTicks() - nRenderStart);
+
+		m_pRenderAheadQueue->CommitWriteBlock();
 	}
 }
 
@@ -619,6 +820,9 @@ void CMT32Pi::Run(unsigned nCore)
 		case 2:
 			return AudioTask();
 
+		case 3:
+			return RenderTask();
+
 		default:
 			break;
 	}
@@ -650,8 +854,11 @@ void CMT32Pi::OnUnderVoltageDetected()
 	LCDLog(TLCDLogType::Warning, "Low voltage! Chk PSU");
 }
 
-void CMT32Pi::OnShortMessage(u32 nMessage)
+void CMT32Pi::OnShortMessage(u32 nMessage, u32 nTimestamp)
 {
+	if (m_pMIDIRecorder)
+		m_pMIDIRecorder->RecordShortMessage(nMessage, nTimestamp);
+
 	// Active sensing
 	if (nMessage == 0xFE)
 	{
@@ -663,20 +870,41 @@ void CMT32Pi::OnShortMessage(u32 nMessage)
 	if ((nMessage & 0xFF) < 0xF0)
 		LEDOn();
 
-	m_pCurrentSynth->HandleMIDIShortMessage(nMessage);
+	m_pCurrentSynth->HandleMIDIShortMessage(nMessage, nTimestamp);
 
 	// Wake from power saving mode if necessary
 	Awaken();
 }
 
-void CMT32Pi::OnSysExMessage(const u8* pData, size_t nSize)
+void CMT32Pi::OnSysExMessage(const u8* pData, size_t nSize, u32 nTimestamp)
 {
 	// Flash LED
 	LEDOn();
 
 	// If we don't consume the SysEx message, forward it to the synthesizer
+	// Custom SysEx messages aren't recorded, so that playing back a recording can't reboot the device
 	if (!ParseCustomSysEx(pData, nSize))
-		m_pCurrentSynth->HandleMIDISysExMessage(pData, nSize);
+	{
+		if (m_pMIDIRecorder)
+			m_pMIDIRecorder->RecordSysExMessage(pData, nSize, nTimestamp);
+
+		m_pCurrentSynth->HandleMIDISysExMessage(pData, nSize, nTimestamp);
+	}
+
+	// Wake from power saving mode if necessary
+	Awaken();
+}
+
+void CMT32Pi::OnSysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp)
+{
+	// Flash LED
+	LEDOn();
+
+	// Too large for any of our custom SysEx messages; always record and forward to the synthesizer
+	if (m_pMIDIRecorder)
+		m_pMIDIRecorder->RecordSysExFragment(pData, nSize, Fragment, nTimestamp);
+
+	m_pCurrentSynth->HandleMIDISysExFragment(pData, nSize, Fragment, nTimestamp);
 
 	// Wake from power saving mode if necessary
 	Awaken();
@@ -684,14 +912,12 @@ void CMT32Pi::OnSysExMessage(const u8* pData, size_t nSize)
 
 void CMT32Pi::OnUnexpectedStatus()
 {
-	CMIDIParser::OnUnexpectedStatus();
 	if (m_pConfig->SystemVerbose)
 		LCDLog(TLCDLogType::Warning, "Unexp. MIDI status!");
 }
 
 void CMT32Pi::OnSysExOverflow()
 {
-	CMIDIParser::OnSysExOverflow();
 	LCDLog(TLCDLogType::Error, "SysEx overflow!");
 }
 
@@ -713,29 +939,19 @@ void CMT32Pi::OnAppleMIDIDisconnect(const CIPAddress* pIPAddress, const char* pN
 
 bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 {
-	if (nSize < 4)
+	TCustomSysExCommand Command;
+	u8 nParameter;
+	if (!::ParseCustomSysEx(pData, nSize, Command, nParameter))
 		return false;
 
-	// 'Educational' manufacturer
-	if (pData[1] != 0x7D)
-		return false;
-
-	const auto Command = static_cast<TCustomSysExCommand>(pData[2]);
-
-	// Reboot (F0 7D 00 F7)
-	if (nSize == 4 && Command == TCustomSysExCommand::Reboot)
-	{
-		LOGNOTE("Reboot command received");
-		m_bRunning = false;
-		return true;
-	}
-
-	if (nSize != 5)
-		return false;
-
-	const u8 nParameter = pData[3];
 	switch (Command)
 	{
+		// Reboot (F0 7D 00 F7)
+		case TCustomSysExCommand::Reboot:
+			LOGNOTE("Reboot command received");
+			m_bRunning = false;
+			return true;
+
 		// Switch MT-32 ROM set (F0 7D 01 xx F7)
 		case TCustomSysExCommand::SwitchMT32ROMSet:
 		{
@@ -765,9 +981,42 @@ bool CMT32Pi::ParseCustomSysEx(const u8* pData, size_t nSize)
 			return true;
 		}
 
-		default:
-			return false;
+		// Start/stop MIDI recording (F0 7D 05 xx F7)
+		case TCustomSysExCommand::SetMIDIRecording:
+			SetMIDIRecording(nParameter);
+			return true;
 	}
+
+	return false;
+}
+
+void CMT32Pi::SetMIDIRecording(u8 nMode)
+{
+	if (!m_pMIDIRecorder)
+		return;
+
+	// 0 = stop, 1 = record to SD card, 2 = record to USB storage
+	if (nMode == 0)
+	{
+		if (m_pMIDIRecorder->IsRecording())
+		{
+			m_pMIDIRecorder->StopRecording();
+			LCDLog(TLCDLogType::Notice, "MIDI rec. stopped");
+		}
+		return;
+	}
+
+	if (nMode > 2 || m_pMIDIRecorder->IsRecording())
+		return;
+
+	if (nMode == 2 && !m_pUSBMassStorageDevice)
+	{
+		LCDLog(TLCDLogType::Error, "No USB storage!");
+		return;
+	}
+
+	if (m_pMIDIRecorder->StartRecording(nMode == 1 ? "SD:" : "USB:"))
+		LCDLog(TLCDLogType::Notice, "MIDI rec. started");
 }
 
 void CMT32Pi::UpdateUSB(bool bStartup)
@@ -798,7 +1047,7 @@ void CMT32Pi::UpdateUSB(bool bStartup)
 
 				LCDLog(TLCDLogType::Spinner, "SoundFont rescan");
 				if (m_pSoundFontSynth)
-					m_pSoundFontSynth->GetSoundFontManager().ScanSoundFonts();
+					m_pSoundFontSynth->RescanSoundFonts();
 				else
 					InitSoundFontSynth();
 
@@ -818,7 +1067,7 @@ void CMT32Pi::UpdateUSB(bool bStartup)
 		if (m_pSoundFontSynth)
 		{
 			LCDLog(TLCDLogType::Spinner, "SoundFont rescan");
-			m_pSoundFontSynth->GetSoundFontManager().ScanSoundFonts();
+			m_pSoundFontSynth->RescanSoundFonts();
 			LCDLog(TLCDLogType::Notice, "%d SoundFonts avail", m_pSoundFontSynth->GetSoundFontManager().GetSoundFontCount());
 		}
 	}
@@ -916,22 +1165,31 @@ void CMT32Pi::UpdateMIDI()
 	u8 Buffer[MIDIRxBufferSize];
 
 	// Read MIDI messages from serial device or ring buffer
-	if (m_bSerialMIDIEnabled)
-		nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer));
-	else if (m_pUSBSerialDevice)
+	if (m_bSerialMIDIEnabled || m_pUSBSerialDevice)
 	{
-		const int nResult = m_pUSBSerialDevice->Read(Buffer, sizeof(Buffer));
-		nBytes = nResult > 0 ? static_cast<size_t>(nResult) : 0;
+		TMIDISource Source;
+		if (m_bSerialMIDIEnabled)
+		{
+			nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer));
+			Source = TMIDISource::SerialGPIO;
+		}
+		else
+		{
+			const int nResult = m_pUSBSerialDevice->Read(Buffer, sizeof(Buffer));
+			nBytes = nResult > 0 ? static_cast<size_t>(nResult) : 0;
+			Source = TMIDISource::USBSerial;
+		}
+
+		// Polled devices are timestamped when read
+		if (nBytes)
+			ParseMIDIBytes(Source, Buffer, nBytes, CTimer::GetClockTicks());
 	}
 	else
-		nBytes = m_MIDIRxBuffer.Dequeue(Buffer, sizeof(Buffer));
+		nBytes = ProcessBufferedMIDI();
 
 	if (nBytes == 0)
 		return;
 
-	// Process MIDI messages
-	ParseMIDIBytes(Buffer, nBytes);
-
 	// Reset the Active Sense timer
 	s_pThis->m_nActiveSenseTime = s_pThis->m_pTimer->GetTicks();
 }
@@ -943,13 +1201,50 @@ void CMT32Pi::PurgeMIDIBuffers()
 
 	// Process MIDI messages from all devices/ring buffers, but ignore note-ons
 	while (m_bSerialMIDIEnabled && (nBytes = ReceiveSerialMIDI(Buffer, sizeof(Buffer))) > 0)
-		ParseMIDIBytes(Buffer, nBytes, true);
+		ParseMIDIBytes(TMIDISource::SerialGPIO, Buffer, nBytes, CTimer::GetClockTicks(), true);
 
 	while (m_pUSBSerialDevice && (nBytes = m_pUSBSerialDevice->Read(Buffer, sizeof(Buffer))) > 0)
-		ParseMIDIBytes(Buffer, nBytes, true);
+		ParseMIDIBytes(TMIDISource::USBSerial, Buffer, nBytes, CTimer::GetClockTicks(), true);
+
+	while (ProcessBufferedMIDI(true) > 0)
+		;
+}
+
+void CMT32Pi::ParseMIDIBytes(TMIDISource Source, const u8* pData, size_t nSize, u32 nTimestamp, bool bIgnoreNoteOns, u8 nCable)
+{
+	assert(nCable == 0 || Source == TMIDISource::USBMIDI);
+	assert(nCable < USBMIDICableCount);
+
+	// Only the parser's state is per-source; completed messages all go to the same handlers
+	m_MIDIParsers[static_cast<size_t>(Source) + nCable].ParseMIDIBytes(pData, nSize, nTimestamp, bIgnoreNoteOns);
+}
 
-	while ((nBytes = m_MIDIRxBuffer.Dequeue(Buffer, sizeof(Buffer))) > 0)
-		ParseMIDIBytes(Buffer, nBytes, true);
+size_t CMT32Pi::ProcessBufferedMIDI(bool bIgnoreNoteOns)
+{
+	u8 Buffer[MIDIRxBufferSize];
+	TMIDIRxPacket Packet;
+	size_t nPackets = 0;
+
+	// The interrupt handler enqueues any data before its packet, so all of its bytes are available
+	while (m_MIDIRxPackets.Dequeue(Packet))
+	{
+		++nPackets;
+
+		// Already decoded; skip the parser
+		if (Packet.bShortMessage)
+		{
+			const bool bIsNoteOn = (Packet.nData & 0xF0) == 0x90;
+			if (!(bIsNoteOn && bIgnoreNoteOns))
+				OnShortMessage(Packet.nData, Packet.nTimestamp);
+			continue;
+		}
+
+		// Parse with the parser for its input and the time it was received by the interrupt handler
+		const size_t nBytes = m_MIDIRxBuffer.Dequeue(Buffer, Packet.nData);
+		ParseMIDIBytes(Packet.Source, Buffer, nBytes, Packet.nTimestamp, bIgnoreNoteOns, Packet.nCable);
+	}
+
+	return nPackets;
 }
 
 size_t CMT32Pi::ReceiveSerialMIDI(u8* pOutData, size_t nSize)
@@ -1123,6 +1418,8 @@ void CMT32Pi::SwitchSynth(TSynth NewSynth)
 		pNewSynth = m_pMT32Synth;
 	else if (NewSynth == TSynth::SoundFont)
 		pNewSynth = m_pSoundFontSynth;
+	else if (NewSynth == TSynth::Split)
+		pNewSynth = m_pSplitSynth;
 
 	if (pNewSynth == nullptr)
 	{
@@ -1138,7 +1435,7 @@ void CMT32Pi::SwitchSynth(TSynth NewSynth)
 
 	m_pCurrentSynth->AllSoundOff();
 	m_pCurrentSynth = pNewSynth;
-	const char* pMode = NewSynth == TSynth::MT32 ? "MT-32 mode" : "SoundFont mode";
+	const char* pMode = NewSynth == TSynth::MT32 ? "MT-32 mode" : NewSynth == TSynth::SoundFont ? "SoundFont mode" : "Split mode";
 	LOGNOTE("Switching to %s", pMode);
 	LCDLog(TLCDLogType::Notice, pMode);
 }
@@ -1275,15 +1572,41 @@ void CMT32Pi::USBMIDIDeviceRemovedHandler(CDevice* pDevice, void* pContext)
 // The following handlers are called from interrupt context, enqueue into ring buffer for main thread
 void CMT32Pi::USBMIDIPacketHandler(unsigned nCable, u8* pPacket, unsigned nLength)
 {
-	IRQMIDIReceiveHandler(pPacket, nLength);
+	IRQMIDIReceive(TMIDISource::USBMIDI, nCable, pPacket, nLength);
 }
 
-void CMT32Pi::IRQMIDIReceiveHandler(const u8* pData, size_t nSize)
+void CMT32Pi::PisoundMIDIReceiveHandler(const u8* pData, size_t nSize)
+{
+	IRQMIDIReceive(TMIDISource::Pisound, 0, pData, nSize);
+}
+
+void CMT32Pi::IRQMIDIReceive(TMIDISource Source, u8 nCable, const u8* pData, size_t nSize)
 {
 	assert(s_pThis != nullptr);
 
-	// Enqueue data into ring buffer
-	if (s_pThis->m_MIDIRxBuffer.Enqueue(pData, nSize) != nSize)
+	const u32 nTimestamp = CTimer::GetClockTicks();
+	size_t nEnqueued = 0;
+
+	// USB-MIDI event packets usually carry exactly one complete message; enqueue it ready-made
+	if (Source == TMIDISource::USBMIDI && CMIDIParser::IsCompleteShortMessage(pData, nSize))
+	{
+		u32 nMessage = 0;
+		for (size_t i = 0; i < nSize; ++i)
+			nMessage |= pData[i] << 8 * i;
+
+		if (s_pThis->m_MIDIRxPackets.Enqueue(TMIDIRxPacket{Source, nCable, true, nTimestamp, nMessage}))
+			nEnqueued = nSize;
+	}
+
+	// Otherwise enqueue data into ring buffer, followed by its arrival time; make sure there's room for the latter first
+	else if (s_pThis->m_MIDIRxPackets.GetFreeSpace() > 0)
+	{
+		nEnqueued = s_pThis->m_MIDIRxBuffer.Enqueue(pData, nSize);
+		if (nEnqueued > 0)
+			s_pThis->m_MIDIRxPackets.Enqueue(TMIDIRxPacket{Source, nCable, false, nTimestamp, static_cast<u32>(nEnqueued)});
+	}
+
+	if (nEnqueued != nSize)
 	{
 		static const char* pErrorString = "MIDI overrun error!";
 		LOGWARN(pErrorString);
@@ -34,6 +34,12 @@ LOGMODULE("soundfontmanager");
 const char* const Disks[] = { "SD", "USB" };
 const char SoundFontDirectory[] = "soundfonts";
 
+// SoundFont index files, stored in each SoundFont directory
+const char IndexFileName[] = ".index";
+const char TempIndexFileName[] = ".index.tmp";
+constexpr u16 IndexVersion = 1;
+constexpr size_t MaxIndexFileSize = 256 * 1024;
+
 // Four-character codes used throughout SoundFont RIFF structure
 constexpr u32 FourCC(const char pFourCC[4])
 {
@@ -43,8 +49,14 @@ constexpr u32 FourCC(const char pFourCC[4])
 constexpr u32 FourCCINAM = FourCC("INAM");
 constexpr u32 FourCCINFO = FourCC("INFO");
 constexpr u32 FourCCLIST = FourCC("LIST");
+constexpr u32 FourCCPDTA = FourCC("pdta");
+constexpr u32 FourCCPHDR = FourCC("phdr");
 constexpr u32 FourCCRIFF = FourCC("RIFF");
 constexpr u32 FourCCSFBK = FourCC("sfbk");
+constexpr u32 FourCCSFIX = FourCC("SFIX");
+
+// Size of a preset header record in the phdr chunk
+constexpr u32 PresetHeaderSize = 38;
 
 struct TSoundFontChunk
 {
@@ -53,6 +65,29 @@ struct TSoundFontChunk
 }
 PACKED;
 
+struct TSoundFontIndexHeader
+{
+	u32 nMagic;
+	u16 nVersion;
+	u16 nEntries;
+}
+PACKED;
+
+// Followed by the file name and SoundFont name (not null-terminated)
+struct TSoundFontIndexRecord
+{
+	u64 nFileSize;
+	u16 nFileDate;
+	u16 nFileTime;
+	u16 nPresets;
+	u16 nFlags;
+	u16 nFileNameLength;
+	u16 nNameLength;
+}
+PACKED;
+
+constexpr u16 IndexFlagSoundFont = 1 << 0;
+
 CSoundFontManager::CSoundFontManager()
 	: m_nSoundFonts(0)
 {
@@ -66,32 +101,13 @@ bool CSoundFontManager::ScanSoundFonts()
 
 	m_nSoundFonts = 0;
 
-	DIR Dir;
-	FILINFO FileInfo;
-	FRESULT Result;
 	CString DirectoryPath;
 
 	// Loop over each disk
 	for (auto pDisk : Disks)
 	{
 		DirectoryPath.Format("%s:%s", pDisk, SoundFontDirectory);
-		Result = f_findfirst(&Dir, &FileInfo, DirectoryPath, "*");
-
-		// Loop over each file in the directory
-		while (Result == FR_OK && *FileInfo.fname && m_nSoundFonts < MaxSoundFonts)
-		{
-			// Ensure not directory, hidden, or system file
-			if (!(FileInfo.fattrib & (AM_DIR | AM_HID | AM_SYS)))
-			{
-				// Assemble path
-				CString SoundFontPath;
-				SoundFontPath.Format("%s/%s", static_cast<const char*>(DirectoryPath), FileInfo.fname);
-
-				CheckSoundFont(SoundFontPath, FileInfo.fname);
-			}
-
-			Result = f_findnext(&Dir, &FileInfo);
-		}
+		ScanDirectory(DirectoryPath);
 	}
 
 	if (m_nSoundFonts > 0)
@@ -101,7 +117,10 @@ bool CSoundFontManager::ScanSoundFonts()
 
 		LOGNOTE("%d SoundFonts found:", m_nSoundFonts);
 		for (size_t i = 0; i < m_nSoundFonts; ++i)
-			LOGNOTE("%d: %s (%s)", i, static_cast<const char*>(m_SoundFontList[i].Path), static_cast<const char*>(m_SoundFontList[i].Name));
+		{
+			const TSoundFontListEntry& Entry = m_SoundFontList[i];
+			LOGNOTE("%d: %s (%s, %d presets%s)", i, static_cast<const char*>(Entry.Path), static_cast<const char*>(Entry.Name), Entry.nPresets, Entry.bHasFXProfile ? ", effects profile" : "");
+		}
 
 		return true;
 	}
@@ -109,6 +128,118 @@ bool CSoundFontManager::ScanSoundFonts()
 	return false;
 }
 
+void CSoundFontManager::ScanDirectory(const char* pDirectoryPath)
+{
+	DIR Dir;
+	FILINFO FileInfo;
+	FRESULT Result = f_findfirst(&Dir, &FileInfo, pDirectoryPath, "*");
+
+	// Disk not present or no SoundFont directory
+	if (Result != FR_OK)
+		return;
+
+	TSoundFontIndexEntry* pOldEntries = nullptr;
+	const size_t nOldEntries = LoadIndex(pDirectoryPath, pOldEntries);
+
+	TSoundFontIndexEntry* const pNewEntries = new TSoundFontIndexEntry[MaxIndexEntries];
+	size_t nNewEntries = 0;
+	size_t nOtherEntries = 0;
+	size_t nFiles = 0;
+	size_t nProbed = 0;
+	size_t nSearchStart = 0;
+	bool bIndexChanged = false;
+	bool bComplete = true;
+
+	// Loop over each file in the directory
+	while (Result == FR_OK && *FileInfo.fname)
+	{
+		// Only SoundFonts count towards the limit, so other files can't hide them
+		if (m_nSoundFonts == MaxSoundFonts)
+		{
+			bComplete = false;
+			break;
+		}
+
+		// Ensure not directory, hidden, or system file
+		const bool bIndexFile = !strcasecmp(FileInfo.fname, IndexFileName) || !strcasecmp(FileInfo.fname, TempIndexFileName);
+		if (!(FileInfo.fattrib & (AM_DIR | AM_HID | AM_SYS)) && !bIndexFile)
+		{
+			// Assemble path
+			CString SoundFontPath;
+			SoundFontPath.Format("%s/%s", pDirectoryPath, FileInfo.fname);
+
+			// Look for an unchanged entry in the index; directory order rarely changes, so start after the previous match
+			TSoundFontIndexEntry Entry;
+			bool bFound = false;
+			++nFiles;
+
+			for (size_t i = 0; i < nOldEntries && !bFound; ++i)
+			{
+				const size_t nIndex = (nSearchStart + i) % nOldEntries;
+				const TSoundFontIndexEntry& OldEntry = pOldEntries[nIndex];
+
+				if (OldEntry.nFileSize == FileInfo.fsize && OldEntry.nFileDate == FileInfo.fdate && OldEntry.nFileTime == FileInfo.ftime && !strcmp(OldEntry.FileName, FileInfo.fname))
+				{
+					Entry = OldEntry;
+					nSearchStart = nIndex + 1;
+					bFound = true;
+				}
+			}
+
+			// New or modified file
+			if (!bFound)
+			{
+				Entry.FileName = FileInfo.fname;
+				Entry.nFileSize = FileInfo.fsize;
+				Entry.nFileDate = FileInfo.fdate;
+				Entry.nFileTime = FileInfo.ftime;
+				Entry.bSoundFont = ProbeSoundFont(SoundFontPath, Entry);
+				++nProbed;
+			}
+
+			// There is always room for the SoundFonts; other files are indexed in the space left over, or probed again
+			// on the next scan
+			if (Entry.bSoundFont || nOtherEntries < MaxIndexEntries - MaxSoundFonts)
+			{
+				pNewEntries[nNewEntries++] = Entry;
+				bIndexChanged |= !bFound;
+
+				if (!Entry.bSoundFont)
+					++nOtherEntries;
+			}
+
+			if (Entry.bSoundFont)
+			{
+				TSoundFontListEntry& ListEntry = m_SoundFontList[m_nSoundFonts++];
+				ListEntry.Path = SoundFontPath;
+				ListEntry.nPresets = Entry.nPresets;
+
+				// If we got a name, use it, otherwise fall back on filename
+				ListEntry.Name = Entry.Name.GetLength() ? Entry.Name : Entry.FileName;
+
+				// Effects profiles can be edited independently of the SoundFont, so always check for them
+				CString FXProfilePath;
+				FILINFO FXProfileInfo;
+				GetFXProfilePath(SoundFontPath, FXProfilePath);
+				ListEntry.bHasFXProfile = f_stat(FXProfilePath, &FXProfileInfo) == FR_OK;
+			}
+		}
+
+		Result = f_findnext(&Dir, &FileInfo);
+	}
+
+	f_closedir(&Dir);
+
+	LOGDBG("%s: %d files, %d probed", pDirectoryPath, nFiles, nProbed);
+
+	// Only rewrite the index if files were added, modified or removed
+	if (bComplete && (bIndexChanged || nNewEntries != nOldEntries))
+		SaveIndex(pDirectoryPath, pNewEntries, nNewEntries);
+
+	delete[] pNewEntries;
+	delete[] pOldEntries;
+}
+
 const char* CSoundFontManager::GetSoundFontPath(size_t nIndex) const
 {
 	// Return the path if in-range
@@ -132,24 +263,14 @@ TFXProfile CSoundFontManager::GetSoundFontFXProfile(size_t nIndex) const
 {
 	TFXProfile FXProfile;
 
-	const char* const pSoundFontPath = GetSoundFontPath(nIndex);
-	if (!pSoundFontPath)
+	if (nIndex >= m_nSoundFonts || !m_SoundFontList[nIndex].bHasFXProfile)
 		return FXProfile;
 
-	// +5 bytes in case we need to add an extension (4 chars + null terminator)
-	const size_t nPathLength = strlen(pSoundFontPath) + 5;
-	char PathBuffer[nPathLength];
-	strcpy(PathBuffer, pSoundFontPath);
-
-	// Replace file extension if present
-	char* const pExtension = strrchr(PathBuffer, '.');
-	if (pExtension)
-		strcpy(pExtension, ".cfg");
-	else
-		strcat(PathBuffer, ".cfg");
+	CString FXProfilePath;
+	GetFXProfilePath(m_SoundFontList[nIndex].Path, FXProfilePath);
 
 	FIL File;
-	if (f_open(&File, PathBuffer, FA_READ) != FR_OK)
+	if (f_open(&File, FXProfilePath, FA_READ) != FR_OK)
 		return FXProfile;
 
 	// +1 byte for null terminator
@@ -180,46 +301,64 @@ const char* CSoundFontManager::GetFirstValidSoundFontPath() const
 	return m_nSoundFonts > 0 ? static_cast<const char*>(m_SoundFontList[0].Path) : nullptr;
 }
 
-void CSoundFontManager::CheckSoundFont(const char* pFullPath, const char* pFileName)
+void CSoundFontManager::GetFXProfilePath(const char* pSoundFontPath, CString& FXProfilePath)
+{
+	// Replace file extension if present
+	const char* const pExtension = strrchr(pSoundFontPath, '.');
+	const size_t nBaseLength = pExtension ? static_cast<size_t>(pExtension - pSoundFontPath) : strlen(pSoundFontPath);
+
+	char PathBuffer[nBaseLength + 1];
+	memcpy(PathBuffer, pSoundFontPath, nBaseLength);
+	PathBuffer[nBaseLength] = '\0';
+
+	FXProfilePath.Format("%s.cfg", PathBuffer);
+}
+
+bool CSoundFontManager::ProbeSoundFont(const char* pFullPath, TSoundFontIndexEntry& Entry)
 {
 	FIL File;
 	UINT nBytesRead;
 	TSoundFontChunk Chunk;
 	u32 nFourCC;
-	u32 nInfoListChunkSize;
-	char Name[MaxSoundFontNameLength];
+	char Name[MaxSoundFontNameLength + 1];
 
 	// Init with null terminator
 	Name[0] = '\0';
+	Entry.Name = "";
+	Entry.nPresets = 0;
 
 	// Try to open file
 	if (f_open(&File, pFullPath, FA_READ) != FR_OK)
-		return;
+		return false;
 
 #define CHECK_CHUNK_ID(EXPECTED_CHUNK_ID)                                                                \
 	if (f_read(&File, &Chunk, sizeof(Chunk), &nBytesRead) != FR_OK || Chunk.FourCC != EXPECTED_CHUNK_ID) \
 	{                                                                                                    \
 		f_close(&File);                                                                                  \
-		return;                                                                                          \
+		return false;                                                                                    \
 	}
 
 #define CHECK_FORM_ID(EXPECTED_FORM_ID)                                                                \
 	if (f_read(&File, &nFourCC, sizeof(nFourCC), &nBytesRead) != FR_OK || nFourCC != EXPECTED_FORM_ID) \
 	{                                                                                                  \
 		f_close(&File);                                                                                \
-		return;                                                                                        \
+		return false;                                                                                  \
 	}
 
 	CHECK_CHUNK_ID(FourCCRIFF);
 	CHECK_FORM_ID(FourCCSFBK);
 	CHECK_CHUNK_ID(FourCCLIST);
+
+	// The sdta and pdta lists follow the info list
+	const FSIZE_t nInfoListEnd = f_tell(&File) + Chunk.Size;
+
 	CHECK_FORM_ID(FourCCINFO);
 
 	#undef CHECK_CHUNK_ID
 	#undef CHECK_FORM_ID
 
 	// Loop over info list chunks and look for name chunk
-	nInfoListChunkSize = Chunk.Size;
+	const u32 nInfoListChunkSize = Chunk.Size;
 	size_t nTotalBytesRead = 4;
 
 	while (nTotalBytesRead < nInfoListChunkSize && f_read(&File, &Chunk, sizeof(Chunk), &nBytesRead) == FR_OK)
@@ -229,8 +368,8 @@ void CSoundFontManager::CheckSoundFont(const char* pFullPath, const char* pFileN
 		// Extract name
 		if (Chunk.FourCC == FourCCINAM)
 		{
-			if (Chunk.Size <= sizeof(Name))
-				f_read(&File, Name, Chunk.Size, &nBytesRead);
+			if (Chunk.Size <= MaxSoundFontNameLength && f_read(&File, Name, Chunk.Size, &nBytesRead) == FR_OK)
+				Name[nBytesRead] = '\0';
 
 			break;
 		}
@@ -242,17 +381,163 @@ void CSoundFontManager::CheckSoundFont(const char* pFullPath, const char* pFileN
 		nTotalBytesRead += Chunk.Size;
 	}
 
+	Entry.Name = Name;
+
+	// Skip over the sample data list to count the presets in the preset headers; the last record is a terminator
+	if (f_lseek(&File, nInfoListEnd) == FR_OK &&
+	    f_read(&File, &Chunk, sizeof(Chunk), &nBytesRead) == FR_OK && Chunk.FourCC == FourCCLIST &&
+	    f_lseek(&File, f_tell(&File) + Chunk.Size) == FR_OK &&
+	    f_read(&File, &Chunk, sizeof(Chunk), &nBytesRead) == FR_OK && Chunk.FourCC == FourCCLIST &&
+	    f_read(&File, &nFourCC, sizeof(nFourCC), &nBytesRead) == FR_OK && nFourCC == FourCCPDTA &&
+	    f_read(&File, &Chunk, sizeof(Chunk), &nBytesRead) == FR_OK && Chunk.FourCC == FourCCPHDR &&
+	    Chunk.Size >= PresetHeaderSize)
+		Entry.nPresets = Utility::Min<u32>(Chunk.Size / PresetHeaderSize - 1, 0xFFFF);
+
 	// Clean up
 	f_close(&File);
 
-	TSoundFontListEntry& Entry = m_SoundFontList[m_nSoundFonts++];
-	Entry.Path = pFullPath;
+	return true;
+}
+
+size_t CSoundFontManager::LoadIndex(const char* pDirectoryPath, TSoundFontIndexEntry*& pEntries)
+{
+	CString IndexPath;
+	IndexPath.Format("%s/%s", pDirectoryPath, IndexFileName);
+
+	pEntries = nullptr;
+
+	FIL File;
+	if (f_open(&File, IndexPath, FA_READ) != FR_OK)
+		return 0;
+
+	const FSIZE_t nFileSize = f_size(&File);
+	if (nFileSize < sizeof(TSoundFontIndexHeader) || nFileSize > MaxIndexFileSize)
+	{
+		f_close(&File);
+		return 0;
+	}
+
+	u8* const pBuffer = new u8[nFileSize];
+	UINT nRead;
+	const bool bRead = f_read(&File, pBuffer, nFileSize, &nRead) == FR_OK && nRead == nFileSize;
+	f_close(&File);
+
+	TSoundFontIndexHeader Header;
+	memcpy(&Header, pBuffer, sizeof(Header));
+
+	if (!bRead || Header.nMagic != FourCCSFIX || Header.nVersion != IndexVersion || Header.nEntries > MaxIndexEntries)
+	{
+		LOGWARN("Ignoring invalid SoundFont index %s", static_cast<const char*>(IndexPath));
+		delete[] pBuffer;
+		return 0;
+	}
+
+	pEntries = new TSoundFontIndexEntry[Header.nEntries];
+
+	size_t nEntries = 0;
+	size_t nOffset = sizeof(Header);
+
+	while (nEntries < Header.nEntries && nOffset + sizeof(TSoundFontIndexRecord) <= nFileSize)
+	{
+		TSoundFontIndexRecord Record;
+		memcpy(&Record, pBuffer + nOffset, sizeof(Record));
+		nOffset += sizeof(Record);
+
+		if (Record.nFileNameLength > FF_LFN_BUF || Record.nNameLength > MaxSoundFontNameLength || nOffset + Record.nFileNameLength + Record.nNameLength > nFileSize)
+			break;
+
+		// Large enough for either string plus a null terminator
+		char String[(FF_LFN_BUF > MaxSoundFontNameLength ? FF_LFN_BUF : MaxSoundFontNameLength) + 1];
+		TSoundFontIndexEntry& Entry = pEntries[nEntries++];
+
+		memcpy(String, pBuffer + nOffset, Record.nFileNameLength);
+		String[Record.nFileNameLength] = '\0';
+		Entry.FileName = String;
+		nOffset += Record.nFileNameLength;
+
+		memcpy(String, pBuffer + nOffset, Record.nNameLength);
+		String[Record.nNameLength] = '\0';
+		Entry.Name = String;
+		nOffset += Record.nNameLength;
+
+		Entry.nFileSize  = Record.nFileSize;
+		Entry.nFileDate  = Record.nFileDate;
+		Entry.nFileTime  = Record.nFileTime;
+		Entry.nPresets   = Record.nPresets;
+		Entry.bSoundFont = Record.nFlags & IndexFlagSoundFont;
+	}
+
+	delete[] pBuffer;
+	return nEntries;
+}
+
+bool CSoundFontManager::SaveIndex(const char* pDirectoryPath, const TSoundFontIndexEntry* pEntries, size_t nEntries)
+{
+	CString IndexPath, TempIndexPath;
+	IndexPath.Format("%s/%s", pDirectoryPath, IndexFileName);
+	TempIndexPath.Format("%s/%s", pDirectoryPath, TempIndexFileName);
+
+	size_t nFileSize = sizeof(TSoundFontIndexHeader);
+	for (size_t i = 0; i < nEntries; ++i)
+		nFileSize += sizeof(TSoundFontIndexRecord) + pEntries[i].FileName.GetLength() + pEntries[i].Name.GetLength();
+
+	if (nFileSize > MaxIndexFileSize)
+		return false;
+
+	u8* const pBuffer = new u8[nFileSize];
+
+	const TSoundFontIndexHeader Header = { FourCCSFIX, IndexVersion, static_cast<u16>(nEntries) };
+	memcpy(pBuffer, &Header, sizeof(Header));
+	size_t nOffset = sizeof(Header);
+
+	for (size_t i = 0; i < nEntries; ++i)
+	{
+		const TSoundFontIndexEntry& Entry = pEntries[i];
+		const TSoundFontIndexRecord Record =
+		{
+			Entry.nFileSize,
+			Entry.nFileDate,
+			Entry.nFileTime,
+			Entry.nPresets,
+			static_cast<u16>(Entry.bSoundFont ? IndexFlagSoundFont : 0),
+			static_cast<u16>(Entry.FileName.GetLength()),
+			static_cast<u16>(Entry.Name.GetLength()),
+		};
+
+		memcpy(pBuffer + nOffset, &Record, sizeof(Record));
+		nOffset += sizeof(Record);
+		memcpy(pBuffer + nOffset, static_cast<const char*>(Entry.FileName), Record.nFileNameLength);
+		nOffset += Record.nFileNameLength;
+		memcpy(pBuffer + nOffset, static_cast<const char*>(Entry.Name), Record.nNameLength);
+		nOffset += Record.nNameLength;
+	}
+
+	// Write to a temporary file and then replace the old index, so that a partially-written index is never read
+	FIL File;
+	UINT nWritten;
+	bool bResult = f_open(&File, TempIndexPath, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK;
+	if (bResult)
+	{
+		bResult = f_write(&File, pBuffer, nFileSize, &nWritten) == FR_OK && nWritten == nFileSize;
+		bResult = f_close(&File) == FR_OK && bResult;
+	}
+
+	delete[] pBuffer;
+
+	if (bResult)
+	{
+		const FRESULT Result = f_unlink(IndexPath);
+		bResult = (Result == FR_OK || Result == FR_NO_FILE) && f_rename(TempIndexPath, IndexPath) == FR_OK;
+	}
+
+	// Read-only or write-protected media is fine; we'll just probe again next time
+	if (!bResult)
+	{
+		LOGDBG("Couldn't write SoundFont index %s", static_cast<const char*>(IndexPath));
+		f_unlink(TempIndexPath);
+	}
 
-	// If we got a name, use it, otherwise fall back on filename
-	if (Name[0] != '\0')
-		Entry.Name = Name;
-	else
-		Entry.Name = pFileName;
+	return bResult;
 }
 
 inline bool CSoundFontManager::SoundFontListComparator(const TSoundFontListEntry& EntryA, const TSoundFontListEntry& EntryB)
@@ -26,6 +26,7 @@
 #include "config.h"
 #include "lcd/ui.h"
 #include "synth/mt32synth.h"
+#include "synth/rolandsysex.h"
 #include "utility.h"
 
 LOGMODULE("mt32synth");
@@ -55,7 +56,14 @@ CMT32Synth::CMT32Synth(unsigned nSampleRate, float nGain, float nReverbGain, TRe
 	  m_pControlROMImage(nullptr),
 	  m_pPCMROMImage(nullptr),
 
-	  m_LCDTextBuffer{'\0'}
+	  m_LCDTextBuffer{'\0'},
+
+	  m_bSysExStreamActive(false),
+	  m_nSysExStreamDeviceID(0),
+	  m_nSysExStreamAddress(0),
+	  m_nSysExStreamChecksum(0),
+	  m_nSysExStreamLength(0),
+	  m_SysExStreamData{0}
 {
 }
 
@@ -120,24 +128,132 @@ bool CMT32Synth::Initialize()
 	return true;
 }
 
-void CMT32Synth::HandleMIDIShortMessage(u32 nMessage)
+void CMT32Synth::HandleMIDIShortMessage(u32 nMessage, u32 nTimestamp)
 {
-	m_pSynth->playMsg(nMessage);
+	// Passed to mt32emu by the render core
+	m_MIDIEventQueue.EnqueueShortMessage(nMessage, nTimestamp);
 
 	// Update MIDI monitor
-	CSynthBase::HandleMIDIShortMessage(nMessage);
+	CSynthBase::HandleMIDIShortMessage(nMessage, nTimestamp);
 }
 
-void CMT32Synth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
+void CMT32Synth::HandleMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp)
 {
-	m_pSynth->playSysex(pData, nSize);
+	m_MIDIEventQueue.EnqueueSysEx(pData, nSize, nTimestamp);
+}
+
+void CMT32Synth::HandleMIDISysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp)
+{
+	if (Fragment == TSysExFragment::Begin)
+	{
+		const auto& Header = reinterpret_cast<const TRolandSysExHeader&>(pData[1]);
+		const size_t nHeaderSize = sizeof(TRolandSysExHeader) + 1;
+
+		// Only data sets can be split up
+		m_bSysExStreamActive = nSize >= nHeaderSize &&
+				       Header.ManufacturerID == TManufacturerID::Roland &&
+				       Header.ModelID == TRolandModelID::MT32 &&
+				       Header.CommandID == TRolandCommandID::DT1;
+
+		if (!m_bSysExStreamActive)
+		{
+			LOGWARN("Ignoring large SysEx message that isn't an MT-32 data set");
+			return;
+		}
+
+		m_nSysExStreamDeviceID = Header.DeviceID;
+		m_nSysExStreamAddress = Header.Address[0] << 14 | Header.Address[1] << 7 | Header.Address[2];
+		m_nSysExStreamChecksum = Header.Address[0] + Header.Address[1] + Header.Address[2];
+		m_nSysExStreamLength = 0;
+
+		pData += nHeaderSize;
+		nSize -= nHeaderSize;
+	}
+	else if (!m_bSysExStreamActive)
+		return;
+	else if (Fragment == TSysExFragment::Abort)
+	{
+		LOGWARN("Streamed SysEx data set was interrupted; only partially applied");
+		m_bSysExStreamActive = false;
+		return;
+	}
+
+	// Drop EOX
+	if (Fragment == TSysExFragment::End)
+		--nSize;
+
+	for (size_t i = 0; i < nSize; ++i)
+	{
+		if (m_nSysExStreamLength == sizeof(m_SysExStreamData))
+			SendSysExStreamChunk(SysExStreamChunkSize, nTimestamp);
+
+		m_SysExStreamData[m_nSysExStreamLength++] = pData[i];
+		m_nSysExStreamChecksum += pData[i];
+	}
+
+	if (Fragment == TSysExFragment::End)
+	{
+		// Send everything except the checksum
+		if (m_nSysExStreamLength > 1)
+			SendSysExStreamChunk(m_nSysExStreamLength - 1, nTimestamp);
+
+		// The data has already been applied, so all we can do is complain
+		if (m_nSysExStreamChecksum & 0x7F)
+			LOGWARN("Checksum error in streamed SysEx data set");
+
+		m_bSysExStreamActive = false;
+	}
+}
+
+void CMT32Synth::SendSysExStreamChunk(size_t nSize, u32 nTimestamp)
+{
+	assert(nSize <= SysExStreamChunkSize && m_nSysExStreamLength - nSize <= 1);
+
+	// Re-frame as a data set of its own, with the address and checksum adjusted
+	u8 Message[sizeof(TRolandSysExHeader) + SysExStreamChunkSize + 3];
+	const u8 Address[] = {
+		static_cast<u8>((m_nSysExStreamAddress >> 14) & 0x7F),
+		static_cast<u8>((m_nSysExStreamAddress >> 7) & 0x7F),
+		static_cast<u8>(m_nSysExStreamAddress & 0x7F)
+	};
+
+	size_t nLength = 0;
+	Message[nLength++] = 0xF0;
+	Message[nLength++] = TManufacturerID::Roland;
+	Message[nLength++] = m_nSysExStreamDeviceID;
+	Message[nLength++] = TRolandModelID::MT32;
+	Message[nLength++] = TRolandCommandID::DT1;
+
+	u8 nChecksum = 0;
+	for (u8 nByte : Address)
+	{
+		Message[nLength++] = nByte;
+		nChecksum += nByte;
+	}
+
+	for (size_t i = 0; i < nSize; ++i)
+	{
+		Message[nLength++] = m_SysExStreamData[i];
+		nChecksum += m_SysExStreamData[i];
+	}
+
+	Message[nLength++] = (128 - (nChecksum & 0x7F)) & 0x7F;
+	Message[nLength++] = 0xF7;
+
+	m_MIDIEventQueue.EnqueueSysEx(Message, nLength, nTimestamp);
+
+	// Addresses are 7 bits per byte, so they can be advanced as a single 21-bit number
+	m_nSysExStreamAddress = (m_nSysExStreamAddress + nSize) & 0x1FFFFF;
+
+	// Keep the held-back byte
+	m_nSysExStreamLength -= nSize;
+	if (m_nSysExStreamLength)
+		m_SysExStreamData[0] = m_SysExStreamData[nSize];
 }
 
 void CMT32Synth::AllSoundOff()
 {
-	// Stop all sound immediately; mt32emu treats CC 0x7C like "All Sound Off", ignoring pedal
-	for (uint8_t i = 0; i < 8; ++i)
-		m_pSynth->playMsgOnPart(i, 0x0B, 0x7C, 0);
+	m_MIDIEventQueue.EnqueueCommand(TMIDIEvent::TType::AllSoundOff);
 
 	// Reset MIDI monitor
 	CSynthBase::AllSoundOff();
@@ -145,13 +261,12 @@ void CMT32Synth::AllSoundOff()
 
 void CMT32Synth::SetMasterVolume(u8 nVolume)
 {
-	const u8 SetVolumeSysEx[] = { 0x10, 0x00, 0x16, nVolume };
-	m_pSynth->writeSysex(0x10, SetVolumeSysEx, sizeof(SetVolumeSysEx));
+	m_MIDIEventQueue.EnqueueCommand(TMIDIEvent::TType::SetMasterVolume, nVolume);
 }
 
 size_t CMT32Synth::Render(s16* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
+	BeginRender(nFrames);
 	if (m_pSampleRateConverter)
 		m_pSampleRateConverter->getOutputSamples(pOutBuffer, nFrames);
 	else
@@ -163,7 +278,7 @@ size_t CMT32Synth::Render(s16* pOutBuffer, size_t nFrames)
 
 size_t CMT32Synth::Render(float* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
+	BeginRender(nFrames);
 	if (m_pSampleRateConverter)
 		m_pSampleRateConverter->getOutputSamples(pOutBuffer, nFrames);
 	else
@@ -173,6 +288,57 @@ size_t CMT32Synth::Render(float* pOutBuffer, size_t nFrames)
 	return nFrames;
 }
 
+void CMT32Synth::BeginRender(size_t nFrames)
+{
+	const unsigned int nLockStart = CTimer::GetClockTicks();
+	m_Lock.Acquire();
+	m_MIDIEventQueue.RecordLockWait(CTimer::GetClockTicks() - nLockStart);
+
+	m_MIDIEventQueue.BeginBlock(m_nSampleRate);
+
+	// mt32emu timestamps are in samples at the synth's internal sample rate
+	const u32 nRenderedSamples = m_pSynth->getInternalRenderedSampleCount();
+	const u32 nInternalSampleRate = m_pSynth->getStereoOutputSampleRate();
+	const u32 nTicks = CTimer::GetClockTicks();
+	size_t nFrame;
+	TMIDIEvent Event;
+
+	// Queue all events due during this block; mt32emu splits rendering at their timestamps
+	while ((nFrame = m_MIDIEventQueue.GetNextEventFrame(nFrames)) < nFrames)
+	{
+		m_MIDIEventQueue.Dequeue(Event, nTicks);
+		const u32 nTimestamp = nRenderedSamples + static_cast<u64>(nFrame) * nInternalSampleRate / m_nSampleRate;
+
+		switch (Event.Type)
+		{
+			case TMIDIEvent::TType::ShortMessage:
+				m_pSynth->playMsg(Event.nData, nTimestamp);
+				break;
+
+			case TMIDIEvent::TType::SysEx:
+				m_pSynth->playSysex(Event.pSysExData, Event.nData, nTimestamp);
+				break;
+
+			case TMIDIEvent::TType::AllSoundOff:
+				// Stop all sound immediately; mt32emu treats CC 0x7C like "All Sound Off", ignoring pedal
+				for (uint8_t i = 0; i < 8; ++i)
+					m_pSynth->playMsgOnPart(i, 0x0B, 0x7C, 0);
+				break;
+
+			case TMIDIEvent::TType::SetMasterVolume:
+			{
+				const u8 SetVolumeSysEx[] = { 0x10, 0x00, 0x16, static_cast<u8>(Event.nData) };
+				m_pSynth->writeSysex(0x10, SetVolumeSysEx, sizeof(SetVolumeSysEx));
+				break;
+			}
+
+			// Only queued by the SoundFont synth
+			case TMIDIEvent::TType::SwapSoundFont:
+				break;
+		}
+	}
+}
+
 void CMT32Synth::ReportStatus() const
 {
 	if (m_pUI)
@@ -309,6 +475,22 @@ u8 CMT32Synth::GetMasterVolume() const
 	return nVolume;
 }
 
+u32 CMT32Synth::GetActivePartialCount() const
+{
+	const u32 nPartials = m_pSynth->getPartialCount();
+	MT32Emu::PartialState PartialStates[nPartials];
+	m_pSynth->getPartialStates(PartialStates);
+
+	u32 nActivePartials = 0;
+	for (u32 i = 0; i < nPartials; ++i)
+	{
+		if (PartialStates[i] != MT32Emu::PartialState_INACTIVE)
+			++nActivePartials;
+	}
+
+	return nActivePartials;
+}
+
 void CMT32Synth::GetPartLevels(unsigned int nTicks, float PartLevels[9], float PartPeaks[9])
 {
 	float ChannelLevels[16], ChannelPeaks[16];
@@ -0,0 +1,284 @@
+//
+// presetcache.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+
+#include "synth/presetcache.h"
+#include "utility.h"
+#include "zoneallocator.h"
+
+LOGMODULE("presetcache");
+
+constexpr int CPresetCache::DrumBank;
+
+// Program 0 of these banks is selected by FluidSynth whenever channels are reset
+constexpr int DefaultBanks[] = { 0, CPresetCache::DrumBank };
+
+CPresetCache::CPresetCache(size_t nMemoryLimit)
+	: m_pSynth(nullptr),
+	  m_pSecondarySynth(nullptr),
+	  m_SoundFont{},
+	  m_nMemoryLimit(nMemoryLimit),
+	  m_nUsedMemory(0),
+
+	  m_Entries{},
+	  m_nEntries(0),
+	  m_nUseCounter(0),
+
+	  m_ChannelEntries{}
+{
+	ResetChannels();
+}
+
+void CPresetCache::SetSoundFont(fluid_synth_t* pSynth, fluid_synth_t* pSecondarySynth, const TSoundFont& SoundFont)
+{
+	// The previous SoundFont's presets must have been unpinned with UnpinAll()
+	m_pSynth = pSynth;
+	m_pSecondarySynth = pSecondarySynth;
+	m_SoundFont = SoundFont;
+	m_nEntries = 0;
+	m_nUsedMemory = 0;
+	ResetChannels();
+}
+
+void CPresetCache::UnpinAll()
+{
+	if (m_SoundFont.pPrimary)
+	{
+		for (size_t i = 0; i < m_nEntries; ++i)
+			UnpinPreset(m_Entries[i].nBank, m_Entries[i].nProgram);
+	}
+
+	m_nEntries = 0;
+	m_nUsedMemory = 0;
+	ResetChannels();
+}
+
+void CPresetCache::ResetChannels()
+{
+	// After a reset every channel is back on a default preset, which is always loaded
+	for (int& nEntry : m_ChannelEntries)
+		nEntry = NoEntry;
+}
+
+bool CPresetCache::Lookup(u8 nChannel, bool bDrums, int& nBank, int& nProgram)
+{
+	if (!m_SoundFont.pPrimary || !ResolvePreset(bDrums, nBank, nProgram))
+	{
+		m_ChannelEntries[nChannel] = NoEntry;
+		return true;
+	}
+
+	// Pinned when the SoundFont was loaded
+	if (nProgram == 0 && (nBank == 0 || nBank == DrumBank))
+	{
+		m_ChannelEntries[nChannel] = NoEntry;
+		return true;
+	}
+
+	const int nEntry = FindEntry(nBank, nProgram);
+	if (nEntry == NoEntry)
+		return false;
+
+	m_Entries[nEntry].nLastUsed = ++m_nUseCounter;
+	m_ChannelEntries[nChannel] = nEntry;
+	return true;
+}
+
+bool CPresetCache::Pin(u8 nChannel, int nBank, int nProgram)
+{
+	CZoneAllocator* pAllocator = CZoneAllocator::Get();
+
+	// The channel's previous preset may now be evicted
+	m_ChannelEntries[nChannel] = NoEntry;
+
+	// At most one entry per channel is protected, so there is always one to evict
+	if (m_nEntries == MaxEntries)
+		EvictLeastRecentlyUsed();
+
+	size_t nUsedBefore = pAllocator->GetUsedSize();
+	while (!PinPreset(nBank, nProgram))
+	{
+		// Most likely out of memory; make room and try again
+		if (!EvictLeastRecentlyUsed())
+		{
+			LOGWARN("Couldn't load samples for bank %d program %d", nBank, nProgram);
+			return false;
+		}
+
+		nUsedBefore = pAllocator->GetUsedSize();
+	}
+
+	// Samples shared with presets that are already loaded don't count towards this one
+	const size_t nUsedAfter = pAllocator->GetUsedSize();
+	TEntry& Entry = m_Entries[m_nEntries];
+	Entry.nBank = nBank;
+	Entry.nProgram = nProgram;
+	Entry.nSize = nUsedAfter > nUsedBefore ? nUsedAfter - nUsedBefore : 0;
+	Entry.nLastUsed = ++m_nUseCounter;
+
+	m_ChannelEntries[nChannel] = m_nEntries++;
+	m_nUsedMemory += Entry.nSize;
+
+	LOGDBG("Loaded bank %d program %d (%d KB, %d KB in use)", nBank, nProgram, Entry.nSize / 1024, m_nUsedMemory / 1024);
+
+	while (m_nMemoryLimit && m_nUsedMemory > m_nMemoryLimit)
+	{
+		if (!EvictLeastRecentlyUsed())
+			break;
+	}
+
+	return true;
+}
+
+bool CPresetCache::PinDefaultPresets(fluid_synth_t* pSynth, int nSoundFontID)
+{
+	// Channel resets happen on the render core, so these must always be loaded
+	fluid_sfont_t* pSoundFont = fluid_synth_get_sfont_by_id(pSynth, nSoundFontID);
+
+	for (int nBank : DefaultBanks)
+	{
+		if (fluid_sfont_get_preset(pSoundFont, nBank, 0) && fluid_synth_pin_preset(pSynth, nSoundFontID, nBank, 0) != FLUID_OK)
+			return false;
+	}
+
+	return true;
+}
+
+void CPresetCache::UnpinDefaultPresets(fluid_synth_t* pSynth, int nSoundFontID)
+{
+	// Fails harmlessly for presets that don't exist
+	for (int nBank : DefaultBanks)
+		fluid_synth_unpin_preset(pSynth, nSoundFontID, nBank, 0);
+}
+
+bool CPresetCache::ResolvePreset(bool bDrums, int& nBank, int& nProgram) const
+{
+	// Same fallbacks as fluid_synth_program_change()
+	if (bDrums)
+	{
+		nBank = DrumBank;
+		if (fluid_sfont_get_preset(m_SoundFont.pPrimary, nBank, nProgram))
+			return true;
+
+		nProgram = 0;
+		return fluid_sfont_get_preset(m_SoundFont.pPrimary, nBank, nProgram) != nullptr;
+	}
+
+	if (fluid_sfont_get_preset(m_SoundFont.pPrimary, nBank, nProgram))
+		return true;
+
+	nBank = 0;
+	if (fluid_sfont_get_preset(m_SoundFont.pPrimary, nBank, nProgram))
+		return true;
+
+	nProgram = 0;
+	return fluid_sfont_get_preset(m_SoundFont.pPrimary, nBank, nProgram) != nullptr;
+}
+
+bool CPresetCache::PinPreset(int nBank, int nProgram)
+{
+	if (fluid_synth_pin_preset(m_pSynth, fluid_sfont_get_id(m_SoundFont.pPrimary), nBank, nProgram) != FLUID_OK)
+		return false;
+
+	// The secondary instance finds the samples just loaded for the primary in FluidSynth's sample cache
+	if (m_SoundFont.pSecondary && fluid_synth_pin_preset(m_pSecondarySynth, fluid_sfont_get_id(m_SoundFont.pSecondary), nBank, nProgram) != FLUID_OK)
+	{
+		fluid_synth_unpin_preset(m_pSynth, fluid_sfont_get_id(m_SoundFont.pPrimary), nBank, nProgram);
+		return false;
+	}
+
+	return true;
+}
+
+void CPresetCache::UnpinPreset(int nBank, int nProgram)
+{
+	fluid_synth_unpin_preset(m_pSynth, fluid_sfont_get_id(m_SoundFont.pPrimary), nBank, nProgram);
+	if (m_SoundFont.pSecondary)
+		fluid_synth_unpin_preset(m_pSecondarySynth, fluid_sfont_get_id(m_SoundFont.pSecondary), nBank, nProgram);
+}
+
+int CPresetCache::FindEntry(int nBank, int nProgram) const
+{
+	for (size_t i = 0; i < m_nEntries; ++i)
+	{
+		if (m_Entries[i].nBank == nBank && m_Entries[i].nProgram == nProgram)
+			return i;
+	}
+
+	return NoEntry;
+}
+
+bool CPresetCache::IsSelected(int nEntry) const
+{
+	for (int nChannelEntry : m_ChannelEntries)
+	{
+		if (nChannelEntry == nEntry)
+			return true;
+	}
+
+	return false;
+}
+
+bool CPresetCache::EvictLeastRecentlyUsed()
+{
+	int nOldest = NoEntry;
+
+	for (size_t i = 0; i < m_nEntries; ++i)
+	{
+		if (IsSelected(i))
+			continue;
+
+		if (nOldest == NoEntry || m_Entries[i].nLastUsed < m_Entries[nOldest].nLastUsed)
+			nOldest = i;
+	}
+
+	if (nOldest == NoEntry)
+		return false;
+
+	// Samples still playing on released voices are freed by FluidSynth once they finish
+	const TEntry& Entry = m_Entries[nOldest];
+	LOGDBG("Unloading bank %d program %d", Entry.nBank, Entry.nProgram);
+	UnpinPreset(Entry.nBank, Entry.nProgram);
+	RemoveEntry(nOldest);
+
+	return true;
+}
+
+void CPresetCache::RemoveEntry(int nEntry)
+{
+	m_nUsedMemory -= Utility::Min(m_Entries[nEntry].nSize, m_nUsedMemory);
+
+	// Move the last entry into the gap
+	const int nLast = m_nEntries - 1;
+	if (nEntry != nLast)
+	{
+		m_Entries[nEntry] = m_Entries[nLast];
+		for (int& nChannelEntry : m_ChannelEntries)
+		{
+			if (nChannelEntry == nLast)
+				nChannelEntry = nEntry;
+		}
+	}
+
+	--m_nEntries;
+}
@@ -0,0 +1,349 @@
+//
+// soundfontloader.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+#include <circle/sched/scheduler.h>
+#include <circle/timer.h>
+
+#include "synth/presetcache.h"
+#include "synth/soundfontloader.h"
+#include "utility.h"
+
+LOGMODULE("soundfontloader");
+
+constexpr unsigned int CSoundFontLoader::UnloadRetryMillis;
+
+CSoundFontLoader* CSoundFontLoader::s_pThis = nullptr;
+
+CSoundFontLoader::CSoundFontLoader()
+	: CTask(TASK_STACK_SIZE, true),
+
+	  m_pSettings(nullptr),
+	  m_pSynth(nullptr),
+	  m_pSynthLock(nullptr),
+	  m_pSynthLockOwner(nullptr),
+	  m_bSecondaryInstance(false),
+	  m_bDynamicSamples(false),
+	  m_bUnloadPending(false),
+	  m_nLastUnloadTime(0),
+
+	  m_bRequestPending(false),
+	  m_nRequestIndex(0),
+
+	  m_bLoading(false),
+	  m_bCancel(false),
+	  m_nLoadingIndex(0),
+	  m_nLastYieldTime(0),
+
+	  m_bResultReady(false),
+	  m_nResultIndex(0),
+	  m_ResultSoundFont{}
+{
+	s_pThis = this;
+}
+
+CSoundFontLoader::~CSoundFontLoader()
+{
+	if (m_pSynth)
+		delete_fluid_synth(m_pSynth);
+
+	if (m_pSettings)
+		delete_fluid_settings(m_pSettings);
+}
+
+bool CSoundFontLoader::Initialize(CSpinLock* pSynthLock, bool bSecondaryInstance, bool bDynamicSamples)
+{
+	m_pSynthLock = pSynthLock;
+	m_bSecondaryInstance = bSecondaryInstance;
+
+	m_pSettings = new_fluid_settings();
+	if (!m_pSettings)
+	{
+		LOGERR("Failed to create settings");
+		return false;
+	}
+
+	// Keep the synth as small as possible; it never plays anything
+	fluid_settings_setint(m_pSettings, "synth.polyphony", 1);
+	fluid_settings_setint(m_pSettings, "synth.threadsafe-api", false);
+
+	// Only sample headers are read at load time; samples are loaded when presets are pinned
+	m_bDynamicSamples = bDynamicSamples;
+	fluid_settings_setint(m_pSettings, "synth.dynamic-sample-loading", bDynamicSamples);
+
+	m_pSynth = new_fluid_synth(m_pSettings);
+	if (!m_pSynth)
+	{
+		LOGERR("Failed to create synth");
+		return false;
+	}
+
+	// We started as a suspended task; run now that initialization is successful
+	Start();
+
+	return true;
+}
+
+void CSoundFontLoader::Load(size_t nIndex, const char* pSoundFontPath)
+{
+	if (IsLoading(nIndex))
+		return;
+
+	// Abandon whatever we're loading now; this request replaces any other pending one
+	if (m_bLoading)
+		m_bCancel = true;
+
+	m_nRequestIndex = nIndex;
+	m_RequestPath = pSoundFontPath;
+	m_bRequestPending = true;
+}
+
+void CSoundFontLoader::Cancel()
+{
+	m_bRequestPending = false;
+	if (m_bLoading)
+		m_bCancel = true;
+}
+
+bool CSoundFontLoader::IsLoading(size_t nIndex) const
+{
+	if (m_bRequestPending)
+		return m_nRequestIndex == nIndex;
+
+	return m_bLoading && !m_bCancel && m_nLoadingIndex == nIndex;
+}
+
+bool CSoundFontLoader::TakeResult(size_t& nIndex, TSoundFont& SoundFont)
+{
+	if (!m_bResultReady)
+		return false;
+
+	nIndex = m_nResultIndex;
+	SoundFont = m_ResultSoundFont;
+	m_ResultSoundFont = TSoundFont{};
+	m_bResultReady = false;
+
+	return true;
+}
+
+bool CSoundFontLoader::LoadNow(const char* pSoundFontPath, TSoundFont& SoundFont)
+{
+	const unsigned int nLoadStart = CTimer::GetClockTicks();
+
+	if (!LoadSoundFont(pSoundFontPath, SoundFont))
+	{
+		LOGERR("Failed to load SoundFont");
+		return false;
+	}
+
+	const float nLoadTime = (CTimer::GetClockTicks() - nLoadStart) / 1000000.0f;
+	LOGNOTE("\"%s\" loaded in %0.2f seconds", pSoundFontPath, nLoadTime);
+
+	return true;
+}
+
+void CSoundFontLoader::FreeSoundFont(const TSoundFont& SoundFont)
+{
+	if (SoundFont.pSecondary)
+		FreeInstance(SoundFont.pSecondary);
+	if (SoundFont.pPrimary)
+		FreeInstance(SoundFont.pPrimary);
+}
+
+void CSoundFontLoader::FreeInstance(fluid_sfont_t* pSoundFont)
+{
+	// Unload it through our synth; if voices elsewhere are still playing its samples, FluidSynth keeps it until they finish
+	const int nID = fluid_synth_add_sfont(m_pSynth, pSoundFont);
+	if (nID == FLUID_FAILED)
+	{
+		LOGERR("Failed to unload SoundFont");
+		return;
+	}
+
+	LockSynth();
+
+	if (m_bDynamicSamples)
+		CPresetCache::UnpinDefaultPresets(m_pSynth, nID);
+
+	fluid_synth_sfunload(m_pSynth, nID, false);
+	m_bUnloadPending = fluid_synth_unload_pending_sfonts(m_pSynth) > 0;
+
+	UnlockSynth();
+
+	m_nLastUnloadTime = CTimer::GetClockTicks();
+}
+
+bool CSoundFontLoader::UnloadPendingSoundFonts()
+{
+	if (m_bUnloadPending)
+	{
+		LockSynth();
+		m_bUnloadPending = fluid_synth_unload_pending_sfonts(m_pSynth) > 0;
+		UnlockSynth();
+
+		m_nLastUnloadTime = CTimer::GetClockTicks();
+	}
+
+	return m_bUnloadPending;
+}
+
+void CSoundFontLoader::LockSynth()
+{
+	// Both tasks run on core 0 and storage reads can yield, so spinning on a lock held by the other task would never end
+	CScheduler* const pScheduler = CScheduler::Get();
+	while (m_pSynthLockOwner)
+		pScheduler->Yield();
+
+	m_pSynthLockOwner = pScheduler->GetCurrentTask();
+	m_pSynthLock->Acquire();
+}
+
+void CSoundFontLoader::UnlockSynth()
+{
+	m_pSynthLock->Release();
+	m_pSynthLockOwner = nullptr;
+}
+
+bool CSoundFontLoader::IsLoaderTask()
+{
+	return s_pThis && s_pThis->m_bLoading && CScheduler::Get()->GetCurrentTask() == s_pThis;
+}
+
+bool CSoundFontLoader::YieldIfDue()
+{
+	// Let the main task process MIDI; yielding on every read would slow loading down too much
+	// While we hold the synth lock the render core is stalled, so finish pinning first
+	const unsigned int nTicks = CTimer::GetClockTicks();
+	if (s_pThis->m_pSynthLockOwner != s_pThis && nTicks - s_pThis->m_nLastYieldTime >= YieldIntervalMicros)
+	{
+		CScheduler::Get()->Yield();
+		s_pThis->m_nLastYieldTime = CTimer::GetClockTicks();
+	}
+
+	// Abort the load if it's no longer wanted
+	return !s_pThis->m_bCancel;
+}
+
+void CSoundFontLoader::Run()
+{
+	CScheduler* const pScheduler = CScheduler::Get();
+
+	while (true)
+	{
+		// Wait for the previous result to be collected
+		if (m_bRequestPending && !m_bResultReady)
+		{
+			m_nLoadingIndex = m_nRequestIndex;
+			const CString SoundFontPath(m_RequestPath);
+			m_bRequestPending = false;
+			m_bCancel = false;
+			m_bLoading = true;
+
+			const unsigned int nLoadStart = CTimer::GetClockTicks();
+			m_nLastYieldTime = nLoadStart;
+
+			TSoundFont SoundFont;
+			const bool bLoaded = LoadSoundFont(SoundFontPath, SoundFont);
+
+			m_bLoading = false;
+
+			if (m_bCancel)
+			{
+				if (bLoaded)
+					FreeSoundFont(SoundFont);
+				m_bCancel = false;
+			}
+			else
+			{
+				if (bLoaded)
+				{
+					const float nLoadTime = (CTimer::GetClockTicks() - nLoadStart) / 1000000.0f;
+					LOGNOTE("\"%s\" loaded in the background in %0.2f seconds", static_cast<const char*>(SoundFontPath), nLoadTime);
+				}
+				else
+					LOGERR("Failed to load SoundFont in the background");
+
+				m_nResultIndex = m_nLoadingIndex;
+				m_ResultSoundFont = bLoaded ? SoundFont : TSoundFont{};
+				m_bResultReady = true;
+			}
+		}
+
+		// Retry unloading SoundFonts that were still being played when they were freed
+		if (m_bUnloadPending && CTimer::GetClockTicks() - m_nLastUnloadTime >= Utility::MillisToTicks(UnloadRetryMillis))
+			UnloadPendingSoundFonts();
+
+		pScheduler->MsSleep(PollIntervalMillis);
+	}
+}
+
+bool CSoundFontLoader::LoadSoundFont(const char* pSoundFontPath, TSoundFont& SoundFont)
+{
+	SoundFont = TSoundFont{};
+
+	SoundFont.pPrimary = LoadInstance(pSoundFontPath);
+	if (!SoundFont.pPrimary)
+		return false;
+
+	// Only the presets and sample headers are read again; the sample data is found in FluidSynth's sample cache
+	if (m_bSecondaryInstance)
+	{
+		SoundFont.pSecondary = LoadInstance(pSoundFontPath);
+		if (!SoundFont.pSecondary)
+		{
+			FreeInstance(SoundFont.pPrimary);
+			SoundFont.pPrimary = nullptr;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+fluid_sfont_t* CSoundFontLoader::LoadInstance(const char* pSoundFontPath)
+{
+	const int nID = fluid_synth_sfload(m_pSynth, pSoundFontPath, false);
+	if (nID == FLUID_FAILED)
+		return nullptr;
+
+	// The sample cache is shared with the synths, which unload samples from it when voices end
+	if (m_bDynamicSamples)
+	{
+		LockSynth();
+		const bool bPinned = CPresetCache::PinDefaultPresets(m_pSynth, nID);
+		if (!bPinned)
+			fluid_synth_sfunload(m_pSynth, nID, false);
+		UnlockSynth();
+
+		if (!bPinned)
+		{
+			LOGERR("Failed to load default preset samples");
+			return nullptr;
+		}
+	}
+
+	// Detach it again; it now belongs to whoever takes it
+	fluid_sfont_t* pSoundFont = fluid_synth_get_sfont_by_id(m_pSynth, nID);
+	fluid_synth_remove_sfont(m_pSynth, pSoundFont);
+
+	return pSoundFont;
+}
@@ -20,10 +20,16 @@
 // mt32-pi. If not, see <http://www.gnu.org/licenses/>.
 //
 
-#include <fatfs/ff.h>
+#include <algorithm>
+#include <cmath>
+
 #include <circle/logger.h>
+#include <circle/multicore.h>
 #include <circle/timer.h>
+#include <circle/util.h>
 
+#include "audio/mix.h"
+#include "bufferedfile.h"
 #include "config.h"
 #include "lcd/ui.h"
 #include "synth/gmsysex.h"
@@ -36,6 +42,15 @@
 LOGMODULE("soundfontsynth");
 const char SoundFontPath[] = "soundfonts";
 
+constexpr size_t CSoundFontSynth::ParallelRenderFrames;
+constexpr u32 CSoundFontSynth::GovernorRestoreMillis;
+constexpr unsigned int CSoundFontSynth::UnloadTimeoutMillis;
+constexpr unsigned int CSoundFontSynth::SwapTimeoutMillis;
+
+// Largest single read when loading in the background, so that the loader yields regularly even during sample data
+constexpr size_t BackgroundReadSize = 64 * 1024;
+static_assert(BackgroundReadSize >= CBufferedFile::DirectReadSize, "Background reads of sample data should bypass the read-ahead buffer");
+
 extern "C"
 {
 	// Replacements for fluid_sys.c functions
@@ -49,6 +64,7 @@ extern "C"
 		return CZoneAllocator::Get()->Realloc(ptr, len, TZoneTag::FluidSynth);
 	}
 
+	// FluidSynth also frees memory on the render cores, e.g. samples unloaded when the last voice playing them finishes
 	void fluid_free(void* ptr)
 	{
 		CZoneAllocator::Get()->Free(ptr);
@@ -69,10 +85,15 @@ extern "C"
 
 	// Replacements for fluid_sfont.c functions
 	// These were found to be much faster than FluidSynth's default approach of going through libc
+	// SoundFont parsing issues lots of tiny reads, so they go through a read-ahead buffer
 	void* default_fopen(const char* path)
 	{
-		FIL* pFile = new FIL;
-		if (f_open(pFile, path, FA_READ) != FR_OK)
+		// Storage can only be accessed from core 0; samples must have been loaded before the render core needs them
+		if (CMultiCoreSupport::ThisCore() != 0)
+			return nullptr;
+
+		CBufferedFile* pFile = new CBufferedFile;
+		if (!pFile->Open(path))
 		{
 			delete pFile;
 			pFile = nullptr;
@@ -83,49 +104,60 @@ extern "C"
 
 	int default_fclose(void* handle)
 	{
-		FIL* pFile = static_cast<FIL*>(handle);
-
-		if (f_close(pFile) == FR_OK)
-		{
-			delete pFile;
-			return FLUID_OK;
-		}
+		CBufferedFile* pFile = static_cast<CBufferedFile*>(handle);
+		const bool bResult = pFile->Close();
+		delete pFile;
 
-		return FLUID_FAILED;
+		return bResult ? FLUID_OK : FLUID_FAILED;
 	}
 
 	fluid_long_long_t default_ftell(void* handle)
 	{
-		FIL* pFile = static_cast<FIL*>(handle);
-		return f_tell(pFile);
+		CBufferedFile* pFile = static_cast<CBufferedFile*>(handle);
+		return pFile->Tell();
 	}
 
 	int safe_fread(void* buf, fluid_long_long_t count, void* fd)
 	{
-		FIL* pFile = static_cast<FIL*>(fd);
-		UINT nRead;
-		return f_read(pFile, buf, count, &nRead) == FR_OK ? FLUID_OK : FLUID_FAILED;
+		CBufferedFile* pFile = static_cast<CBufferedFile*>(fd);
+
+		if (!CSoundFontLoader::IsLoaderTask())
+			return pFile->Read(buf, count) ? FLUID_OK : FLUID_FAILED;
+
+		// Loading in the background; read in pieces and let other tasks run in between
+		u8* pBuffer = static_cast<u8*>(buf);
+		while (count > 0)
+		{
+			const size_t nSize = Utility::Min(count, static_cast<fluid_long_long_t>(BackgroundReadSize));
+			if (!pFile->Read(pBuffer, nSize) || !CSoundFontLoader::YieldIfDue())
+				return FLUID_FAILED;
+
+			pBuffer += nSize;
+			count -= nSize;
+		}
+
+		return FLUID_OK;
 	}
 
 	int safe_fseek(void* fd, fluid_long_long_t ofs, int whence)
 	{
-		FIL* pFile = static_cast<FIL*>(fd);
+		CBufferedFile* pFile = static_cast<CBufferedFile*>(fd);
 
 		switch (whence)
 		{
 		case SEEK_CUR:
-			ofs += f_tell(pFile);
+			ofs += pFile->Tell();
 			break;
 
 		case SEEK_END:
-			ofs += f_size(pFile);
+			ofs += pFile->GetSize();
 			break;
 
 		default:
 			break;
 		}
 
-		return f_lseek(pFile, ofs) == FR_OK ? FLUID_OK : FLUID_FAILED;
+		return ofs >= 0 && pFile->Seek(ofs) ? FLUID_OK : FLUID_FAILED;
 	}
 }
 
@@ -134,19 +166,68 @@ CSoundFontSynth::CSoundFontSynth(unsigned nSampleRate)
 
 	  m_pSettings(nullptr),
 	  m_pSynth(nullptr),
+	  m_SoundFont{},
+
+	  m_pSecondarySynth(nullptr),
+	  m_nSecondaryFrames(0),
+	  m_SecondaryBuffer{},
+
+	  m_nActiveVoices(0),
+
+	  m_bLoadGovernor(false),
+	  m_nRenderStartTime(0),
+	  m_nLowLoadStartTime(0),
+	  m_nShedVoices(0),
+	  m_nPolyphonyLimit(0),
+	  m_nMaxPolyphony(0),
+	  m_pVoiceList(nullptr),
+	  m_nVoiceListSize(0),
 
 	  m_nVolume(100),
 	  m_nInitialGain(0.2f),
 
 	  m_nPercussionMask(1 << 9),
-	  m_nCurrentSoundFontIndex(0)
+	  m_nCurrentSoundFontIndex(0),
+
+	  m_pPresetCache(nullptr),
+	  m_BankMSB{},
+
+	  m_nRepinChannelMask(0),
+	  m_RepinBanks{},
+	  m_RepinPrograms{},
+
+	  m_pLoader(nullptr),
+	  m_bSwitchPending(false),
+	  m_nPendingSoundFontIndex(0),
+	  m_bPreloadNeighbors(false),
+	  m_bPreloadFailed(false),
+	  m_Preloaded{},
+
+	  m_Swap{},
+	  m_SwapState(TSwapState::None),
+	  m_nSwapPrepareTime(0),
+
+	  m_bForegroundLoadPending(false),
+	  m_nForegroundLoadIndex(0),
+	  m_nUnloadStartTime(0),
+
+	  m_bSwitchDeferred(false),
+	  m_nDeferredSoundFontIndex(0),
+
+	  m_nCrossfadeMillis(0)
 {
 }
 
 CSoundFontSynth::~CSoundFontSynth()
 {
-	if (m_pSynth)
-		delete_fluid_synth(m_pSynth);
+	FreePreloaded(false);
+	DeleteSynths();
+
+	if (m_pPresetCache)
+		delete m_pPresetCache;
+
+	if (m_pVoiceList)
+		delete[] m_pVoiceList;
 
 	if (m_pSettings)
 		delete_fluid_settings(m_pSettings);
@@ -157,6 +238,54 @@ void CSoundFontSynth::FluidSynthLogCallback(int nLevel, const char* pMessage, vo
 	CLogger::Get()->Write(From, static_cast<TLogSeverity>(nLevel), pMessage);
 }
 
+void CSoundFontSynth::RenderSecondaryJob(void* pParam)
+{
+	CSoundFontSynth* pThis = static_cast<CSoundFontSynth*>(pParam);
+	float* pBuffer = pThis->m_SecondaryBuffer;
+	fluid_synth_write_float(pThis->m_pSecondarySynth, pThis->m_nSecondaryFrames, pBuffer, 0, 2, pBuffer, 1, 2);
+}
+
+void CSoundFontSynth::DispatchShortMessage(fluid_synth_t* pSynth, u8 nStatus, u8 nChannel, u8 nData1, u8 nData2)
+{
+	switch (nStatus & 0xF0)
+	{
+		// Note off
+		case 0x80:
+			fluid_synth_noteoff(pSynth, nChannel, nData1);
+			break;
+
+		// Note on
+		case 0x90:
+			fluid_synth_noteon(pSynth, nChannel, nData1, nData2);
+			break;
+
+		// Polyphonic key pressure/aftertouch
+		case 0xA0:
+			fluid_synth_key_pressure(pSynth, nChannel, nData1, nData2);
+			break;
+
+		// Control change
+		case 0xB0:
+			fluid_synth_cc(pSynth, nChannel, nData1, nData2);
+			break;
+
+		// Program change
+		case 0xC0:
+			fluid_synth_program_change(pSynth, nChannel, nData1);
+			break;
+
+		// Channel pressure/aftertouch
+		case 0xD0:
+			fluid_synth_channel_pressure(pSynth, nChannel, nData1);
+			break;
+
+		// Pitch bend
+		case 0xE0:
+			fluid_synth_pitch_bend(pSynth, nChannel, (nData2 << 7) | nData1);
+			break;
+	}
+}
+
 bool CSoundFontSynth::Initialize()
 {
 	const CConfig* const pConfig = CConfig::Get();
@@ -164,6 +293,13 @@ bool CSoundFontSynth::Initialize()
 	if (!m_SoundFontManager.ScanSoundFonts())
 		return false;
 
+	m_bLoadGovernor = pConfig->FluidSynthLoadGovernor;
+	m_nMaxPolyphony = pConfig->FluidSynthPolyphony;
+
+	// Used on the render core by the load governor and SoundFont switches; neither synth can have more voices than this
+	m_nVoiceListSize = Utility::Max(m_nMaxPolyphony, 1);
+	m_pVoiceList = new fluid_voice_t*[m_nVoiceListSize];
+
 	// Try to get preferred SoundFont
 	m_nCurrentSoundFontIndex = pConfig->FluidSynthSoundFont;
 	const char* pSoundFontPath = m_SoundFontManager.GetSoundFontPath(m_nCurrentSoundFontIndex);
@@ -179,8 +315,6 @@ bool CSoundFontSynth::Initialize()
 	if (!pSoundFontPath)
 		return false;
 
-	TFXProfile FXProfile = m_SoundFontManager.GetSoundFontFXProfile(m_nCurrentSoundFontIndex);
-
 	// Install logging handlers
 	fluid_set_log_function(FLUID_PANIC, FluidSynthLogCallback, this);
 	fluid_set_log_function(FLUID_ERR, FluidSynthLogCallback, this);
@@ -200,98 +334,74 @@ bool CSoundFontSynth::Initialize()
 	fluid_settings_setnum(m_pSettings, "synth.sample-rate", static_cast<double>(m_nSampleRate));
 	fluid_settings_setint(m_pSettings, "synth.threadsafe-api", false);
 
-	return Reinitialize(pSoundFontPath, &FXProfile);
-}
+	m_bPreloadNeighbors = pConfig->FluidSynthPreloadNeighbors;
+	m_nCrossfadeMillis = Utility::Clamp(pConfig->FluidSynthSwitchCrossfade, 0, static_cast<int>(MaxCrossfadeMillis));
 
-void CSoundFontSynth::HandleMIDIShortMessage(u32 nMessage)
-{
-	const u8 nStatus  = nMessage & 0xFF;
-	const u8 nChannel = nMessage & 0x0F;
-	const u8 nData1   = (nMessage >> 8) & 0xFF;
-	const u8 nData2   = (nMessage >> 16) & 0xFF;
+	// Only the samples of presets selected by program changes are loaded, so SoundFonts larger than memory can be used
+	if (pConfig->FluidSynthDynamicSamples)
+		m_pPresetCache = new CPresetCache(Utility::Max(pConfig->FluidSynthSampleMemory, 0) * MEGABYTE);
 
-	// Handle system real-time messages
-	if (nStatus == 0xFF)
-	{
-		m_Lock.Acquire();
-		fluid_synth_system_reset(m_pSynth);
-		m_Lock.Release();
-		return;
-	}
-
-	m_Lock.Acquire();
+	if (!CreateSynths())
+		return false;
 
-	// Handle channel messages
-	switch (nStatus & 0xF0)
+	// The loader needs to know whether to load a second instance of each SoundFont for the secondary synth
+	m_pLoader = new CSoundFontLoader();
+	if (!m_pLoader->Initialize(&m_Lock, m_pSecondarySynth != nullptr, m_pPresetCache != nullptr))
 	{
-		// Note off
-		case 0x80:
-			fluid_synth_noteoff(m_pSynth, nChannel, nData1);
-			break;
-
-		// Note on
-		case 0x90:
-			fluid_synth_noteon(m_pSynth, nChannel, nData1, nData2);
-			break;
+		LOGERR("Failed to start SoundFont loader");
+		delete m_pLoader;
+		m_pLoader = nullptr;
+		return false;
+	}
 
-		// Polyphonic key pressure/aftertouch
-		case 0xA0:
-			fluid_synth_key_pressure(m_pSynth, nChannel, nData1, nData2);
-			break;
+	// The first SoundFont is loaded synchronously; later switches are loaded in the background
+	TSoundFont SoundFont;
+	if (!m_pLoader->LoadNow(pSoundFontPath, SoundFont))
+		return false;
 
-		// Control change
-		case 0xB0:
-			fluid_synth_cc(m_pSynth, nChannel, nData1, nData2);
-			break;
+	// Nothing is rendering yet, so the swap can be applied here rather than on the render core
+	PrepareSwap(m_nCurrentSoundFontIndex, SoundFont);
+	SwapSoundFont();
+	FinishSwap();
 
-		// Program change
-		case 0xC0:
-			fluid_synth_program_change(m_pSynth, nChannel, nData1);
-			break;
+	return true;
+}
 
-		// Channel pressure/aftertouch
-		case 0xD0:
-			fluid_synth_channel_pressure(m_pSynth, nChannel, nData1);
-			break;
+void CSoundFontSynth::HandleMIDIShortMessage(u32 nMessage, u32 nTimestamp)
+{
+	// The samples have to be loaded here, before the render core selects the preset
+	if (m_pPresetCache)
+		PrepareProgramChange(nMessage);
 
-		// Pitch bend
-		case 0xE0:
-			fluid_synth_pitch_bend(m_pSynth, nChannel, (nData2 << 7) | nData1);
-			break;
-	}
+	// Applied to FluidSynth by the render core
+	m_MIDIEventQueue.EnqueueShortMessage(nMessage, nTimestamp);
 
-	m_Lock.Release();
+	// System reset doesn't affect the MIDI monitor
+	if ((nMessage & 0xFF) == 0xFF)
+		return;
 
 	// Update MIDI monitor
-	CSynthBase::HandleMIDIShortMessage(nMessage);
+	CSynthBase::HandleMIDIShortMessage(nMessage, nTimestamp);
 }
 
-void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize)
+void CSoundFontSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp)
 {
 	// Return early if it wasn't a GM Mode On/Off message and was consumed as a text/display dots message
 	if (!ParseGMSysEx(pData, nSize) && (ParseRolandSysEx(pData, nSize) || ParseYamahaSysEx(pData, nSize)))
 		return;
 
-	// No special handling; forward to FluidSynth SysEx parser, excluding leading 0xF0 and trailing 0xF7
-	m_Lock.Acquire();
-	fluid_synth_sysex(m_pSynth, reinterpret_cast<const char*>(pData + 1), nSize - 2, nullptr, nullptr, nullptr, false);
-	m_Lock.Release();
+	// No special handling; forward to FluidSynth SysEx parser
+	m_MIDIEventQueue.EnqueueSysEx(pData, nSize, nTimestamp);
 }
 
 bool CSoundFontSynth::IsActive()
 {
-	m_Lock.Acquire();
-	int nVoices = fluid_synth_get_active_voice_count(m_pSynth);
-	m_Lock.Release();
-
-	return nVoices > 0;
+	return m_nActiveVoices.load(std::memory_order_relaxed) > 0;
 }
 
 void CSoundFontSynth::AllSoundOff()
 {
-	m_Lock.Acquire();
-	fluid_synth_all_sounds_off(m_pSynth, -1);
-	m_Lock.Release();
+	m_MIDIEventQueue.EnqueueCommand(TMIDIEvent::TType::AllSoundOff);
 
 	// Reset MIDI monitor
 	CSynthBase::AllSoundOff();
@@ -300,27 +410,339 @@ void CSoundFontSynth::AllSoundOff()
 void CSoundFontSynth::SetMasterVolume(u8 nVolume)
 {
 	m_nVolume = nVolume;
+	m_MIDIEventQueue.EnqueueCommand(TMIDIEvent::TType::SetMasterVolume, nVolume);
+}
+
+bool CSoundFontSynth::SelectsPresets(const TMIDIEvent& Event)
+{
+	// SysEx messages may reset the channels (e.g. GS reset), and swaps change the SoundFonts presets are looked up in
+	if (Event.Type != TMIDIEvent::TType::ShortMessage)
+		return Event.Type == TMIDIEvent::TType::SysEx || Event.Type == TMIDIEvent::TType::SwapSoundFont;
+
+	// Program change or system reset; notes and controllers only use presets that are already selected
+	const u8 nStatus = Event.nData & 0xFF;
+	return (nStatus & 0xF0) == 0xC0 || nStatus == 0xFF;
+}
+
+size_t CSoundFontSynth::ProcessMIDIEvents(size_t nFrame, size_t nFrames, bool& bHoldPresetEvents)
+{
+	const u32 nTicks = CTimer::GetClockTicks();
+	size_t nNextFrame;
+	TMIDIEvent Event;
+
+	// Apply all events due at or before this frame
+	while ((nNextFrame = m_MIDIEventQueue.GetNextEventFrame(nFrames)) <= nFrame)
+	{
+		// Everything after a held event waits too, so that events are never reordered
+		if (bHoldPresetEvents && m_MIDIEventQueue.Peek(Event) && SelectsPresets(Event))
+			return nFrames;
+
+		m_MIDIEventQueue.Dequeue(Event, nTicks);
+
+		switch (Event.Type)
+		{
+			case TMIDIEvent::TType::ShortMessage:
+				ProcessShortMessage(Event.nData);
+				break;
+
+			case TMIDIEvent::TType::SysEx:
+			{
+				// Exclude leading 0xF0 and trailing 0xF7
+				const char* pData = reinterpret_cast<const char*>(Event.pSysExData + 1);
+				const int nSize = Event.nData - 2;
+
+				fluid_synth_sysex(m_pSynth, pData, nSize, nullptr, nullptr, nullptr, false);
+				if (m_pSecondarySynth)
+					fluid_synth_sysex(m_pSecondarySynth, pData, nSize, nullptr, nullptr, nullptr, false);
+				break;
+			}
+
+			case TMIDIEvent::TType::AllSoundOff:
+				fluid_synth_all_sounds_off(m_pSynth, -1);
+				if (m_pSecondarySynth)
+					fluid_synth_all_sounds_off(m_pSecondarySynth, -1);
+				break;
+
+			case TMIDIEvent::TType::SetMasterVolume:
+			{
+				const float nGain = Event.nData / 100.0f * m_nInitialGain;
+				fluid_synth_set_gain(m_pSynth, nGain);
+				if (m_pSecondarySynth)
+					fluid_synth_set_gain(m_pSecondarySynth, nGain);
+				break;
+			}
+
+			// Skipped if the main task applied it already; otherwise later events that may select presets are held until it
+			// has finished the swap
+			case TMIDIEvent::TType::SwapSoundFont:
+				if (m_SwapState.load(std::memory_order_acquire) == TSwapState::Queued)
+				{
+					SwapSoundFont();
+					bHoldPresetEvents = true;
+				}
+				break;
+		}
+	}
+
+	return nNextFrame;
+}
+
+void CSoundFontSynth::ProcessShortMessage(u32 nMessage)
+{
+	const u8 nStatus  = nMessage & 0xFF;
+	const u8 nChannel = nMessage & 0x0F;
+	const u8 nData1   = (nMessage >> 8) & 0xFF;
+	const u8 nData2   = (nMessage >> 16) & 0xFF;
+
+	// Handle system real-time messages
+	if (nStatus == 0xFF)
+	{
+		fluid_synth_system_reset(m_pSynth);
+		if (m_pSecondarySynth)
+			fluid_synth_system_reset(m_pSecondarySynth);
+		return;
+	}
+
+	// Handle channel messages
+	if (m_pSecondarySynth)
+	{
+		// New notes are started on only one of the synths; everything else keeps both channel states identical
+		if ((nStatus & 0xF0) == 0x90 && nData2 > 0)
+		{
+			fluid_synth_t* pSynth = GetNoteOnSynth(nChannel);
+			fluid_synth_t* pOtherSynth = pSynth == m_pSynth ? m_pSecondarySynth : m_pSynth;
+
+			// FluidSynth releases any voice already playing the same key on a note on; emulate this across synths
+			fluid_synth_noteoff(pOtherSynth, nChannel, nData1);
+			fluid_synth_noteon(pSynth, nChannel, nData1, nData2);
+		}
+		else
+		{
+			DispatchShortMessage(m_pSynth, nStatus, nChannel, nData1, nData2);
+			DispatchShortMessage(m_pSecondarySynth, nStatus, nChannel, nData1, nData2);
+		}
+	}
+	else
+		DispatchShortMessage(m_pSynth, nStatus, nChannel, nData1, nData2);
+}
+
+void CSoundFontSynth::BeginRender()
+{
+	// Also held by the main task and the SoundFont loader while they pin or unload samples
+	const unsigned int nLockStart = CTimer::GetClockTicks();
 	m_Lock.Acquire();
-	fluid_synth_set_gain(m_pSynth, m_nVolume / 100.0f * m_nInitialGain);
+	m_MIDIEventQueue.RecordLockWait(CTimer::GetClockTicks() - nLockStart);
+
+	m_MIDIEventQueue.BeginBlock(m_nSampleRate);
+	m_nRenderStartTime = CTimer::GetClockTicks();
+}
+
+void CSoundFontSynth::EndRender(size_t nFrames)
+{
+	if (m_bLoadGovernor)
+		UpdateLoadGovernor(CTimer::GetClockTicks() - m_nRenderStartTime, nFrames);
+
+	int nVoices = fluid_synth_get_active_voice_count(m_pSynth);
+	if (m_pSecondarySynth)
+		nVoices += fluid_synth_get_active_voice_count(m_pSecondarySynth);
+	m_nActiveVoices.store(nVoices, std::memory_order_relaxed);
+
 	m_Lock.Release();
 }
 
 size_t CSoundFontSynth::Render(float* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
-	assert(fluid_synth_write_float(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
-	m_Lock.Release();
+	BeginRender();
+
+	// Events that may select presets are held back until the main task has finished a SoundFont swap
+	bool bHoldPresetEvents = m_SwapState.load(std::memory_order_acquire) == TSwapState::Applied;
+
+	// Split the block at each MIDI event so that it's applied at the right frame
+	size_t nFrame = 0;
+	while (nFrame < nFrames)
+	{
+		const size_t nNextFrame = ProcessMIDIEvents(nFrame, nFrames, bHoldPresetEvents);
+		RenderFrames(pOutBuffer + nFrame * 2, nNextFrame - nFrame);
+		nFrame = nNextFrame;
+	}
+
+	EndRender(nFrames);
 	return nFrames;
 }
 
 size_t CSoundFontSynth::Render(s16* pOutBuffer, size_t nFrames)
 {
-	m_Lock.Acquire();
-	assert(fluid_synth_write_s16(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
-	m_Lock.Release();
+	BeginRender();
+
+	bool bHoldPresetEvents = m_SwapState.load(std::memory_order_acquire) == TSwapState::Applied;
+
+	size_t nFrame = 0;
+	while (nFrame < nFrames)
+	{
+		const size_t nNextFrame = ProcessMIDIEvents(nFrame, nFrames, bHoldPresetEvents);
+		RenderFrames(pOutBuffer + nFrame * 2, nNextFrame - nFrame);
+		nFrame = nNextFrame;
+	}
+
+	EndRender(nFrames);
 	return nFrames;
 }
 
+void CSoundFontSynth::RenderFrames(float* pOutBuffer, size_t nFrames)
+{
+	if (m_pSecondarySynth)
+	{
+		size_t nRemaining = nFrames;
+		float* pOut = pOutBuffer;
+
+		while (nRemaining)
+		{
+			const size_t nChunkFrames = Utility::Min(nRemaining, ParallelRenderFrames);
+
+			// Render the secondary synth on the helper core while we render the primary
+			m_nSecondaryFrames = nChunkFrames;
+			const bool bSubmitted = m_pRenderHelper->Submit(RenderSecondaryJob, this);
+			fluid_synth_write_float(m_pSynth, nChunkFrames, pOut, 0, 2, pOut, 1, 2);
+
+			// Helper is busy (we're probably running on it); render sequentially
+			if (bSubmitted)
+				m_pRenderHelper->Wait();
+			else
+				RenderSecondaryJob(this);
+
+			// Sum partial mixes
+			Audio::Mix(pOut, 1.0f, m_SecondaryBuffer, 1.0f, nChunkFrames * 2);
+
+			pOut += nChunkFrames * 2;
+			nRemaining -= nChunkFrames;
+		}
+	}
+	else
+		assert(fluid_synth_write_float(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
+}
+
+void CSoundFontSynth::RenderFrames(s16* pOutBuffer, size_t nFrames)
+{
+	assert(fluid_synth_write_s16(m_pSynth, nFrames, pOutBuffer, 0, 2, pOutBuffer, 1, 2) == FLUID_OK);
+
+	// Parallel rendering is only implemented for float output; render the secondary synth here and mix it in
+	if (m_pSecondarySynth)
+	{
+		s16* pSecondaryBuffer = reinterpret_cast<s16*>(m_SecondaryBuffer);
+		size_t nRemaining = nFrames;
+		s16* pOut = pOutBuffer;
+
+		while (nRemaining)
+		{
+			const size_t nChunkFrames = Utility::Min(nRemaining, ParallelRenderFrames);
+			fluid_synth_write_s16(m_pSecondarySynth, nChunkFrames, pSecondaryBuffer, 0, 2, pSecondaryBuffer, 1, 2);
+
+			for (size_t i = 0; i < nChunkFrames * 2; ++i)
+				pOut[i] = Utility::Clamp(pOut[i] + pSecondaryBuffer[i], -32768, 32767);
+
+			pOut += nChunkFrames * 2;
+			nRemaining -= nChunkFrames;
+		}
+	}
+}
+
+void CSoundFontSynth::UpdateLoadGovernor(u32 nRenderTime, size_t nFrames)
+{
+	const u32 nTicks = CTimer::GetClockTicks();
+	const u32 nBlockTime = static_cast<u64>(nFrames) * 1000000 / m_nSampleRate;
+	const int nPolyphonyLimit = m_nPolyphonyLimit.load(std::memory_order_relaxed);
+
+	// Close to missing the deadline; shed voices
+	if (nRenderTime * 100 > nBlockTime * GovernorHighLoadPercent)
+	{
+		m_nLowLoadStartTime = nTicks;
+
+		// Fade out released voices first
+		const size_t nShedTarget = Utility::Max(static_cast<size_t>(m_nActiveVoices.load(std::memory_order_relaxed) / 8), static_cast<size_t>(1));
+		size_t nShed = ShedReleasedVoices(m_pSynth, nShedTarget);
+		if (m_pSecondarySynth && nShed < nShedTarget)
+			nShed += ShedReleasedVoices(m_pSecondarySynth, nShedTarget - nShed);
+
+		// Nothing left to release; lower the polyphony limit instead
+		if (nShed == 0)
+		{
+			const int nMinPolyphony = Utility::Max(m_nMaxPolyphony / 4, 1);
+			const int nStep = Utility::Max(m_nMaxPolyphony / 8, 1);
+			SetPolyphonyLimit(Utility::Max(nPolyphonyLimit - nStep, nMinPolyphony));
+		}
+
+		return;
+	}
+
+	// Restore the polyphony limit step by step once the load has stayed low for a while
+	if (nRenderTime * 100 >= nBlockTime * GovernorLowLoadPercent)
+	{
+		m_nLowLoadStartTime = nTicks;
+		return;
+	}
+
+	if (nPolyphonyLimit < m_nMaxPolyphony && nTicks - m_nLowLoadStartTime >= Utility::MillisToTicks(GovernorRestoreMillis))
+	{
+		const int nStep = Utility::Max(m_nMaxPolyphony / 8, 1);
+		SetPolyphonyLimit(Utility::Min(nPolyphonyLimit + nStep, m_nMaxPolyphony));
+		m_nLowLoadStartTime = nTicks;
+	}
+}
+
+size_t CSoundFontSynth::ShedReleasedVoices(fluid_synth_t* pSynth, size_t nMaxVoices)
+{
+	// Release time in timecents (1200 * log2(0.03)) that fades a voice out over about 30ms; short enough to free up
+	// voices within a few blocks, but long enough not to click
+	constexpr float FastReleaseTimecents = -6070.0f;
+
+	fluid_synth_get_voicelist(pSynth, m_pVoiceList, m_nVoiceListSize, -1);
+
+	// Gather voices that have been released and aren't held by a pedal or already being shed
+	size_t nCandidates = 0;
+	for (size_t i = 0; i < m_nVoiceListSize && m_pVoiceList[i]; ++i)
+	{
+		fluid_voice_t* pVoice = m_pVoiceList[i];
+		if (fluid_voice_is_on(pVoice) || fluid_voice_is_sustained(pVoice) || fluid_voice_is_sostenuto(pVoice))
+			continue;
+		if (fluid_voice_gen_get(pVoice, GEN_VOLENVRELEASE) <= FastReleaseTimecents)
+			continue;
+
+		m_pVoiceList[nCandidates++] = pVoice;
+	}
+
+	// FluidSynth doesn't expose the envelope level, so shed the oldest notes first; they've had the longest to decay
+	const size_t nShed = Utility::Min(nCandidates, nMaxVoices);
+	std::partial_sort(m_pVoiceList, m_pVoiceList + nShed, m_pVoiceList + nCandidates, [](fluid_voice_t* pA, fluid_voice_t* pB) {
+		return fluid_voice_get_id(pA) < fluid_voice_get_id(pB);
+	});
+
+	for (size_t i = 0; i < nShed; ++i)
+	{
+		fluid_voice_gen_set(m_pVoiceList[i], GEN_VOLENVRELEASE, FastReleaseTimecents);
+		fluid_voice_update_param(m_pVoiceList[i], GEN_VOLENVRELEASE);
+	}
+
+	m_nShedVoices.fetch_add(nShed, std::memory_order_relaxed);
+	return nShed;
+}
+
+void CSoundFontSynth::SetPolyphonyLimit(int nPolyphony)
+{
+	if (nPolyphony == m_nPolyphonyLimit.load(std::memory_order_relaxed))
+		return;
+
+	// FluidSynth immediately stops any voices above the new limit
+	m_nPolyphonyLimit.store(nPolyphony, std::memory_order_relaxed);
+	if (m_pSecondarySynth)
+	{
+		const int nSynthPolyphony = Utility::Max(nPolyphony / 2, 1);
+		fluid_synth_set_polyphony(m_pSynth, nSynthPolyphony);
+		fluid_synth_set_polyphony(m_pSecondarySynth, nSynthPolyphony);
+	}
+	else
+		fluid_synth_set_polyphony(m_pSynth, nPolyphony);
+}
+
 void CSoundFontSynth::ReportStatus() const
 {
 	if (m_pUI)
@@ -331,15 +753,30 @@ void CSoundFontSynth::UpdateLCD(CLCD& LCD, unsigned int nTicks)
 {
 	const u8 nBarHeight = LCD.Height();
 	float ChannelLevels[16], PeakLevels[16];
-	m_MIDIMonitor.GetChannelLevels(nTicks, ChannelLevels, PeakLevels, m_nPercussionMask);
+	m_MIDIMonitor.GetChannelLevels(nTicks, ChannelLevels, PeakLevels, m_nPercussionMask.load(std::memory_order_relaxed));
 	CUserInterface::DrawChannelLevels(LCD, nBarHeight, ChannelLevels, PeakLevels, 16, true);
 }
 
 bool CSoundFontSynth::SwitchSoundFont(size_t nIndex)
 {
+	// Pick this up once the switch in progress has finished
+	if (IsSwitchInProgress())
+	{
+		m_bSwitchDeferred = true;
+		m_nDeferredSoundFontIndex = nIndex;
+		return false;
+	}
+
 	// Is this SoundFont already active?
 	if (m_nCurrentSoundFontIndex == nIndex)
 	{
+		// Abandon a switch to another SoundFont that hasn't finished loading
+		if (m_bSwitchPending)
+		{
+			m_bSwitchPending = false;
+			m_pLoader->Cancel();
+		}
+
 		if (m_pUI)
 			m_pUI->ShowSystemMessage("Already selected!");
 		return false;
@@ -354,92 +791,588 @@ bool CSoundFontSynth::SwitchSoundFont(size_t nIndex)
 		return false;
 	}
 
+	// Already loaded in the background; swap it in straight away
+	TSoundFont SoundFont;
+	if (TakePreloaded(nIndex, SoundFont))
+	{
+		if (m_bSwitchPending)
+		{
+			m_bSwitchPending = false;
+			m_pLoader->Cancel();
+		}
+
+		ActivateSoundFont(nIndex, SoundFont);
+		return true;
+	}
+
 	if (m_pUI)
 		m_pUI->ShowSystemMessage("Loading SoundFont", true);
 
-	TFXProfile FXProfile = m_SoundFontManager.GetSoundFontFXProfile(nIndex);
+	// Free up memory held for SoundFonts that won't be neighbors of the new one; the current one keeps playing meanwhile
+	FreePreloaded(true, nIndex);
+	m_bSwitchPending = true;
+	m_nPendingSoundFontIndex = nIndex;
+	m_pLoader->Load(nIndex, pSoundFontPath);
 
-	// We can't use fluid_synth_sfunload() as we don't support the lazy SoundFont unload timer, so trash the entire synth and create a new one
-	if (!Reinitialize(pSoundFontPath, &FXProfile))
+	return false;
+}
+
+bool CSoundFontSynth::RescanSoundFonts()
+{
+	// Indices are about to change; anything loaded or loading in the background may now refer to a different file
+	if (m_pLoader)
+		m_pLoader->Cancel();
+	if (m_bSwitchPending)
 	{
+		m_bSwitchPending = false;
 		if (m_pUI)
-			m_pUI->ShowSystemMessage("SF switch failed!");
+			m_pUI->ClearSpinnerMessage();
+	}
+	m_bSwitchDeferred = false;
+
+	FreePreloaded(false);
+
+	return m_SoundFontManager.ScanSoundFonts();
+}
 
+bool CSoundFontSynth::Update()
+{
+	if (!m_pLoader)
 		return false;
+
+	const TSwapState SwapState = m_SwapState.load(std::memory_order_acquire);
+	if (SwapState == TSwapState::Prepared || SwapState == TSwapState::Queued)
+	{
+		if (CTimer::GetClockTicks() - m_nSwapPrepareTime < Utility::MillisToTicks(SwapTimeoutMillis))
+		{
+			// The MIDI event queue was full; try again
+			if (SwapState == TSwapState::Prepared)
+				QueueSwap();
+
+			return false;
+		}
+
+		// Not picked up by the render core, so this synth probably isn't being rendered (e.g. another synth is selected)
+		m_pLoader->LockSynth();
+		if (m_SwapState.load(std::memory_order_relaxed) != TSwapState::Applied)
+			SwapSoundFont();
+		m_pLoader->UnlockSynth();
 	}
 
-	m_nCurrentSoundFontIndex = nIndex;
+	if (m_SwapState.load(std::memory_order_acquire) == TSwapState::Applied)
+		FinishSwap();
+
+	// Stopped voices let go of the old SoundFont's samples during the next render; wait for that so that the memory is really free
+	if (m_bForegroundLoadPending)
+	{
+		if (m_pLoader->UnloadPendingSoundFonts())
+		{
+			if (CTimer::GetClockTicks() - m_nUnloadStartTime < Utility::MillisToTicks(UnloadTimeoutMillis))
+				return false;
+
+			LOGWARN("SoundFont still in use; loading the new one anyway");
+		}
+
+		m_bForegroundLoadPending = false;
+		return LoadSoundFontNow(m_nForegroundLoadIndex);
+	}
+
+	if (m_bSwitchDeferred)
+	{
+		m_bSwitchDeferred = false;
+		return SwitchSoundFont(m_nDeferredSoundFontIndex);
+	}
+
+	bool bSwitched = false;
+
+	size_t nIndex;
+	TSoundFont SoundFont;
+	if (m_pLoader->TakeResult(nIndex, SoundFont))
+	{
+		if (m_bSwitchPending && nIndex == m_nPendingSoundFontIndex)
+		{
+			m_bSwitchPending = false;
+
+			// Probably out of memory with two SoundFonts loaded; fall back on replacing the current one
+			if (SoundFont.pPrimary)
+			{
+				ActivateSoundFont(nIndex, SoundFont);
+				bSwitched = true;
+			}
+			else
+			{
+				LOGWARN("Background load failed; loading SoundFont in the foreground");
+				bSwitched = SwitchSoundFontNow(nIndex);
+			}
+		}
+		else if (SoundFont.pPrimary)
+		{
+			// Preloaded neighbor; discard it if the selection has moved on
+			if (!AddPreloaded(nIndex, SoundFont))
+				m_pLoader->FreeSoundFont(SoundFont);
+		}
+		else
+		{
+			// Don't keep retrying preloads that don't fit in memory
+			m_bPreloadFailed = true;
+		}
+	}
+
+	if (m_bPreloadNeighbors && !m_bPreloadFailed && !m_bSwitchPending && !IsSwitchInProgress() && !m_pLoader->IsBusy())
+		PreloadNeighbors();
+
+	return bSwitched;
+}
+
+bool CSoundFontSynth::SwitchSoundFontNow(size_t nIndex)
+{
+	if (!m_SoundFontManager.GetSoundFontPath(nIndex))
+		return false;
 
-	LOGNOTE("Loaded \"%s\"", m_SoundFontManager.GetSoundFontName(nIndex));
 	if (m_pUI)
-		m_pUI->ClearSpinnerMessage();
+		m_pUI->ShowSystemMessage("Loading SoundFont", true);
 
+	// Make as much memory available as possible
+	m_pLoader->Cancel();
+	FreePreloaded(false);
+
+	if (!m_SoundFont.pPrimary)
+		return LoadSoundFontNow(nIndex);
+
+	// Update() carries on with the load once the render core has removed the current SoundFont
+	UnloadSoundFont();
+	m_bForegroundLoadPending = true;
+	m_nForegroundLoadIndex = nIndex;
+	m_nUnloadStartTime = CTimer::GetClockTicks();
+
+	return false;
+}
+
+bool CSoundFontSynth::LoadSoundFontNow(size_t nIndex)
+{
+	const char* pSoundFontPath = m_SoundFontManager.GetSoundFontPath(nIndex);
+
+	TSoundFont SoundFont;
+	if (!pSoundFontPath || !m_pLoader->LoadNow(pSoundFontPath, SoundFont))
+	{
+		if (m_pUI)
+			m_pUI->ShowSystemMessage("SF switch failed!");
+
+		return false;
+	}
+
+	ActivateSoundFont(nIndex, SoundFont);
 	return true;
 }
 
-bool CSoundFontSynth::Reinitialize(const char* pSoundFontPath, const TFXProfile* pFXProfile)
+void CSoundFontSynth::ActivateSoundFont(size_t nIndex, const TSoundFont& SoundFont)
+{
+	PrepareSwap(nIndex, SoundFont);
+	QueueSwap();
+}
+
+void CSoundFontSynth::UnloadSoundFont()
+{
+	PrepareSwap(m_nCurrentSoundFontIndex, TSoundFont{});
+	QueueSwap();
+}
+
+void CSoundFontSynth::PrepareSwap(size_t nIndex, const TSoundFont& SoundFont)
 {
 	const CConfig* const pConfig = CConfig::Get();
 
-	m_Lock.Acquire();
+	// Prepare everything here so that the render core only has to swap the SoundFonts and apply the settings
+	m_Swap = TSoundFontSwap{};
+	m_Swap.nIndex = nIndex;
+	m_Swap.nOldIndex = m_nCurrentSoundFontIndex;
+	m_Swap.SoundFont = SoundFont;
+	m_Swap.OldSoundFont = m_SoundFont;
 
-	if (m_pSynth)
-		delete_fluid_synth(m_pSynth);
+	if (SoundFont.pPrimary)
+	{
+		m_Swap.FXProfile = m_SoundFontManager.GetSoundFontFXProfile(nIndex);
+		m_Swap.nInitialGain = m_Swap.FXProfile.nGain.ValueOr(pConfig->FluidSynthDefaultGain);
+		m_Swap.nPolyphony = m_nMaxPolyphony;
+	}
 
-	m_pSynth = new_fluid_synth(m_pSettings);
+	// The old SoundFont's presets are unpinned through the synth, so this has to happen before it's removed
+	if (m_pPresetCache && m_SoundFont.pPrimary)
+	{
+		m_pLoader->LockSynth();
+		m_pPresetCache->UnpinAll();
+		m_pPresetCache->SetSoundFont(m_pSynth, m_pSecondarySynth, TSoundFont{});
+		m_pLoader->UnlockSynth();
+	}
 
-	if (!m_pSynth)
+	m_SoundFont = SoundFont;
+	if (SoundFont.pPrimary)
+		m_nCurrentSoundFontIndex = nIndex;
+
+	ResetMIDIMonitor();
+	m_nRepinChannelMask = 0;
+	m_nSwapPrepareTime = CTimer::GetClockTicks();
+	m_SwapState.store(TSwapState::Prepared, std::memory_order_relaxed);
+}
+
+void CSoundFontSynth::QueueSwap()
+{
+	// Applied in order with the MIDI events already queued
+	if (m_MIDIEventQueue.EnqueueCommand(TMIDIEvent::TType::SwapSoundFont))
+		m_SwapState.store(TSwapState::Queued, std::memory_order_release);
+}
+
+void CSoundFontSynth::SwapSoundFont()
+{
+	const TSoundFontSwap& Swap = m_Swap;
+
+	if (Swap.SoundFont.pPrimary)
 	{
-		m_Lock.Release();
-		LOGERR("Failed to create synth");
-		return false;
+		ResetForSwitch(m_pSynth);
+		if (m_pSecondarySynth)
+			ResetForSwitch(m_pSecondarySynth);
+	}
+	else
+	{
+		fluid_synth_all_sounds_off(m_pSynth, -1);
+		if (m_pSecondarySynth)
+			fluid_synth_all_sounds_off(m_pSecondarySynth, -1);
+	}
+
+	// Voices hold references to the samples they're playing, so they carry on after their SoundFont is removed
+	if (Swap.OldSoundFont.pPrimary)
+	{
+		if (Swap.OldSoundFont.pSecondary)
+			fluid_synth_remove_sfont(m_pSecondarySynth, Swap.OldSoundFont.pSecondary);
+		fluid_synth_remove_sfont(m_pSynth, Swap.OldSoundFont.pPrimary);
 	}
 
-	fluid_synth_set_polyphony(m_pSynth, pConfig->FluidSynthPolyphony);
+	if (Swap.SoundFont.pPrimary)
+	{
+		const int nSynthPolyphony = m_pSecondarySynth ? Utility::Max(Swap.nPolyphony / 2, 1) : Swap.nPolyphony;
+
+		// Each synth gets its own instance; adding it selects its presets on every channel
+		fluid_synth_add_sfont(m_pSynth, Swap.SoundFont.pPrimary);
+		if (Swap.SoundFont.pSecondary)
+			fluid_synth_add_sfont(m_pSecondarySynth, Swap.SoundFont.pSecondary);
 
-	m_nInitialGain = pFXProfile->nGain.ValueOr(pConfig->FluidSynthDefaultGain);
-	fluid_synth_set_gain(m_pSynth, m_nVolume / 100.0f * m_nInitialGain);
+		// Reapply the effects profile in place; the reverb and chorus units are kept
+		ApplySettings(m_pSynth, &Swap.FXProfile, nSynthPolyphony, Swap.nInitialGain);
+		if (m_pSecondarySynth)
+			ApplySettings(m_pSecondarySynth, &Swap.FXProfile, nSynthPolyphony, Swap.nInitialGain);
 
-	// Use values from effects profile if set, otherwise use defaults
-	fluid_synth_reverb_on(m_pSynth, -1, pFXProfile->bReverbActive.ValueOr(pConfig->FluidSynthDefaultReverbActive));
-	fluid_synth_set_reverb_group_damp(m_pSynth, -1, pFXProfile->nReverbDamping.ValueOr(pConfig->FluidSynthDefaultReverbDamping));
-	fluid_synth_set_reverb_group_level(m_pSynth, -1, pFXProfile->nReverbLevel.ValueOr(pConfig->FluidSynthDefaultReverbLevel));
-	fluid_synth_set_reverb_group_roomsize(m_pSynth, -1, pFXProfile->nReverbRoomSize.ValueOr(pConfig->FluidSynthDefaultReverbRoomSize));
-	fluid_synth_set_reverb_group_width(m_pSynth, -1, pFXProfile->nReverbWidth.ValueOr(pConfig->FluidSynthDefaultReverbWidth));
-
-	fluid_synth_chorus_on(m_pSynth, -1, pFXProfile->bChorusActive.ValueOr(pConfig->FluidSynthDefaultChorusActive));
-	fluid_synth_set_chorus_group_depth(m_pSynth, -1, pFXProfile->nChorusDepth.ValueOr(pConfig->FluidSynthDefaultChorusDepth));
-	fluid_synth_set_chorus_group_level(m_pSynth, -1, pFXProfile->nChorusLevel.ValueOr(pConfig->FluidSynthDefaultChorusLevel));
-	fluid_synth_set_chorus_group_nr(m_pSynth, -1, pFXProfile->nChorusVoices.ValueOr(pConfig->FluidSynthDefaultChorusVoices));
-	fluid_synth_set_chorus_group_speed(m_pSynth, -1, pFXProfile->nChorusSpeed.ValueOr(pConfig->FluidSynthDefaultChorusSpeed));
+		m_nInitialGain = Swap.nInitialGain;
+		m_nPolyphonyLimit = Swap.nPolyphony;
+		m_nLowLoadStartTime = CTimer::GetClockTicks();
+	}
+
+	m_SwapState.store(TSwapState::Applied, std::memory_order_release);
+}
+
+void CSoundFontSynth::FinishSwap()
+{
+	const TSoundFontSwap Swap = m_Swap;
+
+	if (Swap.SoundFont.pPrimary)
+	{
+		if (m_pPresetCache)
+		{
+			m_pPresetCache->SetSoundFont(m_pSynth, m_pSecondarySynth, Swap.SoundFont);
+
+			// The render core holds these program changes until their presets are pinned
+			for (u8 nChannel = 0; nChannel < 16; ++nChannel)
+			{
+				if (m_nRepinChannelMask & (1 << nChannel))
+					PinProgram(nChannel, m_RepinBanks[nChannel], m_RepinPrograms[nChannel]);
+			}
+		}
 
 #ifndef NDEBUG
-	DumpFXSettings();
+		DumpFXSettings();
 #endif
+	}
 
-	ResetMIDIMonitor();
+	m_nRepinChannelMask = 0;
+	m_SwapState.store(TSwapState::None, std::memory_order_release);
 
-	m_Lock.Release();
+	if (Swap.SoundFont.pPrimary)
+		m_bPreloadFailed = false;
 
-	const unsigned int nLoadStart = CTimer::GetClockTicks();
+	if (Swap.OldSoundFont.pPrimary)
+	{
+		if (Swap.SoundFont.pPrimary)
+			RetireSoundFont(Swap.nOldIndex, Swap.OldSoundFont);
+		else
+			m_pLoader->FreeSoundFont(Swap.OldSoundFont);
+	}
 
-	if (fluid_synth_sfload(m_pSynth, pSoundFontPath, true) == FLUID_FAILED)
+	if (Swap.SoundFont.pPrimary)
 	{
-		LOGERR("Failed to load SoundFont");
+		LOGNOTE("Loaded \"%s\"", m_SoundFontManager.GetSoundFontName(Swap.nIndex));
+		if (m_pUI)
+			m_pUI->ClearSpinnerMessage();
+	}
+}
+
+void CSoundFontSynth::RetireSoundFont(size_t nIndex, const TSoundFont& SoundFont)
+{
+	// Keep it loaded if it's likely to be selected next
+	if (m_bPreloadNeighbors && AddPreloaded(nIndex, SoundFont))
+		return;
+
+	m_pLoader->FreeSoundFont(SoundFont);
+}
+
+bool CSoundFontSynth::IsNeighbor(size_t nIndex, size_t nCenterIndex) const
+{
+	const size_t nSoundFonts = m_SoundFontManager.GetSoundFontCount();
+	if (nIndex >= nSoundFonts || nCenterIndex >= nSoundFonts || nIndex == nCenterIndex)
+		return false;
+
+	// The UI wraps around at either end of the list
+	return nIndex == (nCenterIndex + 1) % nSoundFonts || nIndex == (nCenterIndex + nSoundFonts - 1) % nSoundFonts;
+}
+
+void CSoundFontSynth::PreloadNeighbors()
+{
+	const size_t nSoundFonts = m_SoundFontManager.GetSoundFontCount();
+	if (nSoundFonts < 2 || m_nCurrentSoundFontIndex >= nSoundFonts)
+		return;
+
+	FreePreloaded(true, m_nCurrentSoundFontIndex);
+
+	// Load one at a time, next SoundFont first
+	const size_t Neighbors[] = { (m_nCurrentSoundFontIndex + 1) % nSoundFonts, (m_nCurrentSoundFontIndex + nSoundFonts - 1) % nSoundFonts };
+	for (size_t nIndex : Neighbors)
+	{
+		bool bLoaded = nIndex == m_nCurrentSoundFontIndex;
+		for (const TPreloadedSoundFont& Slot : m_Preloaded)
+			bLoaded |= Slot.SoundFont.pPrimary && Slot.nIndex == nIndex;
+
+		if (!bLoaded)
+		{
+			m_pLoader->Load(nIndex, m_SoundFontManager.GetSoundFontPath(nIndex));
+			return;
+		}
+	}
+}
+
+bool CSoundFontSynth::AddPreloaded(size_t nIndex, const TSoundFont& SoundFont)
+{
+	if (!IsNeighbor(nIndex, m_nCurrentSoundFontIndex))
+		return false;
+
+	TPreloadedSoundFont* pFreeSlot = nullptr;
+	for (TPreloadedSoundFont& Slot : m_Preloaded)
+	{
+		if (!Slot.SoundFont.pPrimary)
+			pFreeSlot = &Slot;
+		else if (Slot.nIndex == nIndex)
+			return false;
+	}
+
+	if (!pFreeSlot)
+		return false;
+
+	pFreeSlot->nIndex = nIndex;
+	pFreeSlot->SoundFont = SoundFont;
+	return true;
+}
+
+bool CSoundFontSynth::TakePreloaded(size_t nIndex, TSoundFont& SoundFont)
+{
+	for (TPreloadedSoundFont& Slot : m_Preloaded)
+	{
+		if (Slot.SoundFont.pPrimary && Slot.nIndex == nIndex)
+		{
+			SoundFont = Slot.SoundFont;
+			Slot.SoundFont = TSoundFont{};
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CSoundFontSynth::FreePreloaded(bool bKeepNeighbors, size_t nCenterIndex)
+{
+	for (TPreloadedSoundFont& Slot : m_Preloaded)
+	{
+		if (Slot.SoundFont.pPrimary && !(bKeepNeighbors && IsNeighbor(Slot.nIndex, nCenterIndex)))
+		{
+			m_pLoader->FreeSoundFont(Slot.SoundFont);
+			Slot.SoundFont = TSoundFont{};
+		}
+	}
+}
+
+bool CSoundFontSynth::CreateSynths()
+{
+	const CConfig* const pConfig = CConfig::Get();
+
+	m_pSynth = new_fluid_synth(m_pSettings);
+	if (!m_pSynth)
+	{
+		LOGERR("Failed to create synth");
 		return false;
 	}
 
-	const float nLoadTime = (CTimer::GetClockTicks() - nLoadStart) / 1000000.0f;
-	LOGNOTE("\"%s\" loaded in %0.2f seconds", pSoundFontPath, nLoadTime);
+	if (pConfig->FluidSynthParallelRender && m_pRenderHelper)
+	{
+		m_pSecondarySynth = new_fluid_synth(m_pSettings);
+		if (!m_pSecondarySynth)
+			LOGWARN("Failed to create secondary synth; parallel rendering disabled");
+	}
 
 	return true;
 }
 
+void CSoundFontSynth::ResetForSwitch(fluid_synth_t* pSynth)
+{
+	// Start from a clean state, as if the synth had just been created
+	if (!m_nCrossfadeMillis)
+	{
+		fluid_synth_system_reset(pSynth);
+		return;
+	}
+
+	// Shorten the release of every voice to the crossfade time
+	const float nReleaseTimecents = 1200.0f * log2f(m_nCrossfadeMillis / 1000.0f);
+	fluid_synth_get_voicelist(pSynth, m_pVoiceList, m_nVoiceListSize, -1);
+	for (size_t i = 0; i < m_nVoiceListSize && m_pVoiceList[i]; ++i)
+	{
+		if (fluid_voice_gen_get(m_pVoiceList[i], GEN_VOLENVRELEASE) > nReleaseTimecents)
+		{
+			fluid_voice_gen_set(m_pVoiceList[i], GEN_VOLENVRELEASE, nReleaseTimecents);
+			fluid_voice_update_param(m_pVoiceList[i], GEN_VOLENVRELEASE);
+		}
+	}
+
+	// Reset the channels like a system reset would, but release the voices instead of cutting them off
+	for (int nChannel = 0; nChannel < 16; ++nChannel)
+	{
+		fluid_synth_cc(pSynth, nChannel, 64, 0);
+		fluid_synth_cc(pSynth, nChannel, 66, 0);
+		fluid_synth_cc(pSynth, nChannel, 121, 0);
+		fluid_synth_set_channel_type(pSynth, nChannel, nChannel == 9 ? CHANNEL_TYPE_DRUM : CHANNEL_TYPE_MELODIC);
+		fluid_synth_bank_select(pSynth, nChannel, 0);
+		fluid_synth_program_change(pSynth, nChannel, 0);
+	}
+
+	fluid_synth_all_notes_off(pSynth, -1);
+}
+
+void CSoundFontSynth::ApplySettings(fluid_synth_t* pSynth, const TFXProfile* pFXProfile, int nPolyphony, float nInitialGain)
+{
+	const CConfig* const pConfig = CConfig::Get();
+
+	// In parallel mode, voices are shared equally between both synths
+	fluid_synth_set_polyphony(pSynth, nPolyphony);
+
+	fluid_synth_set_gain(pSynth, m_nVolume / 100.0f * nInitialGain);
+
+	// Use values from effects profile if set, otherwise use defaults
+	fluid_synth_reverb_on(pSynth, -1, pFXProfile->bReverbActive.ValueOr(pConfig->FluidSynthDefaultReverbActive));
+	fluid_synth_set_reverb_group_damp(pSynth, -1, pFXProfile->nReverbDamping.ValueOr(pConfig->FluidSynthDefaultReverbDamping));
+	fluid_synth_set_reverb_group_level(pSynth, -1, pFXProfile->nReverbLevel.ValueOr(pConfig->FluidSynthDefaultReverbLevel));
+	fluid_synth_set_reverb_group_roomsize(pSynth, -1, pFXProfile->nReverbRoomSize.ValueOr(pConfig->FluidSynthDefaultReverbRoomSize));
+	fluid_synth_set_reverb_group_width(pSynth, -1, pFXProfile->nReverbWidth.ValueOr(pConfig->FluidSynthDefaultReverbWidth));
+
+	fluid_synth_chorus_on(pSynth, -1, pFXProfile->bChorusActive.ValueOr(pConfig->FluidSynthDefaultChorusActive));
+	fluid_synth_set_chorus_group_depth(pSynth, -1, pFXProfile->nChorusDepth.ValueOr(pConfig->FluidSynthDefaultChorusDepth));
+	fluid_synth_set_chorus_group_level(pSynth, -1, pFXProfile->nChorusLevel.ValueOr(pConfig->FluidSynthDefaultChorusLevel));
+	fluid_synth_set_chorus_group_nr(pSynth, -1, pFXProfile->nChorusVoices.ValueOr(pConfig->FluidSynthDefaultChorusVoices));
+	fluid_synth_set_chorus_group_speed(pSynth, -1, pFXProfile->nChorusSpeed.ValueOr(pConfig->FluidSynthDefaultChorusSpeed));
+}
+
+void CSoundFontSynth::DeleteSynths()
+{
+	// Each synth frees its own instance of the SoundFont
+	if (m_pSecondarySynth)
+	{
+		delete_fluid_synth(m_pSecondarySynth);
+		m_pSecondarySynth = nullptr;
+	}
+
+	if (m_pSynth)
+	{
+		delete_fluid_synth(m_pSynth);
+		m_pSynth = nullptr;
+	}
+
+	m_SoundFont = TSoundFont{};
+}
+
+fluid_synth_t* CSoundFontSynth::GetNoteOnSynth(u8 nChannel)
+{
+	// Keep percussion on one synth so that exclusive classes (e.g. open/closed hi-hats) still cut each other off
+	if (m_nPercussionMask.load(std::memory_order_relaxed) & (1 << nChannel))
+		return m_pSynth;
+
+	// Otherwise balance the load by voice count
+	const int nVoices = fluid_synth_get_active_voice_count(m_pSynth);
+	const int nSecondaryVoices = fluid_synth_get_active_voice_count(m_pSecondarySynth);
+	return nSecondaryVoices < nVoices ? m_pSecondarySynth : m_pSynth;
+}
+
 void CSoundFontSynth::ResetMIDIMonitor()
 {
 	m_MIDIMonitor.AllNotesOff();
 	m_MIDIMonitor.ResetControllers(false);
-	m_nPercussionMask = 1 << 9;
+	m_nPercussionMask.store(1 << 9, std::memory_order_relaxed);
+
+	// Channels are back on the default presets
+	memset(m_BankMSB, 0, sizeof(m_BankMSB));
+	if (m_pPresetCache)
+		m_pPresetCache->ResetChannels();
+}
+
+void CSoundFontSynth::PrepareProgramChange(u32 nMessage)
+{
+	const u8 nStatus  = nMessage & 0xFF;
+	const u8 nChannel = nMessage & 0x0F;
+	const u8 nData1   = (nMessage >> 8) & 0xFF;
+	const u8 nData2   = (nMessage >> 16) & 0xFF;
+
+	if (nStatus == 0xFF)
+	{
+		memset(m_BankMSB, 0, sizeof(m_BankMSB));
+		m_pPresetCache->ResetChannels();
+		m_nRepinChannelMask = 0;
+		return;
+	}
+
+	// Bank select MSB; FluidSynth's default GS bank select style ignores the LSB
+	if ((nStatus & 0xF0) == 0xB0 && nData1 == 0x00)
+	{
+		m_BankMSB[nChannel] = nData2;
+		return;
+	}
+
+	if ((nStatus & 0xF0) != 0xC0)
+		return;
+
+	// The new SoundFont can't be pinned through the synth until the render core has swapped it in
+	if (m_SwapState.load(std::memory_order_relaxed) != TSwapState::None)
+	{
+		m_nRepinChannelMask |= 1 << nChannel;
+		m_RepinBanks[nChannel] = m_BankMSB[nChannel];
+		m_RepinPrograms[nChannel] = nData1;
+		return;
+	}
+
+	PinProgram(nChannel, m_BankMSB[nChannel], nData1);
+}
+
+void CSoundFontSynth::PinProgram(u8 nChannel, int nBank, int nProgram)
+{
+	if (m_pPresetCache->Lookup(nChannel, m_nPercussionMask.load(std::memory_order_relaxed) & (1 << nChannel), nBank, nProgram))
+		return;
+
+	// Voices ending on the render core unload samples through the same counters and sample cache that pinning updates,
+	// and FluidSynth doesn't lock them; rendering stalls until the samples are loaded
+	m_pLoader->LockSynth();
+	m_pPresetCache->Pin(nChannel, nBank, nProgram);
+	m_pLoader->UnlockSynth();
 }
 
 #ifndef NDEBUG
@@ -536,7 +1469,8 @@ bool CSoundFontSynth::ParseRolandSysEx(const u8* pData, size_t nSize)
 			// TODO: If FluidSynth had an API to query the channel mode we wouldn't need to keep track of it
 			const u8 nChannel = Header.Address[1] & 0x0F;
 			const u8 nMode    = *pRolandData ? 1 : 0;
-			m_nPercussionMask ^= (-nMode ^ m_nPercussionMask) & (1 << nChannel);
+			const u16 nPercussionMask = m_nPercussionMask.load(std::memory_order_relaxed);
+			m_nPercussionMask.store(nPercussionMask ^ ((-nMode ^ nPercussionMask) & (1 << nChannel)), std::memory_order_relaxed);
 
 			// Don't consume; forward to FluidSynth
 			return false;
@@ -0,0 +1,225 @@
+//
+// splitsynth.cpp
+//
+// mt32-pi - A baremetal MIDI synthesizer for Raspberry Pi
+// Copyright (C) 2020-2023 Dale Whinham <daleyo@gmail.com>
+//
+// This file is part of mt32-pi.
+//
+// mt32-pi is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// mt32-pi is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+// details.
+//
+// You should have received a copy of the GNU General Public License along with
+// mt32-pi. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <circle/logger.h>
+
+#include "audio/mix.h"
+#include "config.h"
+#include "lcd/ui.h"
+#include "synth/rolandsysex.h"
+#include "synth/splitsynth.h"
+#include "utility.h"
+
+LOGMODULE("splitsynth");
+
+constexpr size_t CSplitSynth::RenderFrames;
+
+CSplitSynth::CSplitSynth(unsigned nSampleRate, CMT32Synth* pMT32Synth, CSoundFontSynth* pSoundFontSynth)
+	: CSynthBase(nSampleRate),
+
+	  m_pMT32Synth(pMT32Synth),
+	  m_pSoundFontSynth(pSoundFontSynth),
+
+	  m_pSysExFragmentSynth(nullptr),
+
+	  m_nMT32ChannelMask(0x01FF),
+	  m_nMT32Gain(1.0f),
+	  m_nSoundFontGain(1.0f),
+
+	  m_nSoundFontFrames(0),
+	  m_SoundFontBuffer{}
+{
+}
+
+bool CSplitSynth::Initialize()
+{
+	const CConfig* const pConfig = CConfig::Get();
+
+	if (!m_pMT32Synth || !m_pSoundFontSynth)
+		return false;
+
+	// Config uses 1-based channel numbers
+	const int nFirstChannel = Utility::Clamp(pConfig->SplitMT32FirstChannel, 1, 16) - 1;
+	const int nLastChannel = Utility::Clamp(pConfig->SplitMT32LastChannel, 1, 16) - 1;
+
+	m_nMT32ChannelMask = 0;
+	for (int nChannel = nFirstChannel; nChannel <= nLastChannel; ++nChannel)
+		m_nMT32ChannelMask |= 1 << nChannel;
+
+	m_nMT32Gain = pConfig->SplitMT32Gain;
+	m_nSoundFontGain = pConfig->SplitSoundFontGain;
+
+	LOGNOTE("MT-32 on channels %d-%d, SoundFont on remaining channels", nFirstChannel + 1, nLastChannel + 1);
+
+	return true;
+}
+
+void CSplitSynth::HandleMIDIShortMessage(u32 nMessage, u32 nTimestamp)
+{
+	const u8 nStatus  = nMessage & 0xFF;
+	const u8 nChannel = nMessage & 0x0F;
+
+	// System messages go to both synths
+	if (nStatus >= 0xF0)
+	{
+		m_pMT32Synth->HandleMIDIShortMessage(nMessage, nTimestamp);
+		m_pSoundFontSynth->HandleMIDIShortMessage(nMessage, nTimestamp);
+	}
+	else if (m_nMT32ChannelMask & (1 << nChannel))
+		m_pMT32Synth->HandleMIDIShortMessage(nMessage, nTimestamp);
+	else
+		m_pSoundFontSynth->HandleMIDIShortMessage(nMessage, nTimestamp);
+
+	// Update MIDI monitor
+	CSynthBase::HandleMIDIShortMessage(nMessage, nTimestamp);
+}
+
+void CSplitSynth::HandleMIDISysExMessage(const u8* pData, size_t nSize, u32 nTimestamp)
+{
+	// MT-32 SysEx goes to the MT-32; GM/GS/XG and anything else to the SoundFont synth
+	if (IsMT32SysEx(pData, nSize))
+		m_pMT32Synth->HandleMIDISysExMessage(pData, nSize, nTimestamp);
+	else
+		m_pSoundFontSynth->HandleMIDISysExMessage(pData, nSize, nTimestamp);
+}
+
+void CSplitSynth::HandleMIDISysExFragment(const u8* pData, size_t nSize, TSysExFragment Fragment, u32 nTimestamp)
+{
+	// Route the whole message according to its header, which is only in the first fragment
+	if (Fragment == TSysExFragment::Begin)
+		m_pSysExFragmentSynth = IsMT32SysEx(pData, nSize) ? static_cast<CSynthBase*>(m_pMT32Synth) : m_pSoundFontSynth;
+
+	if (!m_pSysExFragmentSynth)
+		return;
+
+	m_pSysExFragmentSynth->HandleMIDISysExFragment(pData, nSize, Fragment, nTimestamp);
+
+	if (Fragment == TSysExFragment::End || Fragment == TSysExFragment::Abort)
+		m_pSysExFragmentSynth = nullptr;
+}
+
+bool CSplitSynth::IsActive()
+{
+	return m_pMT32Synth->IsActive() || m_pSoundFontSynth->IsActive();
+}
+
+void CSplitSynth::AllSoundOff()
+{
+	m_pMT32Synth->AllSoundOff();
+	m_pSoundFontSynth->AllSoundOff();
+
+	// Reset MIDI monitor
+	CSynthBase::AllSoundOff();
+}
+
+void CSplitSynth::SetMasterVolume(u8 nVolume)
+{
+	m_pMT32Synth->SetMasterVolume(nVolume);
+	m_pSoundFontSynth->SetMasterVolume(nVolume);
+}
+
+void CSplitSynth::RenderSoundFontJob(void* pParam)
+{
+	CSplitSynth* pThis = static_cast<CSplitSynth*>(pParam);
+	pThis->m_pSoundFontSynth->Render(pThis->m_SoundFontBuffer, pThis->m_nSoundFontFrames);
+}
+
+size_t CSplitSynth::Render(float* pOutBuffer, size_t nFrames)
+{
+	size_t nRemaining = nFrames;
+	float* pOut = pOutBuffer;
+
+	while (nRemaining)
+	{
+		const size_t nChunkFrames = Utility::Min(nRemaining, RenderFrames);
+
+		// Render the SoundFont synth on the helper core (if available) while we render the MT-32
+		m_nSoundFontFrames = nChunkFrames;
+		const bool bSubmitted = m_pRenderHelper && m_pRenderHelper->Submit(RenderSoundFontJob, this);
+		m_pMT32Synth->Render(pOut, nChunkFrames);
+
+		if (bSubmitted)
+			m_pRenderHelper->Wait();
+		else
+			RenderSoundFontJob(this);
+
+		Audio::Mix(pOut, m_nMT32Gain, m_SoundFontBuffer, m_nSoundFontGain, nChunkFrames * 2);
+
+		pOut += nChunkFrames * 2;
+		nRemaining -= nChunkFrames;
+	}
+
+	return nFrames;
+}
+
+size_t CSplitSynth::Render(s16* pOutBuffer, size_t nFrames)
+{
+	// Not used for audio output; render sequentially
+	s16* pSoundFontBuffer = reinterpret_cast<s16*>(m_SoundFontBuffer);
+	size_t nRemaining = nFrames;
+	s16* pOut = pOutBuffer;
+
+	while (nRemaining)
+	{
+		const size_t nChunkFrames = Utility::Min(nRemaining, RenderFrames);
+
+		m_pMT32Synth->Render(pOut, nChunkFrames);
+		m_pSoundFontSynth->Render(pSoundFontBuffer, nChunkFrames);
+
+		for (size_t i = 0; i < nChunkFrames * 2; ++i)
+		{
+			const float nSample = pOut[i] * m_nMT32Gain + pSoundFontBuffer[i] * m_nSoundFontGain;
+			pOut[i] = Utility::Clamp(nSample, -32768.0f, 32767.0f);
+		}
+
+		pOut += nChunkFrames * 2;
+		nRemaining -= nChunkFrames;
+	}
+
+	return nFrames;
+}
+
+void CSplitSynth::ReportStatus() const
+{
+	if (m_pUI)
+		m_pUI->ShowSystemMessage("MT-32 + SoundFont");
+}
+
+void CSplitSynth::UpdateLCD(CLCD& LCD, unsigned int nTicks)
+{
+	const u8 nBarHeight = LCD.Height();
+	float ChannelLevels[16], PeakLevels[16];
+
+	// Percussion is on channel 10 for both MT-32 and GM
+	m_MIDIMonitor.GetChannelLevels(nTicks, ChannelLevels, PeakLevels, 1 << 9);
+	CUserInterface::DrawChannelLevels(LCD, nBarHeight, ChannelLevels, PeakLevels, 16, true);
+}
+
+bool CSplitSynth::IsMT32SysEx(const u8* pData, size_t nSize) const
+{
+	// Must be at least size of header plus Start/End of Exclusive bytes
+	if (nSize < sizeof(TRolandSysExHeader) + 2)
+		return false;
+
+	const auto& Header = reinterpret_cast<const TRolandSysExHeader&>(pData[1]);
+	return Header.ManufacturerID == TManufacturerID::Roland && Header.ModelID == TRolandModelID::MT32;
+}
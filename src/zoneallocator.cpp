@@ -40,7 +40,9 @@ CZoneAllocator::CZoneAllocator()
 	: m_pHeap(nullptr),
 	  m_nHeapSize(0),
 	  m_pCurrentBlock(nullptr),
-	  m_nAllocCount(0)
+	  m_nAllocCount(0),
+	  m_nUsedSize(0),
+	  m_Lock(TASK_LEVEL)
 {
 	assert(s_pThis == nullptr);
 	s_pThis = this;
@@ -104,6 +106,31 @@ bool CZoneAllocator::Initialize()
 }
 
 void* CZoneAllocator::Alloc(size_t nSize, TZoneTag Tag)
+{
+	m_Lock.Acquire();
+	void* pPtr = AllocBlock(nSize, Tag);
+	m_Lock.Release();
+
+	return pPtr;
+}
+
+void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
+{
+	m_Lock.Acquire();
+	void* pNewPtr = ReallocBlock(pPtr, nSize, Tag);
+	m_Lock.Release();
+
+	return pNewPtr;
+}
+
+void CZoneAllocator::Free(void* pPtr)
+{
+	m_Lock.Acquire();
+	FreeBlock(pPtr);
+	m_Lock.Release();
+}
+
+void* CZoneAllocator::AllocBlock(size_t nSize, TZoneTag Tag)
 {
 	if (!nSize)
 		return nullptr;
@@ -173,15 +200,16 @@ void* CZoneAllocator::Alloc(size_t nSize, TZoneTag Tag)
 
 	// Increment alloc counter
 	++m_nAllocCount;
+	m_nUsedSize += pCandidateBlock->nSize;
 
 	return pCandidateBlock + 1;
 }
 
-void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
+void* CZoneAllocator::ReallocBlock(void* pPtr, size_t nSize, TZoneTag Tag)
 {
 	// If passed a null pointer, perform a new allocation
 	if (!pPtr)
-		return Alloc(nSize, Tag);
+		return AllocBlock(nSize, Tag);
 
 	if (!nSize)
 		return nullptr;
@@ -227,6 +255,7 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 			if (pBlock->pNext == m_pCurrentBlock)
 				m_pCurrentBlock = pNewBlock;
 
+			m_nUsedSize += nNewSize - pBlock->nSize;
 			pBlock->nSize       = nNewSize;
 			pBlock->pNext       = pNewBlock;
 			pBlock->Tag         = Tag;
@@ -243,7 +272,7 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 		else
 		{
 			const size_t nSrcSize = pBlock->nSize - sizeof(TBlock) - sizeof(BlockMagic);
-			void* pDest           = Alloc(nSize, Tag);
+			void* pDest           = AllocBlock(nSize, Tag);
 
 			if (!pDest)
 			{
@@ -252,7 +281,7 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 			}
 
 			memcpy(pDest, pPtr, nSrcSize);
-			Free(pPtr);
+			FreeBlock(pPtr);
 
 #ifdef ZONE_ALLOCATOR_TRACE
 			LOGDBG("Expanded block at %p by allocating new block", pPtr);
@@ -306,6 +335,7 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 			pBlock->pNext = pNewBlock;
 		}
 
+		m_nUsedSize -= pBlock->nSize - nNewSize;
 		pBlock->nSize = nNewSize;
 		pBlock->Tag   = Tag;
 
@@ -320,7 +350,7 @@ void* CZoneAllocator::Realloc(void* pPtr, size_t nSize, TZoneTag Tag)
 	return pPtr;
 }
 
-void CZoneAllocator::Free(void* pPtr)
+void CZoneAllocator::FreeBlock(void* pPtr)
 {
 	if (!pPtr)
 		return;
@@ -341,6 +371,7 @@ void CZoneAllocator::Free(void* pPtr)
 
 	// Mark this block as free
 	pBlock->Tag = TZoneTag::Free;
+	m_nUsedSize -= pBlock->nSize;
 
 	// Join with previous block if previous block is also free
 	TBlock* pAdjacentBlock = pBlock->pPrevious;
@@ -401,6 +432,7 @@ void CZoneAllocator::Clear()
 #endif
 
 	m_pCurrentBlock = pFirstBlock;
+	m_nUsedSize = 0;
 }
 
 void CZoneAllocator::FreeTag(u32 Tag)
@@ -411,6 +443,8 @@ void CZoneAllocator::FreeTag(u32 Tag)
 		return;
 	}
 
+	m_Lock.Acquire();
+
 	TBlock* pBlock = m_MainBlock.pNext;
 	TBlock* pNextBlock;
 
@@ -419,9 +453,11 @@ void CZoneAllocator::FreeTag(u32 Tag)
 		// Grab the next block before freeing this one
 		pNextBlock = pBlock->pNext;
 		if (pBlock->Tag == Tag)
-			Free(reinterpret_cast<u8*>(pBlock) + sizeof(TBlock));
+			FreeBlock(reinterpret_cast<u8*>(pBlock) + sizeof(TBlock));
 		pBlock = pNextBlock;
 	} while (pBlock != &m_MainBlock);
+
+	m_Lock.Release();
 }
 
 void CZoneAllocator::Dump() const